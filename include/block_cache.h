@@ -0,0 +1,29 @@
+// include/block_cache.h
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Unit of caching: version contents are cached in blocks of this size,
+// the last block of a version being shorter.
+#define BLOCK_CACHE_BLOCK_SIZE (64 * 1024)
+#define BLOCK_CACHE_SHARDS 16
+#define BLOCK_CACHE_DEFAULT_BUDGET ((size_t) 256 * 1024 * 1024)
+
+typedef struct CacheBlock CacheBlock;
+
+// Memory cache of decoded version contents keyed by (file, version, block
+// index), shared by every handle. Versions never change once written, so
+// entries only go away on eviction (CLOCK, within a fixed byte budget) or
+// when the file is removed. Blocks are returned pinned: their data stays
+// valid until block_cache_unpin.
+void block_cache_set_budget(size_t bytes);
+size_t block_cache_budget(void);
+CacheBlock *block_cache_get(const char *filename, int version_id, uint64_t block);
+CacheBlock *block_cache_put(const char *filename, int version_id, uint64_t block, char *data, size_t size);
+const char *block_cache_data(const CacheBlock *entry, size_t *size);
+void block_cache_unpin(CacheBlock *entry);
+void block_cache_invalidate(const char *filename);
+
+#endif // BLOCK_CACHE_H
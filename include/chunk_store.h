@@ -0,0 +1,38 @@
+// include/chunk_store.h
+#ifndef CHUNK_STORE_H
+#define CHUNK_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "sha256.h"
+
+#define CHUNKS_DIR ".versions/.chunks"
+
+// Set in a chunk reference when the stored chunk carries a codec header.
+// Chunks written before compression existed are plain bytes.
+#define CHUNK_REF_ENCODED 0x1
+
+// Content-addressed store: every unique chunk is kept once, named by the
+// SHA-256 of its raw bytes, and shared by all versions of all files that
+// contain it. put reports through flags how the stored copy is encoded.
+int chunk_store_put(const char *data, size_t size, unsigned char hash[SHA256_DIGEST_SIZE], uint32_t *flags);
+int chunk_store_read(const unsigned char hash[SHA256_DIGEST_SIZE], uint32_t flags, size_t length,
+                     size_t offset, size_t size, char *buf);
+int chunk_store_locate(const unsigned char hash[SHA256_DIGEST_SIZE], uint32_t flags, size_t length,
+                       int *fd, int *slot, off_t *data_offset);
+int chunk_store_contains(const unsigned char hash[SHA256_DIGEST_SIZE], uint32_t flags, size_t length);
+void chunk_store_path(const unsigned char hash[SHA256_DIGEST_SIZE], char *path, size_t path_size);
+
+// Chunks are not reference counted. Garbage is collected by marking every
+// chunk some version still refers to in a set, then sweeping the store of
+// the rest. Nothing may put chunks while a collection runs: a chunk that
+// is stored but not yet in a manifest looks like garbage.
+typedef struct ChunkSet ChunkSet;
+
+ChunkSet *chunk_set_create(void);
+void chunk_set_destroy(ChunkSet *set);
+int chunk_set_add(ChunkSet *set, const unsigned char hash[SHA256_DIGEST_SIZE]);
+long chunk_store_sweep(const ChunkSet *live);
+
+#endif // CHUNK_STORE_H
@@ -0,0 +1,16 @@
+// include/chunker.h
+#ifndef CHUNKER_H
+#define CHUNKER_H
+
+#include <stddef.h>
+
+// FastCDC parameters: chunks are cut where a gear rolling hash matches a
+// mask, so boundaries follow content and survive insertions upstream.
+#define CHUNK_MIN_SIZE (2 * 1024)
+#define CHUNK_AVG_SIZE (8 * 1024)
+#define CHUNK_MAX_SIZE (64 * 1024)
+
+// Length of the chunk starting at data, never more than size.
+size_t chunker_next_cut(const unsigned char *data, size_t size);
+
+#endif // CHUNKER_H
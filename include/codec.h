@@ -0,0 +1,31 @@
+// include/codec.h
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Codec IDs as recorded in blob headers. Stored blobs keep their codec, so
+// changing the default never makes older data unreadable.
+#define CODEC_NONE 0
+#define CODEC_FAST 1  // zstd negative level, LZ4-class speed
+#define CODEC_DENSE 2 // zstd mid level, for stores that are I/O bound
+
+#define CODEC_MAGIC "VFSZ"
+
+// Header written in front of every encoded blob.
+typedef struct {
+    char magic[4];
+    uint8_t codec;
+    uint8_t reserved[3];
+    uint64_t raw_size;
+    uint64_t stored_size;
+} BlobHeader;
+
+void codec_set_default(int codec);
+int codec_from_name(const char *name);
+int codec_encode(const char *data, size_t size, char **out, size_t *out_size);
+int codec_is_blob(const char *blob, size_t blob_size, size_t raw_size);
+int codec_decode(const char *blob, size_t blob_size, char *out, size_t out_size);
+
+#endif // CODEC_H
@@ -0,0 +1,42 @@
+// include/delta.h
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary deltas in a VCDIFF-like copy/add encoding. A delta is a varint
+// target size followed by instructions: COPY (source offset, length) reuses
+// bytes of the source, ADD (length, bytes) carries new bytes inline.
+#define DELTA_OP_COPY 1
+#define DELTA_OP_ADD 2
+
+// One decoded instruction, positioned in the target so a range of the
+// target can be rebuilt without replaying the whole delta.
+typedef struct {
+    int op;
+    uint64_t target_offset;
+    uint64_t length;
+    uint64_t source_offset; // COPY: offset in the source
+    uint64_t delta_offset;  // ADD: offset of the bytes in the delta
+} DeltaOp;
+
+// A delta being written instruction by instruction, for callers that
+// already know which parts of the target are copies of the source.
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+    uint64_t target_size;
+    uint64_t written;
+} DeltaBuilder;
+
+int delta_encode(const char *source, size_t source_size, const char *target, size_t target_size,
+                 char **out, size_t *out_size);
+int delta_builder_init(DeltaBuilder *builder, uint64_t target_size);
+int delta_builder_copy(DeltaBuilder *builder, uint64_t source_offset, uint64_t length);
+int delta_builder_add(DeltaBuilder *builder, const char *bytes, size_t length);
+char *delta_builder_finish(DeltaBuilder *builder, size_t *size);
+int delta_index(const char *delta, size_t delta_size, DeltaOp **ops, size_t *op_count, uint64_t *target_size);
+
+#endif // DELTA_H
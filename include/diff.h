@@ -0,0 +1,31 @@
+// include/diff.h
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+// Line-based unified diffs between versions of a file, also readable as
+// virtual files under the root:
+//   .diff/<file>@<a>..<b>   from version a of file to version b
+// The directories under .diff mirror the store's, and list nothing.
+#define DIFF_DIR ".diff"
+
+// Unchanged lines shown around each change.
+#define DIFF_CONTEXT_LINES 3
+
+// Lines are split with a vectorized newline scan and each is reduced to a
+// number shared by all equal lines, so the Myers diff that follows
+// compares integers; lines with no equal on the other side are settled
+// before it runs. When a diff would cost more than about the square root
+// of the line count, it settles for a correct but not minimal one rather
+// than going quadratic.
+char *diff_text(const char *a, size_t a_size, const char *b, size_t b_size, const char *label_a,
+                const char *label_b, size_t *out_size);
+char *diff_versions(const char *filename, int version_a, int version_b, size_t *out_size);
+
+int diff_contains(const char *path);
+int diff_parse(const char *path, char *filename, size_t filename_size, int *version_a, int *version_b);
+int diff_stat(const char *path, struct stat *stbuf);
+
+#endif // DIFF_H
@@ -0,0 +1,13 @@
+// include/fd_cache.h
+#ifndef FD_CACHE_H
+#define FD_CACHE_H
+
+// A small table of read-only descriptors for backing files (version files,
+// block packs, chunks), so ranged reads are a pread instead of an
+// open/read/close per request. Every fd_cache_open must be paired with
+// fd_cache_close on the returned slot.
+int fd_cache_open(const char *path, int *slot);
+void fd_cache_close(int fd, int slot);
+void fd_cache_invalidate_prefix(const char *prefix);
+
+#endif // FD_CACHE_H
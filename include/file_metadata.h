@@ -9,10 +9,18 @@ typedef struct {
     char *filename;
     struct stat attributes;
     int version_count;
+    int version_capacity;
     VersionInfo *version_list;
+    // Number of version_list records already in the on-disk log, or -1 if
+    // the log has to be written out in full on the next save.
+    int persisted_count;
 } FileMetadata;
 
 FileMetadata *create_file_metadata(const char *filename);
 void destroy_file_metadata(FileMetadata *metadata);
+VersionInfo *append_version(FileMetadata *metadata);
+const VersionInfo *find_version_before_epoch(const FileMetadata *metadata, uint64_t epoch);
+const VersionInfo *find_version_at_time(const FileMetadata *metadata, int64_t time);
+const VersionInfo *find_version(const FileMetadata *metadata, int version_id);
 
 #endif // FILE_METADATA_H
@@ -0,0 +1,23 @@
+// include/inode_table.h
+#ifndef INODE_TABLE_H
+#define INODE_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Inode 1 is the mount root, whose path is "".
+#define INODE_ROOT 1
+
+// Maps the inode numbers handed to the kernel to paths relative to the
+// store, counting kernel lookups so an entry lives exactly as long as the
+// kernel can still name it. Numbers are never reused within a mount.
+// Paths returned by inode_table_path stay valid until the inode is
+// forgotten, which the kernel only does once no request uses it.
+uint64_t inode_table_lookup(const char *path);
+uint64_t inode_table_peek(const char *path);
+const char *inode_table_path(uint64_t ino);
+void inode_table_forget(uint64_t ino, uint64_t nlookup);
+void inode_table_unlink(const char *path);
+int inode_table_child_path(uint64_t parent, const char *name, char *buf, size_t size);
+
+#endif // INODE_TABLE_H
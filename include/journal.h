@@ -0,0 +1,56 @@
+// include/journal.h
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include "version_info.h"
+
+#define JOURNAL_PATH ".versions/.journal"
+#define JOURNAL_EPOCH_PATH ".versions/.epoch"
+
+// Once the journal grows past this, the next commit checkpoints it.
+#define JOURNAL_CHECKPOINT_SIZE (4 * 1024 * 1024)
+
+// Once files holding this many bytes have been unlinked since the last
+// checkpoint, the next one is due straight away so their chunks are freed.
+#define JOURNAL_GARBAGE_SIZE ((uint64_t) 64 * 1024 * 1024)
+
+// Group commit: a sync waits up to this long for concurrent commits to
+// join it, or until this many records are pending.
+#define JOURNAL_DEFAULT_GROUP_WINDOW_US 1000
+#define JOURNAL_DEFAULT_GROUP_SIZE 64
+
+// Write-ahead journal of commits. A commit writes its version's files,
+// appends a record naming the file, version and new attributes, and waits
+// for journal_sync before it touches the cached metadata, so everything
+// the metadata can reach is durable; .meta files themselves are written
+// back lazily. The files a commit writes are noted with journal_note_file,
+// and a single sync makes every record appended before it, and the files
+// noted for them, durable at once, so concurrent committers share it. At
+// startup journal_recover replays records whose versions made it to disk
+// into the .meta files and discards the rest.
+//
+// Appending a commit or snapshot record also hands out the next epoch of a
+// filesystem-wide counter, so epochs order commits across all files.
+//
+// Commits run between journal_begin and journal_end; a checkpoint waits
+// for them, writes the metadata back, collects the chunks no version
+// refers to any more and empties the journal. Commits in that span are
+// also what a group sync waits for.
+int journal_recover(void);
+int journal_open(void);
+void journal_close(void);
+void journal_set_group(long window_us, int size);
+void journal_begin(void);
+void journal_end(void);
+int journal_log_commit(const char *filename, VersionInfo *version, uint64_t size, int64_t mtime,
+                       uint64_t *sequence);
+int journal_log_snapshot(const char *name, int64_t timestamp, uint64_t *epoch, uint64_t *sequence);
+int journal_log_unlink(const char *filename, uint64_t size);
+int journal_note_file(const char *path);
+int journal_sync(uint64_t sequence);
+int journal_checkpoint(void);
+int journal_needs_checkpoint(void);
+uint64_t journal_epoch(void);
+
+#endif // JOURNAL_H
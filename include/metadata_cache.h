@@ -0,0 +1,22 @@
+// include/metadata_cache.h
+#ifndef METADATA_CACHE_H
+#define METADATA_CACHE_H
+
+#include "file_metadata.h"
+
+#define METADATA_CACHE_CAPACITY 16384
+
+// In-memory table of FileMetadata keyed by path, in front of the on-disk
+// metadata. Lookups of files that do not exist are cached too. Entries
+// are handed out with a reference held; callers pass them back with
+// metadata_cache_release, saying whether they changed them. Changes are
+// written back on eviction and on metadata_cache_flush; until then the
+// journal holds them, so closing or syncing a file does not write its
+// metadata back.
+FileMetadata *metadata_cache_acquire(const char *filename);
+int metadata_cache_peek(const char *filename, struct stat *attributes);
+void metadata_cache_release(FileMetadata *metadata, int dirty);
+int metadata_cache_flush(void);
+void metadata_cache_forget(const char *filename);
+
+#endif // METADATA_CACHE_H
@@ -0,0 +1,12 @@
+// include/metadata_json.h
+#ifndef METADATA_JSON_H
+#define METADATA_JSON_H
+
+#include "file_metadata.h"
+
+// JSON form of FileMetadata. Metadata used to be stored this way; it is now
+// only read to migrate old files and written by the metadump tool.
+char *metadata_to_json(const FileMetadata *metadata);
+FileMetadata *metadata_from_json(const char *filename, const char *json);
+
+#endif // METADATA_JSON_H
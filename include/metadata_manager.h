@@ -4,8 +4,16 @@
 
 #include "file_metadata.h"
 
+// .metadata/<file>.meta holds the binary metadata; .json files from older
+// builds are still read and replaced on the next save.
+#define METADATA_EXTENSION ".meta"
+#define METADATA_LEGACY_EXTENSION ".json"
+
 int save_metadata(FileMetadata *metadata);
 FileMetadata *load_metadata(const char *filename);
+int load_metadata_attributes(int dirfd, const char *filename, struct stat *attributes);
+int remove_metadata(const char *filename);
+size_t metadata_extension_length(const char *name);
 int ensure_directory_exists(const char *path);
 
 #endif // METADATA_MANAGER_H
@@ -0,0 +1,64 @@
+// include/open_file.h
+#ifndef OPEN_FILE_H
+#define OPEN_FILE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "version_manager.h"
+#include "file_metadata.h"
+#include "readahead.h"
+
+// Staging files live next to the version store, so splicing into them
+// writes to the same disk. Their names extend this path.
+#define STAGING_PATH ".versions/.staging"
+
+// A contiguous range written through a handle but not yet committed. Once
+// a handle has a staging file, data is NULL and the bytes are in that file
+// at the same offset.
+typedef struct {
+    off_t offset;
+    size_t size;
+    size_t capacity;
+    char *data;
+} DirtyExtent;
+
+// Per-open-handle state, stored in fuse_file_info->fh. Writes are buffered
+// as sorted, non-overlapping extents and turned into exactly one new version
+// when the handle is committed (flush, fsync or release), unless they only
+// rewrite bytes the file already has: then commit returns 1 and drops them.
+// Bulk writes can instead be spliced into an anonymous staging file that
+// mirrors the file's offsets, so they never pass through this process's
+// memory.
+//
+// A handle stays on the file it was opened on. Committing after that file
+// was unlinked brings it back, but once another file has been created
+// under the name the handle's writes are refused with ESTALE.
+//
+// A handle opened on a past version (open_file_create_at) reads that
+// version instead of the latest and takes no writes; neither does one
+// opened on contents generated from the file (open_file_create_contents).
+typedef struct {
+    char *filename;
+    FileMetadata *metadata; // Held: the file opened, not just its name
+    off_t size;
+    int version_id; // Version read, or 0 for the latest
+    char *contents; // Bytes read instead of any version, or NULL
+    int extent_count;
+    int extent_capacity;
+    DirtyExtent *extents;
+    int staging_fd; // -1 until the first staged write
+    ReadaheadState readahead;
+} OpenFile;
+
+OpenFile *open_file_create(const char *filename);
+OpenFile *open_file_create_at(const char *filename, int version_id, off_t size);
+OpenFile *open_file_create_contents(const char *filename, char *contents, size_t size);
+void open_file_destroy(OpenFile *handle);
+int open_file_write(OpenFile *handle, const char *buf, size_t size, off_t offset);
+int open_file_read(OpenFile *handle, char *buf, size_t size, off_t offset);
+int open_file_map(OpenFile *handle, size_t size, off_t offset, VersionMap *map);
+int open_file_staging_fd(OpenFile *handle);
+int open_file_mark_staged(OpenFile *handle, off_t offset, size_t size);
+int open_file_commit(OpenFile *handle);
+
+#endif // OPEN_FILE_H
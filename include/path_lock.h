@@ -0,0 +1,22 @@
+// include/path_lock.h
+#ifndef PATH_LOCK_H
+#define PATH_LOCK_H
+
+#include <stddef.h>
+
+// Reader/writer locks keyed by path. Operations that only look at a file
+// (getattr, read) take it shared; anything that changes the file's buffered
+// writes, versions or metadata (write, commit, unlink) takes it exclusive.
+// Paths are hashed onto a fixed number of shards, so unrelated files rarely
+// contend. Hold at most one path lock at a time, or one set of them:
+// path_lock_write_set takes the locks of several paths in shard order, so
+// callers doing so cannot deadlock each other or anyone holding just one.
+#define PATH_LOCK_SHARDS 256
+
+void path_lock_read(const char *path);
+void path_lock_write(const char *path);
+void path_unlock(const char *path);
+void path_lock_write_set(const char *const *paths, size_t count);
+void path_unlock_set(const char *const *paths, size_t count);
+
+#endif // PATH_LOCK_H
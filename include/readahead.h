@@ -0,0 +1,32 @@
+// include/readahead.h
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "block_cache.h"
+
+// The window starts at this size when a handle is first seen reading
+// sequentially and doubles on every hit up to the maximum, like the
+// kernel's page cache readahead.
+#define READAHEAD_MIN_WINDOW (4 * BLOCK_CACHE_BLOCK_SIZE)
+#define READAHEAD_MAX_WINDOW (64 * BLOCK_CACHE_BLOCK_SIZE)
+#define READAHEAD_QUEUE_SIZE 64
+
+// Per-handle access pattern. next is where a sequential reader will read
+// next; end is how far ahead has already been requested.
+typedef struct {
+    pthread_mutex_t lock;
+    off_t next;
+    off_t end;
+    size_t window;
+} ReadaheadState;
+
+void readahead_init(ReadaheadState *state);
+void readahead_destroy(ReadaheadState *state);
+void readahead_observe(ReadaheadState *state, const char *filename, int version_id, off_t offset,
+                       size_t size, off_t file_size);
+void readahead_shutdown(void);
+
+#endif // READAHEAD_H
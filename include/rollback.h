@@ -0,0 +1,24 @@
+// include/rollback.h
+#ifndef ROLLBACK_H
+#define ROLLBACK_H
+
+#include "time_view.h"
+
+// Threads walking a directory tree during a rollback, and the files each
+// gathers before rolling them back with one journal sync.
+#define ROLLBACK_WORKERS 8
+#define ROLLBACK_BATCH 512
+
+// Called for each file a rollback changed, once the change is durable.
+typedef void (*RollbackNotify)(const char *filename, void *context);
+
+// Roll a file, or every file under a directory ("" is the root), back to
+// what a view (a snapshot or a moment, as parsed by time_view_parse) shows.
+// Each file gets a new version that reuses the stored data of the version
+// shown, so nothing is copied and history is kept; files that had no
+// version then are left alone. A tree is walked in parallel, and its files
+// are rolled back in batches whose records share one journal sync; the
+// batches of different workers in turn share syncs like concurrent commits.
+int rollback_path(const char *path, const TimeView *target, RollbackNotify notify, void *context);
+
+#endif // ROLLBACK_H
@@ -0,0 +1,22 @@
+// include/sha256.h
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char buffer[64];
+    size_t buffered;
+} Sha256Context;
+
+void sha256_init(Sha256Context *ctx);
+void sha256_update(Sha256Context *ctx, const void *data, size_t size);
+void sha256_final(Sha256Context *ctx, unsigned char digest[SHA256_DIGEST_SIZE]);
+void sha256(const void *data, size_t size, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+#endif // SHA256_H
@@ -0,0 +1,13 @@
+// include/simd.h
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stddef.h>
+
+// Vectorized byte routines. The widest variant the CPU supports (AVX2,
+// else SSE2) is picked at run time, with a portable fallback elsewhere.
+int simd_equal(const char *a, const char *b, size_t size);
+size_t simd_count_byte(const char *data, size_t size, char byte);
+size_t simd_find_bytes(const char *data, size_t size, char byte, size_t *offsets);
+
+#endif // SIMD_H
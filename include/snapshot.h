@@ -0,0 +1,26 @@
+// include/snapshot.h
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SNAPSHOTS_PATH ".versions/.snapshots"
+#define SNAPSHOT_NAME_MAX 64
+
+// A snapshot is only a name for an epoch. Taking one journals a record and
+// appends it to the snapshot list, so it costs the same however many files
+// there are; a file's contents in the snapshot are its last version
+// committed before that epoch (find_version_before_epoch).
+typedef struct {
+    char name[SNAPSHOT_NAME_MAX];
+    uint64_t epoch;
+    int64_t timestamp;
+} Snapshot;
+
+int snapshot_create(const char *name, Snapshot *snapshot);
+int snapshot_find(const char *name, Snapshot *snapshot);
+Snapshot *snapshot_list(size_t *count);
+int snapshot_record(const Snapshot *snapshot);
+
+#endif // SNAPSHOT_H
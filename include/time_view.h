@@ -0,0 +1,40 @@
+// include/time_view.h
+#ifndef TIME_VIEW_H
+#define TIME_VIEW_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include "file_metadata.h"
+
+// Read-only views of the store as it was at some point, as virtual trees
+// under the root:
+//   .snapshots/<name>/...   as of a named snapshot
+//   .at/<unix-time>/...     as of a moment in the past
+// Nothing is copied: a file in a view is one of its existing versions,
+// read in place. Directories are not versioned, so a view has the current
+// directories; a file appears in it if it had a version by then.
+#define TIME_VIEW_SNAPSHOTS_DIR ".snapshots"
+#define TIME_VIEW_AT_DIR ".at"
+
+typedef enum {
+    TIME_VIEW_NONE,      // Not a virtual path
+    TIME_VIEW_SNAPSHOTS, // The .snapshots directory itself
+    TIME_VIEW_AT,        // The .at directory itself
+    TIME_VIEW_TREE       // Inside one view; path is "" for its root
+} TimeViewKind;
+
+typedef struct {
+    TimeViewKind kind;
+    int by_time;     // Resolved by time rather than by epoch
+    uint64_t epoch;
+    int64_t time;
+    const char *path; // Store path within the view, pointing into the parsed path
+} TimeView;
+
+int time_view_contains(const char *path);
+int time_view_parse(const char *path, TimeView *view);
+const VersionInfo *time_view_version(const TimeView *view, const FileMetadata *metadata);
+int time_view_file(const TimeView *view, int *version_id, struct stat *stbuf);
+int time_view_stat(const TimeView *view, struct stat *stbuf);
+
+#endif // TIME_VIEW_H
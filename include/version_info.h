@@ -1,14 +1,26 @@
 #ifndef VERSION_INFO_H
 #define VERSION_INFO_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include <time.h>
 
+// One entry of a file's version list. It is a fixed-size record so the
+// list can be stored and loaded as a packed array.
 typedef struct {
-    int version_id;
-    time_t timestamp;
-    char *data_pointer;
+    int32_t version_id;
+    uint32_t flags;
+    int64_t timestamp;
+    // Filesystem-wide commit counter at the time of the commit, so lists
+    // are sorted by it; 0 for versions written before epochs existed.
+    uint64_t epoch;
+    // A rollback stores no data of its own: it names the earlier version
+    // whose stored data it has. 0 for versions with their own data.
+    int32_t data_version;
+    uint32_t reserved;
 } VersionInfo;
 
-void destroy_version_info(VersionInfo *version);
+int version_data_id(const VersionInfo *version);
+void version_data_pointer(const char *filename, const VersionInfo *version, char *buf, size_t size);
 
 #endif // VERSION_INFO_H
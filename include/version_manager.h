@@ -2,8 +2,64 @@
 #define VERSION_MANAGER_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "block_cache.h"
 
-int save_version(const char *filename, const char *data, size_t size, int version_id);
+// Most versions are stored as a delta against their predecessor; a keyframe
+// is forced before a chain grows longer than this, bounding reads of any
+// version to one keyframe plus this many deltas.
+#define VERSION_MAX_DELTA_CHAIN 8
+
+// No version is ever held whole while it is written. Chunk keyframes are
+// streamed through a window of this many bytes, and deltas are either built
+// from the dirty ranges alone or, for a version and base that each fit in
+// the window, found by matching them in memory.
+#define VERSION_STREAM_WINDOW (4 * 1024 * 1024)
+
+// One piece of a version's contents: size bytes at pos in fd, a backing
+// file held open through the fd cache, or in data when fd is -1. data
+// either belongs to the extent or, when pin is set, points into a block
+// cache entry held pinned.
+typedef struct {
+    int fd;
+    int slot;
+    off_t pos;
+    size_t size;
+    char *data;
+    CacheBlock *pin;
+} VersionExtent;
+
+// A range of a version described as extents in order, so it can be handed
+// to the kernel without copying the parts stored verbatim on disk.
+typedef struct {
+    VersionExtent *extents;
+    int count;
+    int capacity;
+} VersionMap;
+
+// A range of a version, in bytes.
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+} VersionRange;
+
+// Patches the bytes of [offset, offset + size) that differ from the base
+// version into buf, which holds the base's bytes (zeros past its end).
+typedef int (*VersionOverlay)(void *context, char *buf, size_t size, off_t offset);
+
+int save_version_overlay(const char *filename, int version_id, int base_version, uint64_t size,
+                         const VersionRange *dirty, int dirty_count, VersionOverlay overlay, void *context);
 char *load_version(const char *filename, int version_id, size_t *out_size);
+ssize_t load_version_range(const char *filename, int version_id, off_t offset, size_t size, char *buf);
+ssize_t map_version_range(const char *filename, int version_id, off_t offset, size_t size, VersionMap *map);
+int version_map_add_data(VersionMap *map, char *data, size_t size);
+void version_map_release(VersionMap *map);
+void prefetch_version_range(const char *filename, int version_id, off_t offset, size_t size);
+int version_size(const char *filename, int version_id, uint64_t *size);
+int version_verify(const char *filename, int version_id, uint64_t size);
+int version_shared_ends(const char *filename, int version_a, int version_b, uint64_t *prefix, uint64_t *suffix);
+void version_manager_invalidate(const char *filename);
+long version_manager_collect(void);
 
 #endif
@@ -0,0 +1,263 @@
+// src/block_cache.c
+#include "block_cache.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct CacheBlock {
+    char *filename;
+    int version_id;
+    uint64_t block;
+    char *data;
+    size_t size;
+    int pins;
+    int referenced; // CLOCK bit, set on every hit
+    int cached;     // Still in its shard; cleared on eviction or invalidation
+    struct CacheBlock *hash_next;
+    struct CacheBlock *ring_prev;
+    struct CacheBlock *ring_next;
+};
+
+typedef struct {
+    pthread_mutex_t lock;
+    CacheBlock **buckets;
+    size_t bucket_count;
+    size_t count;
+    size_t bytes;
+    CacheBlock *hand; // Next eviction candidate in the CLOCK ring
+} CacheShard;
+
+static CacheShard shards[BLOCK_CACHE_SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+static size_t budget = BLOCK_CACHE_DEFAULT_BUDGET;
+
+static void init_shards(void) {
+    for (int i = 0; i < BLOCK_CACHE_SHARDS; i++)
+        pthread_mutex_init(&shards[i].lock, NULL);
+}
+
+static uint64_t hash_key(const char *filename, int version_id, uint64_t block) {
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+    for (; *filename; filename++) {
+        hash ^= (unsigned char) *filename;
+        hash *= UINT64_C(0x100000001b3);
+    }
+    hash ^= (uint64_t) (uint32_t) version_id;
+    hash *= UINT64_C(0x100000001b3);
+    hash ^= block;
+    hash *= UINT64_C(0x100000001b3);
+    return hash ^ (hash >> 29);
+}
+
+static CacheShard *shard_for(uint64_t hash) {
+    pthread_once(&shards_once, init_shards);
+    return &shards[hash % BLOCK_CACHE_SHARDS];
+}
+
+void block_cache_set_budget(size_t bytes) {
+    __atomic_store_n(&budget, bytes, __ATOMIC_RELAXED);
+}
+
+size_t block_cache_budget(void) {
+    return __atomic_load_n(&budget, __ATOMIC_RELAXED);
+}
+
+static void free_block(CacheBlock *entry) {
+    free(entry->filename);
+    free(entry->data);
+    free(entry);
+}
+
+static CacheBlock *find_block(CacheShard *shard, uint64_t hash, const char *filename, int version_id,
+                              uint64_t block) {
+    if (!shard->buckets)
+        return NULL;
+    CacheBlock *entry = shard->buckets[(hash >> 4) & (shard->bucket_count - 1)];
+    while (entry && (entry->block != block || entry->version_id != version_id ||
+                     strcmp(entry->filename, filename) != 0))
+        entry = entry->hash_next;
+    return entry;
+}
+
+static int grow_buckets(CacheShard *shard) {
+    size_t count = shard->bucket_count ? shard->bucket_count * 2 : 256;
+    CacheBlock **grown = calloc(count, sizeof(CacheBlock *));
+    if (!grown)
+        return -1;
+
+    for (size_t i = 0; i < shard->bucket_count; i++) {
+        CacheBlock *entry = shard->buckets[i];
+        while (entry) {
+            CacheBlock *next = entry->hash_next;
+            size_t slot = (hash_key(entry->filename, entry->version_id, entry->block) >> 4) & (count - 1);
+            entry->hash_next = grown[slot];
+            grown[slot] = entry;
+            entry = next;
+        }
+    }
+    free(shard->buckets);
+    shard->buckets = grown;
+    shard->bucket_count = count;
+    return 0;
+}
+
+// Take an entry out of its shard. It is freed now if nobody has it
+// pinned, otherwise by the last unpin.
+static void remove_block(CacheShard *shard, CacheBlock *entry) {
+    uint64_t hash = hash_key(entry->filename, entry->version_id, entry->block);
+    CacheBlock **link = &shard->buckets[(hash >> 4) & (shard->bucket_count - 1)];
+    while (*link != entry)
+        link = &(*link)->hash_next;
+    *link = entry->hash_next;
+
+    if (entry->ring_next == entry) {
+        shard->hand = NULL;
+    } else {
+        entry->ring_prev->ring_next = entry->ring_next;
+        entry->ring_next->ring_prev = entry->ring_prev;
+        if (shard->hand == entry)
+            shard->hand = entry->ring_next;
+    }
+    shard->count--;
+    shard->bytes -= entry->size;
+    entry->cached = 0;
+    if (entry->pins == 0)
+        free_block(entry);
+}
+
+// Sweep the CLOCK hand until size more bytes fit in the shard's share of
+// the budget: referenced blocks get a second chance, pinned ones are
+// skipped. Returns -1 if it cannot make room.
+static int make_room(CacheShard *shard, size_t size) {
+    size_t limit = block_cache_budget() / BLOCK_CACHE_SHARDS;
+    if (size > limit)
+        return -1;
+
+    size_t scanned = 0;
+    while (shard->bytes + size > limit && shard->hand) {
+        // Two full turns clear every reference bit; after that only
+        // pinned blocks are left.
+        if (scanned++ > 2 * shard->count)
+            return -1;
+        CacheBlock *entry = shard->hand;
+        shard->hand = entry->ring_next;
+        if (entry->pins > 0)
+            continue;
+        if (entry->referenced) {
+            entry->referenced = 0;
+            continue;
+        }
+        remove_block(shard, entry);
+    }
+    return shard->bytes + size <= limit ? 0 : -1;
+}
+
+CacheBlock *block_cache_get(const char *filename, int version_id, uint64_t block) {
+    if (!filename || block_cache_budget() == 0) return NULL;
+
+    uint64_t hash = hash_key(filename, version_id, block);
+    CacheShard *shard = shard_for(hash);
+    pthread_mutex_lock(&shard->lock);
+    CacheBlock *entry = find_block(shard, hash, filename, version_id, block);
+    if (entry) {
+        entry->referenced = 1;
+        entry->pins++;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return entry;
+}
+
+// Offer a block's contents (data, which the cache takes ownership of) and
+// get it back pinned. If the block was cached meanwhile, that copy is
+// returned and data is freed; if it does not fit, the block is returned
+// uncached and goes away on unpin.
+CacheBlock *block_cache_put(const char *filename, int version_id, uint64_t block, char *data, size_t size) {
+    if (!filename || !data) return NULL;
+
+    CacheBlock *entry = calloc(1, sizeof(CacheBlock));
+    if (!entry || !(entry->filename = strdup(filename))) {
+        free(entry);
+        free(data);
+        return NULL;
+    }
+    entry->version_id = version_id;
+    entry->block = block;
+    entry->data = data;
+    entry->size = size;
+    entry->pins = 1;
+
+    uint64_t hash = hash_key(filename, version_id, block);
+    CacheShard *shard = shard_for(hash);
+    pthread_mutex_lock(&shard->lock);
+    CacheBlock *existing = find_block(shard, hash, filename, version_id, block);
+    if (existing) {
+        existing->referenced = 1;
+        existing->pins++;
+        pthread_mutex_unlock(&shard->lock);
+        free_block(entry);
+        return existing;
+    }
+
+    if (make_room(shard, size) == 0 &&
+        (shard->count < shard->bucket_count || grow_buckets(shard) == 0)) {
+        size_t slot = (hash >> 4) & (shard->bucket_count - 1);
+        entry->hash_next = shard->buckets[slot];
+        shard->buckets[slot] = entry;
+
+        // New blocks go just behind the hand, the last place it reaches.
+        if (shard->hand) {
+            entry->ring_next = shard->hand;
+            entry->ring_prev = shard->hand->ring_prev;
+            shard->hand->ring_prev->ring_next = entry;
+            shard->hand->ring_prev = entry;
+        } else {
+            entry->ring_next = entry->ring_prev = entry;
+            shard->hand = entry;
+        }
+        shard->count++;
+        shard->bytes += size;
+        entry->cached = 1;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return entry;
+}
+
+const char *block_cache_data(const CacheBlock *entry, size_t *size) {
+    if (!entry) return NULL;
+    if (size)
+        *size = entry->size;
+    return entry->data;
+}
+
+void block_cache_unpin(CacheBlock *entry) {
+    if (!entry) return;
+
+    CacheShard *shard = shard_for(hash_key(entry->filename, entry->version_id, entry->block));
+    pthread_mutex_lock(&shard->lock);
+    int release = --entry->pins == 0 && !entry->cached;
+    pthread_mutex_unlock(&shard->lock);
+    if (release)
+        free_block(entry);
+}
+
+// Drop every block of a file, for when its versions are deleted and the
+// version numbers may be reused.
+void block_cache_invalidate(const char *filename) {
+    if (!filename) return;
+
+    pthread_once(&shards_once, init_shards);
+    for (int i = 0; i < BLOCK_CACHE_SHARDS; i++) {
+        CacheShard *shard = &shards[i];
+        pthread_mutex_lock(&shard->lock);
+        for (size_t b = 0; b < shard->bucket_count; b++) {
+            CacheBlock *entry = shard->buckets[b];
+            while (entry) {
+                CacheBlock *next = entry->hash_next;
+                if (strcmp(entry->filename, filename) == 0)
+                    remove_block(shard, entry);
+                entry = next;
+            }
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
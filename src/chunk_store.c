@@ -0,0 +1,359 @@
+// src/chunk_store.c
+#include "chunk_store.h"
+#include "metadata_manager.h"
+#include "codec.h"
+#include "fd_cache.h"
+#include "journal.h"
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+static unsigned long tmp_counter;
+
+static void hash_to_hex(const unsigned char hash[SHA256_DIGEST_SIZE], char *hex) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        hex[i * 2] = digits[hash[i] >> 4];
+        hex[i * 2 + 1] = digits[hash[i] & 0xf];
+    }
+    hex[SHA256_DIGEST_SIZE * 2] = '\0';
+}
+
+// Chunks are fanned out over 256 directories by the first hash byte.
+void chunk_store_path(const unsigned char hash[SHA256_DIGEST_SIZE], char *path, size_t path_size) {
+    char hex[SHA256_DIGEST_SIZE * 2 + 1];
+    hash_to_hex(hash, hex);
+    snprintf(path, path_size, "%s/%.2s/%s", CHUNKS_DIR, hex, hex + 2);
+}
+
+// How an existing chunk is stored: 1 encoded, 0 plain, -1 missing or not
+// a complete copy of size bytes.
+static int stored_form(const char *path, size_t size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    BlobHeader header;
+    int form = -1;
+    if (fstat(fd, &st) == 0) {
+        if (pread(fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header) &&
+            codec_is_blob((const char *) &header, (size_t) st.st_size, size))
+            form = 1;
+        else if ((size_t) st.st_size == size)
+            form = 0;
+    }
+    close(fd);
+    return form;
+}
+
+// Whether a complete copy of a chunk is stored in the form flags says.
+int chunk_store_contains(const unsigned char hash[SHA256_DIGEST_SIZE], uint32_t flags, size_t length) {
+    char path[256];
+    chunk_store_path(hash, path, sizeof(path));
+    int form = stored_form(path, length);
+    return form >= 0 && form == ((flags & CHUNK_REF_ENCODED) ? 1 : 0);
+}
+
+static int write_all(int fd, const char *data, size_t size) {
+    size_t written = 0;
+    while (written < size) {
+        ssize_t n = write(fd, data + written, size - written);
+        if (n <= 0)
+            return -1;
+        written += (size_t) n;
+    }
+    return 0;
+}
+
+int chunk_store_put(const char *data, size_t size, unsigned char hash[SHA256_DIGEST_SIZE], uint32_t *flags) {
+    if ((!data && size > 0) || !flags) return -1;
+
+    sha256(data, size, hash);
+
+    char path[256];
+    chunk_store_path(hash, path, sizeof(path));
+
+    int form = stored_form(path, size);
+    if (form >= 0) {
+        *flags = form ? CHUNK_REF_ENCODED : 0;
+        return 0; // Already stored
+    }
+
+    char dirpath[256];
+    snprintf(dirpath, sizeof(dirpath), "%.*s", (int) (strrchr(path, '/') - path), path);
+    if (ensure_directory_exists(CHUNKS_DIR) != 0 || ensure_directory_exists(dirpath) != 0)
+        return -1;
+
+    // A commit that finds this chunk stored may be made durable by a sync
+    // before ours, so it is noted before anyone can find it.
+    if (journal_note_file(path) != 0 || journal_note_file(dirpath) != 0 || journal_note_file(CHUNKS_DIR) != 0)
+        return -1;
+
+    char *blob;
+    size_t blob_size;
+    if (codec_encode(data, size, &blob, &blob_size) != 0)
+        return -1;
+
+    // Write under a private name and rename into place, so a reader never
+    // sees a partially written chunk under its final name.
+    char tmppath[300];
+    snprintf(tmppath, sizeof(tmppath), "%s.tmp.%ld.%lu", path, (long) getpid(),
+             __atomic_fetch_add(&tmp_counter, 1, __ATOMIC_RELAXED));
+    int fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        free(blob);
+        return -1;
+    }
+
+    int rc = write_all(fd, blob, blob_size);
+    free(blob);
+    if (close(fd) != 0 || rc != 0 || rename(tmppath, path) != 0) {
+        unlink(tmppath);
+        return -1;
+    }
+    *flags = CHUNK_REF_ENCODED;
+    return 0;
+}
+
+// Reads size bytes at offset of a chunk whose raw length is length. Plain
+// chunks are read in place; encoded ones are decoded whole, which is
+// bounded by CHUNK_MAX_SIZE.
+int chunk_store_read(const unsigned char hash[SHA256_DIGEST_SIZE], uint32_t flags, size_t length,
+                     size_t offset, size_t size, char *buf) {
+    if (offset > length || size > length - offset) return -1;
+
+    char path[256];
+    chunk_store_path(hash, path, sizeof(path));
+
+    int slot;
+    int fd = fd_cache_open(path, &slot);
+    if (fd < 0) return -1;
+
+    int rc = -1;
+    if (!(flags & CHUNK_REF_ENCODED)) {
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = pread(fd, buf + done, size - done, (off_t) (offset + done));
+            if (n <= 0)
+                break;
+            done += (size_t) n;
+        }
+        rc = done == size ? 0 : -1;
+    } else {
+        struct stat st;
+        char *blob = NULL;
+        char *raw = NULL;
+        size_t blob_size = 0;
+        if (fstat(fd, &st) == 0) {
+            blob_size = (size_t) st.st_size;
+            blob = malloc(blob_size ? blob_size : 1);
+            raw = malloc(length ? length : 1);
+        }
+        if (blob && raw && pread(fd, blob, blob_size, 0) == (ssize_t) blob_size &&
+            codec_decode(blob, blob_size, raw, length) == 0) {
+            memcpy(buf, raw + offset, size);
+            rc = 0;
+        }
+        free(blob);
+        free(raw);
+    }
+    fd_cache_close(fd, slot);
+    return rc;
+}
+
+// Find a chunk's raw bytes on disk, for callers that hand them on without
+// reading them. Plain chunks and blobs the codec stored uncompressed hold
+// them verbatim: returns 0 with the chunk file open through the fd cache
+// (close with fd_cache_close(*fd, *slot)) and the bytes at *data_offset.
+// Returns 1 if the chunk is compressed and must go through
+// chunk_store_read, -1 on error.
+int chunk_store_locate(const unsigned char hash[SHA256_DIGEST_SIZE], uint32_t flags, size_t length,
+                       int *fd, int *slot, off_t *data_offset) {
+    if (!fd || !slot || !data_offset) return -1;
+
+    char path[256];
+    chunk_store_path(hash, path, sizeof(path));
+
+    *fd = fd_cache_open(path, slot);
+    if (*fd < 0) return -1;
+
+    if (!(flags & CHUNK_REF_ENCODED)) {
+        *data_offset = 0;
+        return 0;
+    }
+
+    BlobHeader header;
+    struct stat st;
+    int rc = -1;
+    if (fstat(*fd, &st) == 0 && pread(*fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header) &&
+        codec_is_blob((const char *) &header, (size_t) st.st_size, length))
+        rc = header.codec == CODEC_NONE ? 0 : 1;
+
+    if (rc == 0) {
+        *data_offset = (off_t) sizeof(header);
+    } else {
+        fd_cache_close(*fd, *slot);
+        *fd = -1;
+    }
+    return rc;
+}
+
+// Open-addressed set of hashes. SHA-256 is uniform, so its first bytes
+// serve as the slot.
+struct ChunkSet {
+    unsigned char (*hashes)[SHA256_DIGEST_SIZE];
+    unsigned char *used;
+    size_t count;
+    size_t capacity; // A power of two
+};
+
+ChunkSet *chunk_set_create(void) {
+    ChunkSet *set = calloc(1, sizeof(ChunkSet));
+    if (!set) return NULL;
+    set->capacity = 1024;
+    set->hashes = malloc(set->capacity * SHA256_DIGEST_SIZE);
+    set->used = calloc(set->capacity, 1);
+    if (!set->hashes || !set->used) {
+        chunk_set_destroy(set);
+        return NULL;
+    }
+    return set;
+}
+
+void chunk_set_destroy(ChunkSet *set) {
+    if (set) {
+        free(set->hashes);
+        free(set->used);
+        free(set);
+    }
+}
+
+static size_t set_slot(const ChunkSet *set, const unsigned char hash[SHA256_DIGEST_SIZE]) {
+    uint64_t key;
+    memcpy(&key, hash, sizeof(key));
+    size_t slot = (size_t) key & (set->capacity - 1);
+    while (set->used[slot] && memcmp(set->hashes[slot], hash, SHA256_DIGEST_SIZE) != 0)
+        slot = (slot + 1) & (set->capacity - 1);
+    return slot;
+}
+
+static int set_contains(const ChunkSet *set, const unsigned char hash[SHA256_DIGEST_SIZE]) {
+    return set->used[set_slot(set, hash)];
+}
+
+int chunk_set_add(ChunkSet *set, const unsigned char hash[SHA256_DIGEST_SIZE]) {
+    if (!set) return -1;
+
+    // Kept at most half full
+    if ((set->count + 1) * 2 > set->capacity) {
+        ChunkSet grown = { NULL, NULL, 0, set->capacity * 2 };
+        grown.hashes = malloc(grown.capacity * SHA256_DIGEST_SIZE);
+        grown.used = calloc(grown.capacity, 1);
+        if (!grown.hashes || !grown.used) {
+            free(grown.hashes);
+            free(grown.used);
+            return -1;
+        }
+        for (size_t i = 0; i < set->capacity; i++) {
+            if (!set->used[i])
+                continue;
+            size_t slot = set_slot(&grown, set->hashes[i]);
+            memcpy(grown.hashes[slot], set->hashes[i], SHA256_DIGEST_SIZE);
+            grown.used[slot] = 1;
+        }
+        free(set->hashes);
+        free(set->used);
+        set->hashes = grown.hashes;
+        set->used = grown.used;
+        set->capacity = grown.capacity;
+    }
+
+    size_t slot = set_slot(set, hash);
+    if (!set->used[slot]) {
+        memcpy(set->hashes[slot], hash, SHA256_DIGEST_SIZE);
+        set->used[slot] = 1;
+        set->count++;
+    }
+    return 0;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// The hash a chunk is stored under, from its directory and file names.
+static int parse_chunk_name(const char *dir, const char *name, unsigned char hash[SHA256_DIGEST_SIZE]) {
+    char hex[SHA256_DIGEST_SIZE * 2];
+    if (strlen(dir) != 2 || strlen(name) != sizeof(hex) - 2)
+        return -1;
+    memcpy(hex, dir, 2);
+    memcpy(hex + 2, name, sizeof(hex) - 2);
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        int high = hex_value(hex[i * 2]);
+        int low = hex_value(hex[i * 2 + 1]);
+        if (high < 0 || low < 0)
+            return -1;
+        hash[i] = (unsigned char) (high << 4 | low);
+    }
+    return 0;
+}
+
+// Delete every stored chunk that is not in live, along with the temporary
+// files of puts that never finished. Returns the number of chunks
+// deleted, or -1 if the store could not be read; a partial sweep only
+// leaves garbage behind.
+long chunk_store_sweep(const ChunkSet *live) {
+    if (!live) return -1;
+
+    DIR *store = opendir(CHUNKS_DIR);
+    if (!store)
+        return errno == ENOENT ? 0 : -1;
+
+    long removed = 0;
+    int rc = 0;
+    struct dirent *fan;
+    while ((fan = readdir(store)) != NULL) {
+        if (fan->d_name[0] == '.' || strlen(fan->d_name) != 2)
+            continue;
+
+        char dirpath[256];
+        snprintf(dirpath, sizeof(dirpath), "%s/%.2s", CHUNKS_DIR, fan->d_name);
+        DIR *d = opendir(dirpath);
+        if (!d) {
+            rc = -1;
+            continue;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(d)) != NULL) {
+            if (entry->d_name[0] == '.')
+                continue;
+            unsigned char hash[SHA256_DIGEST_SIZE];
+            int chunk = parse_chunk_name(fan->d_name, entry->d_name, hash) == 0;
+            if (chunk && set_contains(live, hash))
+                continue;
+            if (!chunk && !strstr(entry->d_name, ".tmp."))
+                continue; // Not ours
+
+            char path[512];
+            snprintf(path, sizeof(path), "%s/%s", dirpath, entry->d_name);
+            if (unlink(path) == 0 && chunk)
+                removed++;
+        }
+        closedir(d);
+    }
+    closedir(store);
+
+    // Descriptors still open on deleted chunks would outlive them, and
+    // could later be served for a chunk stored again in another form.
+    if (removed > 0)
+        fd_cache_invalidate_prefix(CHUNKS_DIR "/");
+    return rc == 0 ? removed : -1;
+}
@@ -0,0 +1,51 @@
+// src/chunker.c
+#include "chunker.h"
+#include <stdint.h>
+#include <pthread.h>
+
+// Normalized chunking: a stricter mask before the average size and a looser
+// one after it pulls chunk sizes towards CHUNK_AVG_SIZE. The gear hash is
+// shifted left, so its top bits cover the last 64 bytes of input.
+#define MASK_BITS_SMALL 15
+#define MASK_BITS_LARGE 11
+#define MASK_SMALL (~UINT64_C(0) << (64 - MASK_BITS_SMALL))
+#define MASK_LARGE (~UINT64_C(0) << (64 - MASK_BITS_LARGE))
+
+static uint64_t gear[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+
+// The table only has to be random-looking and identical across runs, so it
+// is derived from a fixed splitmix64 seed instead of being spelled out.
+static void init_gear(void) {
+    uint64_t seed = UINT64_C(0x9e3779b97f4a7c15);
+    for (int i = 0; i < 256; i++) {
+        uint64_t z = (seed += UINT64_C(0x9e3779b97f4a7c15));
+        z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+        z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+        gear[i] = z ^ (z >> 31);
+    }
+}
+
+size_t chunker_next_cut(const unsigned char *data, size_t size) {
+    pthread_once(&gear_once, init_gear);
+
+    if (size <= CHUNK_MIN_SIZE)
+        return size;
+    if (size > CHUNK_MAX_SIZE)
+        size = CHUNK_MAX_SIZE;
+    size_t normal = size < CHUNK_AVG_SIZE ? size : CHUNK_AVG_SIZE;
+
+    uint64_t fp = 0;
+    size_t i = CHUNK_MIN_SIZE;
+    for (; i < normal; i++) {
+        fp = (fp << 1) + gear[data[i]];
+        if (!(fp & MASK_SMALL))
+            return i + 1;
+    }
+    for (; i < size; i++) {
+        fp = (fp << 1) + gear[data[i]];
+        if (!(fp & MASK_LARGE))
+            return i + 1;
+    }
+    return size;
+}
@@ -0,0 +1,125 @@
+// src/codec.c
+#include "codec.h"
+#include "zstd.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FAST_LEVEL (-3)
+#define DENSE_LEVEL 9
+
+static int default_codec = CODEC_FAST;
+
+// zstd contexts are expensive to set up relative to an 8 KB chunk, so each
+// worker thread keeps one of each for its lifetime.
+static pthread_key_t cctx_key;
+static pthread_key_t dctx_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+static void free_cctx(void *cctx) {
+    ZSTD_freeCCtx(cctx);
+}
+
+static void free_dctx(void *dctx) {
+    ZSTD_freeDCtx(dctx);
+}
+
+static void init_keys(void) {
+    pthread_key_create(&cctx_key, free_cctx);
+    pthread_key_create(&dctx_key, free_dctx);
+}
+
+static ZSTD_CCtx *thread_cctx(void) {
+    pthread_once(&key_once, init_keys);
+    ZSTD_CCtx *cctx = pthread_getspecific(cctx_key);
+    if (!cctx) {
+        cctx = ZSTD_createCCtx();
+        pthread_setspecific(cctx_key, cctx);
+    }
+    return cctx;
+}
+
+static ZSTD_DCtx *thread_dctx(void) {
+    pthread_once(&key_once, init_keys);
+    ZSTD_DCtx *dctx = pthread_getspecific(dctx_key);
+    if (!dctx) {
+        dctx = ZSTD_createDCtx();
+        pthread_setspecific(dctx_key, dctx);
+    }
+    return dctx;
+}
+
+void codec_set_default(int codec) {
+    if (codec >= CODEC_NONE && codec <= CODEC_DENSE)
+        default_codec = codec;
+}
+
+int codec_from_name(const char *name) {
+    if (!name) return -1;
+    if (strcmp(name, "none") == 0) return CODEC_NONE;
+    if (strcmp(name, "fast") == 0) return CODEC_FAST;
+    if (strcmp(name, "dense") == 0) return CODEC_DENSE;
+    return -1;
+}
+
+// Produces a header plus payload using the default codec. Data that does
+// not shrink is stored as CODEC_NONE so reads never pay for a useless decode.
+int codec_encode(const char *data, size_t size, char **out, size_t *out_size) {
+    if ((!data && size > 0) || !out || !out_size) return -1;
+
+    size_t bound = ZSTD_compressBound(size);
+    char *blob = malloc(sizeof(BlobHeader) + (bound > size ? bound : size));
+    if (!blob) return -1;
+
+    BlobHeader header;
+    memcpy(header.magic, CODEC_MAGIC, 4);
+    memset(header.reserved, 0, sizeof(header.reserved));
+    header.codec = CODEC_NONE;
+    header.raw_size = size;
+    header.stored_size = size;
+
+    if (default_codec != CODEC_NONE && size > 0) {
+        ZSTD_CCtx *cctx = thread_cctx();
+        int level = default_codec == CODEC_DENSE ? DENSE_LEVEL : FAST_LEVEL;
+        size_t compressed = cctx ? ZSTD_compressCCtx(cctx, blob + sizeof(BlobHeader), bound, data, size, level) : 0;
+        if (cctx && !ZSTD_isError(compressed) && compressed < size) {
+            header.codec = (uint8_t) default_codec;
+            header.stored_size = compressed;
+        }
+    }
+    if (header.codec == CODEC_NONE && size > 0)
+        memcpy(blob + sizeof(BlobHeader), data, size);
+
+    memcpy(blob, &header, sizeof(header));
+    *out = blob;
+    *out_size = sizeof(BlobHeader) + header.stored_size;
+    return 0;
+}
+
+// Whether blob looks like an encoded blob holding raw_size bytes.
+int codec_is_blob(const char *blob, size_t blob_size, size_t raw_size) {
+    BlobHeader header;
+    if (!blob || blob_size < sizeof(header))
+        return 0;
+    memcpy(&header, blob, sizeof(header));
+    return memcmp(header.magic, CODEC_MAGIC, 4) == 0 && header.codec <= CODEC_DENSE &&
+           header.raw_size == raw_size && header.stored_size == blob_size - sizeof(header);
+}
+
+int codec_decode(const char *blob, size_t blob_size, char *out, size_t out_size) {
+    if (!codec_is_blob(blob, blob_size, out_size)) return -1;
+
+    BlobHeader header;
+    memcpy(&header, blob, sizeof(header));
+    const char *payload = blob + sizeof(header);
+
+    if (header.codec == CODEC_NONE) {
+        memcpy(out, payload, out_size);
+        return 0;
+    }
+
+    ZSTD_DCtx *dctx = thread_dctx();
+    if (!dctx) return -1;
+    size_t decoded = ZSTD_decompressDCtx(dctx, out, out_size, payload, header.stored_size);
+    return !ZSTD_isError(decoded) && decoded == out_size ? 0 : -1;
+}
@@ -0,0 +1,268 @@
+// src/delta.c
+#include "delta.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Source positions are indexed every DELTA_WINDOW bytes; the target is
+// scanned byte by byte with a rolling hash of the same width, so any match
+// of at least 2 * DELTA_WINDOW - 1 bytes is found.
+#define DELTA_WINDOW 16
+#define HASH_BASE UINT64_C(0x100000001b3)
+#define NO_ENTRY UINT64_MAX
+
+static int buffer_reserve(DeltaBuilder *buffer, size_t extra) {
+    if (buffer->size + extra <= buffer->capacity)
+        return 0;
+    size_t capacity = buffer->capacity ? buffer->capacity : 256;
+    while (capacity < buffer->size + extra)
+        capacity *= 2;
+    char *data = realloc(buffer->data, capacity);
+    if (!data)
+        return -1;
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return 0;
+}
+
+static int put_varint(DeltaBuilder *buffer, uint64_t value) {
+    if (buffer_reserve(buffer, 10) != 0)
+        return -1;
+    while (value >= 0x80) {
+        buffer->data[buffer->size++] = (char) (value | 0x80);
+        value >>= 7;
+    }
+    buffer->data[buffer->size++] = (char) value;
+    return 0;
+}
+
+static int get_varint(const char *data, size_t size, size_t *pos, uint64_t *value) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && *pos < size; shift += 7) {
+        unsigned char byte = (unsigned char) data[(*pos)++];
+        result |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int emit_add(DeltaBuilder *out, const char *bytes, size_t length) {
+    if (length == 0)
+        return 0;
+    if (buffer_reserve(out, 1) != 0)
+        return -1;
+    out->data[out->size++] = DELTA_OP_ADD;
+    if (put_varint(out, length) != 0 || buffer_reserve(out, length) != 0)
+        return -1;
+    memcpy(out->data + out->size, bytes, length);
+    out->size += length;
+    out->written += length;
+    return 0;
+}
+
+static int emit_copy(DeltaBuilder *out, size_t offset, size_t length) {
+    if (buffer_reserve(out, 1) != 0)
+        return -1;
+    out->data[out->size++] = DELTA_OP_COPY;
+    if (put_varint(out, offset) != 0 || put_varint(out, length) != 0)
+        return -1;
+    out->written += length;
+    return 0;
+}
+
+int delta_builder_init(DeltaBuilder *builder, uint64_t target_size) {
+    if (!builder) return -1;
+    memset(builder, 0, sizeof(*builder));
+    builder->target_size = target_size;
+    if (put_varint(builder, target_size) != 0) {
+        free(builder->data);
+        builder->data = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int delta_builder_copy(DeltaBuilder *builder, uint64_t source_offset, uint64_t length) {
+    if (!builder || length > builder->target_size - builder->written) return -1;
+    return length ? emit_copy(builder, source_offset, length) : 0;
+}
+
+int delta_builder_add(DeltaBuilder *builder, const char *bytes, size_t length) {
+    if (!builder || (!bytes && length > 0) || length > builder->target_size - builder->written) return -1;
+    return emit_add(builder, bytes, length);
+}
+
+// The finished delta, which becomes the caller's, or NULL if the
+// instructions do not add up to the target size. Either way the builder
+// is left empty.
+char *delta_builder_finish(DeltaBuilder *builder, size_t *size) {
+    if (!builder || !size) return NULL;
+
+    char *delta = builder->data;
+    if (builder->written != builder->target_size) {
+        free(delta);
+        delta = NULL;
+    } else {
+        *size = builder->size;
+    }
+    memset(builder, 0, sizeof(*builder));
+    return delta;
+}
+
+static uint64_t window_hash(const unsigned char *bytes) {
+    uint64_t hash = 0;
+    for (int i = 0; i < DELTA_WINDOW; i++)
+        hash = hash * HASH_BASE + bytes[i];
+    return hash;
+}
+
+int delta_encode(const char *source, size_t source_size, const char *target, size_t target_size,
+                 char **out, size_t *out_size) {
+    if (!out || !out_size || (!source && source_size > 0) || (!target && target_size > 0))
+        return -1;
+
+    const unsigned char *src = (const unsigned char *) source;
+    const unsigned char *dst = (const unsigned char *) target;
+    DeltaBuilder buffer;
+    if (delta_builder_init(&buffer, target_size) != 0)
+        return -1;
+
+    // Open-addressed table from window hash to source offset.
+    size_t table_size = 1024;
+    while (table_size < 2 * (source_size / DELTA_WINDOW + 1))
+        table_size *= 2;
+    uint64_t *keys = malloc(table_size * sizeof(uint64_t));
+    uint64_t *offsets = malloc(table_size * sizeof(uint64_t));
+    if (!keys || !offsets) {
+        free(keys);
+        free(offsets);
+        free(buffer.data);
+        return -1;
+    }
+    for (size_t i = 0; i < table_size; i++)
+        offsets[i] = NO_ENTRY;
+
+    for (size_t pos = 0; pos + DELTA_WINDOW <= source_size; pos += DELTA_WINDOW) {
+        uint64_t hash = window_hash(src + pos);
+        size_t slot = (size_t) (hash ^ (hash >> 29)) & (table_size - 1);
+        while (offsets[slot] != NO_ENTRY && keys[slot] != hash)
+            slot = (slot + 1) & (table_size - 1);
+        if (offsets[slot] == NO_ENTRY) { // Keep the first occurrence
+            keys[slot] = hash;
+            offsets[slot] = pos;
+        }
+    }
+
+    uint64_t top_power = 1;
+    for (int i = 1; i < DELTA_WINDOW; i++)
+        top_power *= HASH_BASE;
+
+    int rc = 0;
+    size_t literal_start = 0;
+    size_t pos = 0;
+    uint64_t hash = target_size >= DELTA_WINDOW ? window_hash(dst) : 0;
+    while (rc == 0 && pos + DELTA_WINDOW <= target_size) {
+        size_t slot = (size_t) (hash ^ (hash >> 29)) & (table_size - 1);
+        while (offsets[slot] != NO_ENTRY && keys[slot] != hash)
+            slot = (slot + 1) & (table_size - 1);
+
+        if (offsets[slot] != NO_ENTRY && memcmp(src + offsets[slot], dst + pos, DELTA_WINDOW) == 0) {
+            size_t match_src = offsets[slot];
+            size_t match_dst = pos;
+            size_t length = DELTA_WINDOW;
+            while (match_src + length < source_size && match_dst + length < target_size &&
+                   src[match_src + length] == dst[match_dst + length])
+                length++;
+            // Extend backwards over bytes that would otherwise be literals.
+            while (match_src > 0 && match_dst > literal_start && src[match_src - 1] == dst[match_dst - 1]) {
+                match_src--;
+                match_dst--;
+                length++;
+            }
+
+            if (emit_add(&buffer, target + literal_start, match_dst - literal_start) != 0 ||
+                emit_copy(&buffer, match_src, length) != 0) {
+                rc = -1;
+                break;
+            }
+            pos = match_dst + length;
+            literal_start = pos;
+            if (pos + DELTA_WINDOW <= target_size)
+                hash = window_hash(dst + pos);
+            continue;
+        }
+
+        if (pos + DELTA_WINDOW < target_size)
+            hash = (hash - dst[pos] * top_power) * HASH_BASE + dst[pos + DELTA_WINDOW];
+        pos++;
+    }
+    if (rc == 0)
+        rc = emit_add(&buffer, target + literal_start, target_size - literal_start);
+
+    free(keys);
+    free(offsets);
+    if (rc != 0) {
+        free(buffer.data);
+        return -1;
+    }
+    *out = buffer.data;
+    *out_size = buffer.size;
+    return 0;
+}
+
+int delta_index(const char *delta, size_t delta_size, DeltaOp **ops, size_t *op_count, uint64_t *target_size) {
+    if (!delta || !ops || !op_count || !target_size) return -1;
+
+    size_t pos = 0;
+    uint64_t size;
+    if (get_varint(delta, delta_size, &pos, &size) != 0)
+        return -1;
+
+    DeltaOp *list = NULL;
+    size_t count = 0, capacity = 0;
+    uint64_t written = 0;
+    while (pos < delta_size) {
+        DeltaOp op;
+        memset(&op, 0, sizeof(op));
+        op.op = delta[pos++];
+        op.target_offset = written;
+        if (op.op == DELTA_OP_COPY) {
+            if (get_varint(delta, delta_size, &pos, &op.source_offset) != 0 ||
+                get_varint(delta, delta_size, &pos, &op.length) != 0)
+                break;
+        } else if (op.op == DELTA_OP_ADD) {
+            if (get_varint(delta, delta_size, &pos, &op.length) != 0 || op.length > delta_size - pos)
+                break;
+            op.delta_offset = pos;
+            pos += op.length;
+        } else {
+            break;
+        }
+        if (op.length > size - written)
+            break;
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            DeltaOp *grown = realloc(list, capacity * sizeof(DeltaOp));
+            if (!grown) {
+                free(list);
+                return -1;
+            }
+            list = grown;
+        }
+        list[count++] = op;
+        written += op.length;
+    }
+
+    if (pos != delta_size || written != size) {
+        free(list);
+        return -1;
+    }
+    *ops = list;
+    *op_count = count;
+    *target_size = size;
+    return 0;
+}
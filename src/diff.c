@@ -0,0 +1,831 @@
+// src/diff.c
+#include "diff.h"
+#include "simd.h"
+#include "metadata_cache.h"
+#include "version_manager.h"
+#include "path_lock.h"
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define METADATA_DIR ".metadata"
+
+// Below this many steps a diff is always minimal.
+#define DIFF_MIN_COST 256
+
+#define NO_CLASS UINT32_MAX
+
+// Parts of a version that are only scanned for newlines are read through
+// a window this big rather than held whole.
+#define DIFF_READ_WINDOW (1024 * 1024)
+
+// Sizes of recently worked out diffs, so that stat does not work the same
+// diff out again. Versions are told apart by their commit epoch as well as
+// their number, so a file removed and created again does not match.
+#define DIFF_SIZE_CACHE 32
+
+// The lines of one side of a diff: line i is text[start[i], start[i + 1]),
+// newline included, and class[i] is the number it shares with every line
+// equal to it on either side.
+typedef struct {
+    const char *text;
+    size_t *start;
+    uint32_t *class;
+    char *changed;
+    long count;
+} DiffSide;
+
+typedef struct {
+    uint64_t hash;
+    const char *line;
+    size_t length;
+} LineClass;
+
+// State of one Myers diff. forward and backward hold, per diagonal
+// (x - y), the furthest x reached from the start and from the end; they
+// are offset so that every diagonal of the full problem, plus one on
+// either side, can be indexed.
+typedef struct {
+    const uint32_t *a;
+    const uint32_t *b;
+    char *changed_a;
+    char *changed_b;
+    long *forward;
+    long *backward;
+    long max_cost;
+} Myers;
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+    int failed;
+} DiffOutput;
+
+typedef struct {
+    char *filename;
+    int version_a;
+    int version_b;
+    uint64_t epoch_a;
+    uint64_t epoch_b;
+    size_t size;
+} DiffSize;
+
+static DiffSize size_cache[DIFF_SIZE_CACHE];
+static unsigned int next_size_slot;
+static pthread_mutex_t size_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// A run of lines deleted from a and inserted from b, between equal lines.
+typedef struct {
+    long a_start, a_end;
+    long b_start, b_end;
+} DiffBlock;
+
+static int split_lines(DiffSide *side, const char *text, size_t size) {
+    size_t newlines = simd_count_byte(text, size, '\n');
+    size_t count = newlines + (size > 0 && text[size - 1] != '\n');
+    if (count >= NO_CLASS || count > LONG_MAX / 2) {
+        errno = EFBIG;
+        return -1;
+    }
+
+    side->text = text;
+    side->count = (long) count;
+    side->start = malloc((count + 1) * sizeof(size_t));
+    side->class = malloc(count ? count * sizeof(uint32_t) : 1);
+    side->changed = calloc(count ? count : 1, 1);
+    if (!side->start || !side->class || !side->changed) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Each line starts just past the newline ending the one before.
+    side->start[0] = 0;
+    simd_find_bytes(text, size, '\n', side->start + 1);
+    for (size_t i = 1; i <= newlines; i++)
+        side->start[i]++;
+    side->start[count] = size;
+    return 0;
+}
+
+static void free_side(DiffSide *side) {
+    free(side->start);
+    free(side->class);
+    free(side->changed);
+}
+
+// Eight bytes at a time, as lines are mostly longer than a word.
+static uint64_t hash_line(const char *line, size_t length) {
+    uint64_t hash = 0x9e3779b97f4a7c15ULL ^ length;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, line + i, sizeof(word));
+        hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+    }
+    uint64_t word = 0;
+    memcpy(&word, line + i, length - i);
+    hash = (hash ^ word) * 0xc4ceb9fe1a85ec53ULL;
+    return hash ^ (hash >> 29);
+}
+
+// Number the distinct lines of both sides through one hash table, so the
+// diff compares a single integer per line.
+static int classify(DiffSide *a, DiffSide *b, uint32_t *class_total) {
+    size_t lines = (size_t) a->count + (size_t) b->count;
+    size_t slots = 16;
+    while (slots < lines * 2)
+        slots *= 2;
+
+    uint32_t *table = malloc(slots * sizeof(uint32_t));
+    LineClass *classes = malloc(lines ? lines * sizeof(LineClass) : 1);
+    if (!table || !classes) {
+        free(table);
+        free(classes);
+        errno = ENOMEM;
+        return -1;
+    }
+    memset(table, 0xff, slots * sizeof(uint32_t));
+
+    uint32_t class_count = 0;
+    DiffSide *sides[2] = { a, b };
+    for (int s = 0; s < 2; s++) {
+        DiffSide *side = sides[s];
+        for (long i = 0; i < side->count; i++) {
+            const char *line = side->text + side->start[i];
+            size_t length = side->start[i + 1] - side->start[i];
+            uint64_t hash = hash_line(line, length);
+            size_t slot = (size_t) hash & (slots - 1);
+            while (table[slot] != NO_CLASS) {
+                const LineClass *known = &classes[table[slot]];
+                if (known->hash == hash && known->length == length && memcmp(known->line, line, length) == 0)
+                    break;
+                slot = (slot + 1) & (slots - 1);
+            }
+            if (table[slot] == NO_CLASS) {
+                classes[class_count] = (LineClass) { hash, line, length };
+                table[slot] = class_count++;
+            }
+            side->class[i] = table[slot];
+        }
+    }
+    free(table);
+    free(classes);
+    *class_total = class_count;
+    return 0;
+}
+
+// Find where a shortest edit script of a[a_lo, a_hi) into b[b_lo, b_hi)
+// crosses its middle, searching from both ends at once. Past max_cost
+// steps, settle for the point that got furthest from either end.
+static void split(Myers *m, long a_lo, long a_hi, long b_lo, long b_hi, long *split_a, long *split_b) {
+    long *fv = m->forward, *bv = m->backward;
+    long dmin = a_lo - b_hi, dmax = a_hi - b_lo;
+    long fmid = a_lo - b_lo, bmid = a_hi - b_hi;
+    long fmin = fmid, fmax = fmid, bmin = bmid, bmax = bmid;
+    int odd = (fmid - bmid) & 1;
+
+    fv[fmid] = a_lo;
+    bv[bmid] = a_hi;
+    for (long cost = 1;; cost++) {
+        // Widen the diagonals searched by one each way, or narrow them
+        // where they would leave the box, keeping their parity.
+        if (fmin > dmin)
+            fv[--fmin - 1] = -1;
+        else
+            fmin++;
+        if (fmax < dmax)
+            fv[++fmax + 1] = -1;
+        else
+            fmax--;
+        for (long d = fmax; d >= fmin; d -= 2) {
+            long x = fv[d - 1] >= fv[d + 1] ? fv[d - 1] + 1 : fv[d + 1];
+            long y = x - d;
+            while (x < a_hi && y < b_hi && m->a[x] == m->b[y]) {
+                x++;
+                y++;
+            }
+            fv[d] = x;
+            if (odd && bmin <= d && d <= bmax && bv[d] <= x) {
+                *split_a = x;
+                *split_b = y;
+                return;
+            }
+        }
+
+        if (bmin > dmin)
+            bv[--bmin - 1] = LONG_MAX;
+        else
+            bmin++;
+        if (bmax < dmax)
+            bv[++bmax + 1] = LONG_MAX;
+        else
+            bmax--;
+        for (long d = bmax; d >= bmin; d -= 2) {
+            long x = bv[d - 1] < bv[d + 1] ? bv[d - 1] : bv[d + 1] - 1;
+            long y = x - d;
+            while (x > a_lo && y > b_lo && m->a[x - 1] == m->b[y - 1]) {
+                x--;
+                y--;
+            }
+            bv[d] = x;
+            if (!odd && fmin <= d && d <= fmax && x <= fv[d]) {
+                *split_a = x;
+                *split_b = y;
+                return;
+            }
+        }
+
+        if (cost < m->max_cost)
+            continue;
+        long forward_best = -1, forward_x = a_lo;
+        for (long d = fmax; d >= fmin; d -= 2) {
+            long x = fv[d] < a_hi ? fv[d] : a_hi;
+            long y = x - d;
+            if (y > b_hi) {
+                x = b_hi + d;
+                y = b_hi;
+            }
+            if (x + y > forward_best) {
+                forward_best = x + y;
+                forward_x = x;
+            }
+        }
+        long backward_best = LONG_MAX, backward_x = a_hi;
+        for (long d = bmax; d >= bmin; d -= 2) {
+            long x = bv[d] > a_lo ? bv[d] : a_lo;
+            long y = x - d;
+            if (y < b_lo) {
+                x = b_lo + d;
+                y = b_lo;
+            }
+            if (x + y < backward_best) {
+                backward_best = x + y;
+                backward_x = x;
+            }
+        }
+        if ((a_hi + b_hi) - backward_best < forward_best - (a_lo + b_lo)) {
+            *split_a = forward_x;
+            *split_b = forward_best - forward_x;
+        } else {
+            *split_a = backward_x;
+            *split_b = backward_best - backward_x;
+        }
+        return;
+    }
+}
+
+// Mark the lines of a[a_lo, a_hi) and b[b_lo, b_hi) that a shortest edit
+// script deletes or inserts.
+static void compare(Myers *m, long a_lo, long a_hi, long b_lo, long b_hi) {
+    for (;;) {
+        while (a_lo < a_hi && b_lo < b_hi && m->a[a_lo] == m->b[b_lo]) {
+            a_lo++;
+            b_lo++;
+        }
+        while (a_lo < a_hi && b_lo < b_hi && m->a[a_hi - 1] == m->b[b_hi - 1]) {
+            a_hi--;
+            b_hi--;
+        }
+        if (a_lo == a_hi || b_lo == b_hi) {
+            memset(m->changed_a + a_lo, 1, (size_t) (a_hi - a_lo));
+            memset(m->changed_b + b_lo, 1, (size_t) (b_hi - b_lo));
+            return;
+        }
+
+        long x, y;
+        split(m, a_lo, a_hi, b_lo, b_hi, &x, &y);
+        if (x < a_lo || x > a_hi || y < b_lo || y > b_hi || (x == a_lo && y == b_lo) ||
+            (x == a_hi && y == b_hi)) {
+            // No way forward; replacing everything is still a valid script.
+            memset(m->changed_a + a_lo, 1, (size_t) (a_hi - a_lo));
+            memset(m->changed_b + b_lo, 1, (size_t) (b_hi - b_lo));
+            return;
+        }
+        compare(m, a_lo, x, b_lo, y);
+        a_lo = x;
+        b_lo = y;
+    }
+}
+
+// Lines with no equal on the other side can only be deleted or inserted,
+// so they are marked at once and left out of the Myers diff, which then
+// runs on what remains; lines it is given by index. This keeps the diff
+// minimal, and it is what keeps unrelated texts cheap.
+static long keep_matchable(const DiffSide *side, const unsigned char *seen, unsigned char other, uint32_t *kept,
+                           long *index) {
+    long count = 0;
+    for (long i = 0; i < side->count; i++) {
+        if (seen[side->class[i]] & other) {
+            kept[count] = side->class[i];
+            index[count++] = i;
+        } else {
+            side->changed[i] = 1;
+        }
+    }
+    return count;
+}
+
+static int diff_sides(DiffSide *a, DiffSide *b, uint32_t class_count) {
+    unsigned char *seen = calloc(class_count ? class_count : 1, 1);
+    uint32_t *kept_a = malloc(a->count ? (size_t) a->count * sizeof(uint32_t) : 1);
+    uint32_t *kept_b = malloc(b->count ? (size_t) b->count * sizeof(uint32_t) : 1);
+    long *index_a = malloc(a->count ? (size_t) a->count * sizeof(long) : 1);
+    long *index_b = malloc(b->count ? (size_t) b->count * sizeof(long) : 1);
+    size_t diagonals = (size_t) a->count + (size_t) b->count + 3;
+    long *forward = malloc(diagonals * sizeof(long));
+    long *backward = malloc(diagonals * sizeof(long));
+    int rc = seen && kept_a && kept_b && index_a && index_b && forward && backward ? 0 : -1;
+
+    if (rc == 0) {
+        for (long i = 0; i < a->count; i++)
+            seen[a->class[i]] |= 1;
+        for (long i = 0; i < b->count; i++)
+            seen[b->class[i]] |= 2;
+        long count_a = keep_matchable(a, seen, 2, kept_a, index_a);
+        long count_b = keep_matchable(b, seen, 1, kept_b, index_b);
+
+        // What the Myers diff marks is mapped back to the full sides.
+        char *marks = calloc((size_t) count_a + (size_t) count_b + 1, 1);
+        if (!marks) {
+            rc = -1;
+        } else {
+            Myers m = { kept_a, kept_b, marks, marks + count_a, forward + count_b + 1, backward + count_b + 1,
+                        DIFF_MIN_COST };
+            // About the square root of the diagonals, as in other diff tools.
+            long root = 1;
+            while (root * root < count_a + count_b + 3)
+                root *= 2;
+            if (root > m.max_cost)
+                m.max_cost = root;
+
+            compare(&m, 0, count_a, 0, count_b);
+            for (long i = 0; i < count_a; i++)
+                a->changed[index_a[i]] = marks[i];
+            for (long i = 0; i < count_b; i++)
+                b->changed[index_b[i]] = marks[count_a + i];
+            free(marks);
+        }
+    }
+
+    free(seen);
+    free(kept_a);
+    free(kept_b);
+    free(index_a);
+    free(index_b);
+    free(forward);
+    free(backward);
+    if (rc != 0)
+        errno = ENOMEM;
+    return rc;
+}
+
+static void emit(DiffOutput *out, const char *data, size_t size) {
+    if (out->failed)
+        return;
+    if (out->size + size > out->capacity) {
+        size_t grown = out->capacity ? out->capacity : 4096;
+        while (grown < out->size + size)
+            grown *= 2;
+        char *larger = realloc(out->data, grown);
+        if (!larger) {
+            out->failed = 1;
+            return;
+        }
+        out->data = larger;
+        out->capacity = grown;
+    }
+    memcpy(out->data + out->size, data, size);
+    out->size += size;
+}
+
+static void emit_line(DiffOutput *out, char tag, const DiffSide *side, long line) {
+    const char *text = side->text + side->start[line];
+    size_t length = side->start[line + 1] - side->start[line];
+    emit(out, &tag, 1);
+    emit(out, text, length);
+    if (length == 0 || text[length - 1] != '\n') {
+        const char marker[] = "\n\\ No newline at end of file\n";
+        emit(out, marker, sizeof(marker) - 1);
+    }
+}
+
+// A hunk header range: the first line and the count, the count left out
+// when it is 1, and the line before when it is 0.
+static int format_range(char *buf, size_t size, long first, long count) {
+    if (count == 1)
+        return snprintf(buf, size, "%ld", first + 1);
+    return snprintf(buf, size, "%ld,%ld", count ? first + 1 : first, count);
+}
+
+// Group changes less than twice the context apart into hunks and write them
+// out, numbering lines from first_line.
+static void emit_hunks(DiffOutput *out, const DiffSide *a, const DiffSide *b, const DiffBlock *blocks,
+                       size_t block_count, long first_line) {
+    for (size_t i = 0; i < block_count;) {
+        size_t last = i;
+        while (last + 1 < block_count && blocks[last + 1].a_start - blocks[last].a_end <= 2 * DIFF_CONTEXT_LINES)
+            last++;
+
+        // Equal lines come in the same number on both sides, so context
+        // shifts both ranges alike.
+        long before = blocks[i].a_start < DIFF_CONTEXT_LINES ? blocks[i].a_start : DIFF_CONTEXT_LINES;
+        long after = a->count - blocks[last].a_end < DIFF_CONTEXT_LINES ? a->count - blocks[last].a_end
+                                                                        : DIFF_CONTEXT_LINES;
+        long a_start = blocks[i].a_start - before, a_end = blocks[last].a_end + after;
+        long b_start = blocks[i].b_start - before, b_end = blocks[last].b_end + after;
+
+        char range_a[64], range_b[64], header[160];
+        format_range(range_a, sizeof(range_a), first_line + a_start, a_end - a_start);
+        format_range(range_b, sizeof(range_b), first_line + b_start, b_end - b_start);
+        int len = snprintf(header, sizeof(header), "@@ -%s +%s @@\n", range_a, range_b);
+        emit(out, header, (size_t) len);
+
+        long line = a_start;
+        for (size_t k = i; k <= last; k++) {
+            for (; line < blocks[k].a_start; line++)
+                emit_line(out, ' ', a, line);
+            for (long j = blocks[k].a_start; j < blocks[k].a_end; j++)
+                emit_line(out, '-', a, j);
+            for (long j = blocks[k].b_start; j < blocks[k].b_end; j++)
+                emit_line(out, '+', b, j);
+            line = blocks[k].a_end;
+        }
+        for (; line < a_end; line++)
+            emit_line(out, ' ', a, line);
+        i = last + 1;
+    }
+}
+
+// Diff the lines of two texts, the first of which is line first_line + 1
+// of the files they come from.
+static char *diff_lines(const char *a_text, size_t a_size, const char *b_text, size_t b_size, long first_line,
+                        const char *label_a, const char *label_b, size_t *out_size) {
+    DiffSide a, b;
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    DiffOutput out = { NULL, 0, 0, 0 };
+    DiffBlock *blocks = NULL;
+    size_t block_count = 0, block_capacity = 0;
+    uint32_t class_count = 0;
+    int rc = split_lines(&a, a_text, a_size) == 0 && split_lines(&b, b_text, b_size) == 0 &&
+             classify(&a, &b, &class_count) == 0 && diff_sides(&a, &b, class_count) == 0 ? 0 : -1;
+
+    // Equal lines pair up in order, so the changes are read off by walking
+    // both sides together.
+    long i = 0, j = 0;
+    while (rc == 0 && (i < a.count || j < b.count)) {
+        if (i < a.count && j < b.count && !a.changed[i] && !b.changed[j]) {
+            i++;
+            j++;
+            continue;
+        }
+        DiffBlock block = { i, i, j, j };
+        while (i < a.count && a.changed[i])
+            i++;
+        while (j < b.count && b.changed[j])
+            j++;
+        block.a_end = i;
+        block.b_end = j;
+        if (i == block.a_start && j == block.b_start)
+            break;
+        if (block_count == block_capacity) {
+            size_t grown = block_capacity ? block_capacity * 2 : 16;
+            DiffBlock *larger = realloc(blocks, grown * sizeof(DiffBlock));
+            if (!larger) {
+                errno = ENOMEM;
+                rc = -1;
+                break;
+            }
+            blocks = larger;
+            block_capacity = grown;
+        }
+        blocks[block_count++] = block;
+    }
+
+    if (rc == 0 && block_count > 0) {
+        char header[2 * 1100];
+        int len = snprintf(header, sizeof(header), "--- %s\n+++ %s\n", label_a, label_b);
+        emit(&out, header, len > 0 && (size_t) len < sizeof(header) ? (size_t) len : 0);
+        emit_hunks(&out, &a, &b, blocks, block_count, first_line);
+    }
+    if (rc == 0 && !out.data)
+        out.data = malloc(1);
+    if (rc == 0 && (out.failed || !out.data)) {
+        errno = ENOMEM;
+        rc = -1;
+    }
+
+    free(blocks);
+    free_side(&a);
+    free_side(&b);
+    if (rc != 0) {
+        free(out.data);
+        return NULL;
+    }
+    *out_size = out.size;
+    return out.data;
+}
+
+// A unified diff turning a into b, empty if they have the same lines.
+// Returns NULL with errno set on failure; the result is the caller's.
+char *diff_text(const char *a, size_t a_size, const char *b, size_t b_size, const char *label_a,
+                const char *label_b, size_t *out_size) {
+    if (!a || !b || !label_a || !label_b || !out_size) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return diff_lines(a, a_size, b, b_size, 0, label_a, label_b, out_size);
+}
+
+// Offset just after the count-th newline before offset, or 0 if there are
+// fewer. The version is read back from offset a window at a time.
+static int find_line_back(const char *filename, int version_id, uint64_t offset, int count, char *window,
+                          uint64_t *result) {
+    uint64_t end = offset;
+    while (end > 0) {
+        size_t length = end < DIFF_READ_WINDOW ? (size_t) end : DIFF_READ_WINDOW;
+        uint64_t pos = end - length;
+        if (load_version_range(filename, version_id, (off_t) pos, length, window) != (ssize_t) length)
+            return -1;
+        for (size_t i = length; i > 0; i--) {
+            if (window[i - 1] == '\n' && --count == 0) {
+                *result = pos + i;
+                return 0;
+            }
+        }
+        end = pos;
+    }
+    *result = 0;
+    return 0;
+}
+
+// Offset just after the count-th newline from offset on, or size if there
+// are fewer. The version is read a window at a time.
+static int find_line_forward(const char *filename, int version_id, uint64_t offset, uint64_t size, int count,
+                             char *window, uint64_t *result) {
+    uint64_t pos = offset;
+    while (pos < size) {
+        size_t length = size - pos < DIFF_READ_WINDOW ? (size_t) (size - pos) : DIFF_READ_WINDOW;
+        if (load_version_range(filename, version_id, (off_t) pos, length, window) != (ssize_t) length)
+            return -1;
+        for (const char *newline = window; (newline = memchr(newline, '\n', length - (size_t) (newline - window)));
+             newline++) {
+            if (--count == 0) {
+                *result = pos + (uint64_t) (newline - window) + 1;
+                return 0;
+            }
+        }
+        pos += length;
+    }
+    *result = size;
+    return 0;
+}
+
+// Number of newlines in the first size bytes of a version, read a window
+// at a time.
+static int count_lines(const char *filename, int version_id, uint64_t size, char *window, long *lines) {
+    *lines = 0;
+    for (uint64_t pos = 0; pos < size;) {
+        size_t length = size - pos < DIFF_READ_WINDOW ? (size_t) (size - pos) : DIFF_READ_WINDOW;
+        if (load_version_range(filename, version_id, (off_t) pos, length, window) != (ssize_t) length)
+            return -1;
+        *lines += (long) simd_count_byte(window, length, '\n');
+        pos += length;
+    }
+    return 0;
+}
+
+static void remember_size(const char *filename, int version_a, int version_b, uint64_t epoch_a,
+                          uint64_t epoch_b, size_t size) {
+    char *copy = strdup(filename);
+    if (!copy) return;
+
+    pthread_mutex_lock(&size_lock);
+    DiffSize *entry = &size_cache[next_size_slot++ % DIFF_SIZE_CACHE];
+    free(entry->filename);
+    entry->filename = copy;
+    entry->version_a = version_a;
+    entry->version_b = version_b;
+    entry->epoch_a = epoch_a;
+    entry->epoch_b = epoch_b;
+    entry->size = size;
+    pthread_mutex_unlock(&size_lock);
+}
+
+static int recall_size(const char *filename, int version_a, int version_b, uint64_t epoch_a, uint64_t epoch_b,
+                       size_t *size) {
+    int found = 0;
+    pthread_mutex_lock(&size_lock);
+    for (int i = 0; i < DIFF_SIZE_CACHE && !found; i++) {
+        const DiffSize *entry = &size_cache[i];
+        if (entry->filename && entry->version_a == version_a && entry->version_b == version_b &&
+            entry->epoch_a == epoch_a && entry->epoch_b == epoch_b && strcmp(entry->filename, filename) == 0) {
+            *size = entry->size;
+            found = 1;
+        }
+    }
+    pthread_mutex_unlock(&size_lock);
+    return found;
+}
+
+// A unified diff from version_a of a file to version_b. What the two are
+// known from their storage to share at either end (version_shared_ends)
+// is skipped, less the lines around it, so only what lies between is held
+// in memory, split and compared; the shared prefix of version_a is only
+// read through a window to number the lines. Fails with ENOENT if either
+// version does not exist.
+char *diff_versions(const char *filename, int version_a, int version_b, size_t *out_size) {
+    if (!filename || !out_size) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    path_lock_read(filename);
+    FileMetadata *metadata = metadata_cache_acquire(filename);
+    const VersionInfo *a = metadata ? find_version(metadata, version_a) : NULL;
+    const VersionInfo *b = metadata ? find_version(metadata, version_b) : NULL;
+    int data_a = a ? version_data_id(a) : 0;
+    int data_b = b ? version_data_id(b) : 0;
+    uint64_t epoch_a = a ? a->epoch : 0;
+    uint64_t epoch_b = b ? b->epoch : 0;
+    if (metadata)
+        metadata_cache_release(metadata, 0);
+    path_unlock(filename);
+    if (data_a <= 0 || data_b <= 0) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    uint64_t a_size, b_size;
+    if (version_size(filename, data_a, &a_size) != 0 || version_size(filename, data_b, &b_size) != 0) {
+        errno = EIO;
+        return NULL;
+    }
+
+    uint64_t prefix = 0, suffix = 0;
+    version_shared_ends(filename, data_a, data_b, &prefix, &suffix);
+    if (prefix == a_size && prefix == b_size) {
+        *out_size = 0;
+        remember_size(filename, version_a, version_b, epoch_a, epoch_b, 0);
+        return malloc(1);
+    }
+
+    // Shared bytes are the same in both, so a's copy decides where their
+    // lines begin and end.
+    char *window = malloc(DIFF_READ_WINDOW);
+    uint64_t start = 0, a_end = a_size;
+    long first_line = 0;
+    if (!window || find_line_back(filename, data_a, prefix, DIFF_CONTEXT_LINES + 1, window, &start) != 0 ||
+        find_line_forward(filename, data_a, a_size - suffix, a_size, DIFF_CONTEXT_LINES + 1, window, &a_end) != 0 ||
+        count_lines(filename, data_a, start, window, &first_line) != 0) {
+        free(window);
+        errno = window ? EIO : ENOMEM;
+        return NULL;
+    }
+    free(window);
+
+    uint64_t b_end = b_size - (a_size - a_end);
+    if (a_end - start > SIZE_MAX || b_end - start > SIZE_MAX) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t a_length = (size_t) (a_end - start), b_length = (size_t) (b_end - start);
+    char *a_text = malloc(a_length ? a_length : 1);
+    char *b_text = malloc(b_length ? b_length : 1);
+    if (!a_text || !b_text ||
+        load_version_range(filename, data_a, (off_t) start, a_length, a_text) != (ssize_t) a_length ||
+        load_version_range(filename, data_b, (off_t) start, b_length, b_text) != (ssize_t) b_length) {
+        errno = a_text && b_text ? EIO : ENOMEM;
+        free(a_text);
+        free(b_text);
+        return NULL;
+    }
+
+    char label_a[1100], label_b[1100];
+    snprintf(label_a, sizeof(label_a), "%s@%d", filename, version_a);
+    snprintf(label_b, sizeof(label_b), "%s@%d", filename, version_b);
+    char *diff = diff_lines(a_text, a_length, b_text, b_length, first_line, label_a, label_b, out_size);
+    int saved = errno;
+    free(a_text);
+    free(b_text);
+    if (diff)
+        remember_size(filename, version_a, version_b, epoch_a, epoch_b, *out_size);
+    errno = saved;
+    return diff;
+}
+
+// The rest of path if it starts with the diff directory, else NULL.
+static const char *skip_diff_dir(const char *path) {
+    size_t len = strlen(DIFF_DIR);
+    if (!path || strncmp(path, DIFF_DIR, len) != 0 || (path[len] != '\0' && path[len] != '/'))
+        return NULL;
+    return path + len;
+}
+
+// Whether path is the diff tree or inside it. Nothing under it can be
+// created or removed.
+int diff_contains(const char *path) {
+    return skip_diff_dir(path) != NULL;
+}
+
+static int parse_number(const char *text, size_t len, int *number) {
+    long value = 0;
+    if (len == 0 || len > 9 || text[0] == '0')
+        return -1;
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] < '0' || text[i] > '9')
+            return -1;
+        value = value * 10 + (text[i] - '0');
+    }
+    *number = (int) value;
+    return 0;
+}
+
+// Split a diff file's path into the file and the two version numbers.
+// Fails with ENOENT for anything else under the diff tree, including its
+// directories.
+int diff_parse(const char *path, char *filename, size_t filename_size, int *version_a, int *version_b) {
+    const char *rest = skip_diff_dir(path);
+    const char *at = rest ? strrchr(rest, '@') : NULL;
+    const char *dots = at ? strstr(at, "..") : NULL;
+    const char *slash = rest ? strrchr(rest, '/') : NULL;
+    // Version numbers have no leading zeros, so each diff has one name.
+    if (!at || !dots || !slash || at < slash + 2 || (size_t) (at - rest - 1) >= filename_size ||
+        parse_number(at + 1, (size_t) (dots - at - 1), version_a) != 0 ||
+        parse_number(dots + 2, strlen(dots + 2), version_b) != 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    memcpy(filename, rest + 1, (size_t) (at - rest - 1));
+    filename[at - rest - 1] = '\0';
+    return 0;
+}
+
+// Attributes of anything in the diff tree. A diff file takes its owner
+// from the file, is read-only and dated by the later version. Its size is
+// that of the diff, worked out here unless it was recently. Returns 0 or a
+// negative errno.
+int diff_stat(const char *path, struct stat *stbuf) {
+    const char *rest = skip_diff_dir(path);
+    if (!rest || !stbuf) return -EINVAL;
+
+    memset(stbuf, 0, sizeof(struct stat));
+    char filename[1024];
+    int version_a, version_b;
+    if (diff_parse(path, filename, sizeof(filename), &version_a, &version_b) == 0) {
+        path_lock_read(filename);
+        FileMetadata *metadata = metadata_cache_acquire(filename);
+        const VersionInfo *a = metadata ? find_version(metadata, version_a) : NULL;
+        const VersionInfo *b = metadata ? find_version(metadata, version_b) : NULL;
+        int found = a && b;
+        uint64_t epoch_a = 0, epoch_b = 0;
+        if (found) {
+            *stbuf = metadata->attributes;
+            stbuf->st_mode = S_IFREG | (metadata->attributes.st_mode & 0444);
+            stbuf->st_nlink = 1;
+            stbuf->st_blocks = 0;
+            int64_t later = a->timestamp > b->timestamp ? a->timestamp : b->timestamp;
+            stbuf->st_mtime = stbuf->st_ctime = (time_t) later;
+            epoch_a = a->epoch;
+            epoch_b = b->epoch;
+        }
+        if (metadata)
+            metadata_cache_release(metadata, 0);
+        path_unlock(filename);
+
+        if (found) {
+            size_t size;
+            if (!recall_size(filename, version_a, version_b, epoch_a, epoch_b, &size)) {
+                char *diff = diff_versions(filename, version_a, version_b, &size);
+                if (!diff) {
+                    int rc = errno == ENOENT || errno == ENOMEM ? -errno : -EIO;
+                    memset(stbuf, 0, sizeof(struct stat));
+                    return rc;
+                }
+                free(diff);
+            }
+            stbuf->st_size = (off_t) size;
+            stbuf->st_blocks = (blkcnt_t) ((size + 511) / 512);
+            return 0;
+        }
+    }
+
+    if (*rest) {
+        char dirpath[1024];
+        struct stat st;
+        int len = snprintf(dirpath, sizeof(dirpath), "%s%s", METADATA_DIR, rest);
+        if (len < 0 || (size_t) len >= sizeof(dirpath) || stat(dirpath, &st) != 0 || !S_ISDIR(st.st_mode)) {
+            memset(stbuf, 0, sizeof(struct stat));
+            return -ENOENT;
+        }
+    }
+    stbuf->st_mode = S_IFDIR | 0555;
+    stbuf->st_nlink = 2;
+    return 0;
+}
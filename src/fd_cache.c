@@ -0,0 +1,108 @@
+// src/fd_cache.c
+#include "fd_cache.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FD_CACHE_SIZE 128
+
+typedef struct {
+    char *path;
+    int fd;
+    int refs;
+    int stale;
+    unsigned long last_used;
+} FdCacheEntry;
+
+static FdCacheEntry entries[FD_CACHE_SIZE];
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long clock_tick;
+
+static void drop_entry(FdCacheEntry *entry) {
+    close(entry->fd);
+    free(entry->path);
+    memset(entry, 0, sizeof(*entry));
+}
+
+int fd_cache_open(const char *path, int *slot) {
+    if (!path || !slot) return -1;
+
+    pthread_mutex_lock(&cache_lock);
+    int victim = -1;
+    for (int i = 0; i < FD_CACHE_SIZE; i++) {
+        FdCacheEntry *entry = &entries[i];
+        if (entry->path && !entry->stale && strcmp(entry->path, path) == 0) {
+            entry->refs++;
+            entry->last_used = ++clock_tick;
+            *slot = i;
+            pthread_mutex_unlock(&cache_lock);
+            return entry->fd;
+        }
+        if (entry->refs == 0 && (victim < 0 || !entry->path ||
+                                 (entries[victim].path && entry->last_used < entries[victim].last_used)))
+            victim = i;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    pthread_mutex_lock(&cache_lock);
+    // Another thread may have taken the victim slot while we were opening.
+    if (victim < 0 || entries[victim].refs > 0) {
+        pthread_mutex_unlock(&cache_lock);
+        *slot = -1;
+        return fd;
+    }
+    if (entries[victim].path)
+        drop_entry(&entries[victim]);
+    char *copy = strdup(path);
+    if (!copy) {
+        pthread_mutex_unlock(&cache_lock);
+        *slot = -1;
+        return fd;
+    }
+    entries[victim].path = copy;
+    entries[victim].fd = fd;
+    entries[victim].refs = 1;
+    entries[victim].stale = 0;
+    entries[victim].last_used = ++clock_tick;
+    *slot = victim;
+    pthread_mutex_unlock(&cache_lock);
+    return fd;
+}
+
+void fd_cache_close(int fd, int slot) {
+    if (slot < 0) {
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    FdCacheEntry *entry = &entries[slot];
+    entry->refs--;
+    if (entry->refs == 0 && entry->stale)
+        drop_entry(entry);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// Called when backing files are removed, so a later file of the same name
+// is not read through a descriptor of the old one.
+void fd_cache_invalidate_prefix(const char *prefix) {
+    size_t length = strlen(prefix);
+
+    pthread_mutex_lock(&cache_lock);
+    for (int i = 0; i < FD_CACHE_SIZE; i++) {
+        FdCacheEntry *entry = &entries[i];
+        if (!entry->path || strncmp(entry->path, prefix, length) != 0)
+            continue;
+        if (entry->refs == 0)
+            drop_entry(entry);
+        else
+            entry->stale = 1;
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
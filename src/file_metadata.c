@@ -23,7 +23,9 @@ FileMetadata *create_file_metadata(const char *filename) {
     metadata->attributes.st_mtime = time(NULL); // Current time
 
     metadata->version_count = 0;
+    metadata->version_capacity = 0;
     metadata->version_list = NULL;
+    metadata->persisted_count = -1;
 
     return metadata;
 }
@@ -31,12 +33,79 @@ FileMetadata *create_file_metadata(const char *filename) {
 void destroy_file_metadata(FileMetadata *metadata) {
     if (metadata) {
         free(metadata->filename);
-        if (metadata->version_list) {
-            for (int i = 0; i < metadata->version_count; i++) {
-                destroy_version_info(&metadata->version_list[i]);
-            }
-            free(metadata->version_list);
-        }
+        free(metadata->version_list);
         free(metadata);
     }
 }
+
+// Add a zeroed record to the end of version_list and return it. The list
+// grows geometrically so a long history costs amortized O(1) per version.
+VersionInfo *append_version(FileMetadata *metadata) {
+    if (!metadata) return NULL;
+
+    if (metadata->version_count >= metadata->version_capacity) {
+        int capacity = metadata->version_capacity ? metadata->version_capacity * 2 : 8;
+        if (capacity <= metadata->version_count)
+            capacity = metadata->version_count + 1;
+        VersionInfo *version_list = realloc(metadata->version_list, sizeof(VersionInfo) * capacity);
+        if (!version_list)
+            return NULL;
+        metadata->version_list = version_list;
+        metadata->version_capacity = capacity;
+    }
+
+    VersionInfo *version = &metadata->version_list[metadata->version_count++];
+    memset(version, 0, sizeof(*version));
+    return version;
+}
+
+// The version that was current just before epoch: the last one committed
+// at an earlier epoch, found by binary search since the list is in epoch
+// order. NULL if the file had no version yet.
+const VersionInfo *find_version_before_epoch(const FileMetadata *metadata, uint64_t epoch) {
+    if (!metadata) return NULL;
+
+    int lo = 0, hi = metadata->version_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (metadata->version_list[mid].epoch < epoch)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo > 0 ? &metadata->version_list[lo - 1] : NULL;
+}
+
+// The version that was current at time: the last one committed at or
+// before it. Commit timestamps follow the list order, so this is a binary
+// search too.
+const VersionInfo *find_version_at_time(const FileMetadata *metadata, int64_t time) {
+    if (!metadata) return NULL;
+
+    int lo = 0, hi = metadata->version_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (metadata->version_list[mid].timestamp <= time)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo > 0 ? &metadata->version_list[lo - 1] : NULL;
+}
+
+// The version numbered version_id, or NULL if there is none. Numbers only
+// grow along the list.
+const VersionInfo *find_version(const FileMetadata *metadata, int version_id) {
+    if (!metadata) return NULL;
+
+    int lo = 0, hi = metadata->version_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (metadata->version_list[mid].version_id < version_id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < metadata->version_count && metadata->version_list[lo].version_id == version_id
+               ? &metadata->version_list[lo] : NULL;
+}
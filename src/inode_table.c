@@ -0,0 +1,209 @@
+// src/inode_table.c
+#include "inode_table.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Inode {
+    uint64_t ino;
+    char *path;
+    uint64_t nlookup;
+    int linked;   // Reachable by path; cleared once the name is removed
+    struct Inode *path_next;
+    struct Inode *ino_next;
+} Inode;
+
+static Inode root_inode = { INODE_ROOT, "", 1, 1, NULL, NULL };
+static Inode **path_buckets;
+static Inode **ino_buckets;
+static size_t bucket_count;
+static size_t inode_count;
+static uint64_t next_ino = INODE_ROOT + 1;
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t hash_path(const char *path) {
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+    for (; *path; path++) {
+        hash ^= (unsigned char) *path;
+        hash *= UINT64_C(0x100000001b3);
+    }
+    return hash;
+}
+
+static Inode *find_by_path(const char *path) {
+    if (!*path)
+        return &root_inode;
+    if (!path_buckets)
+        return NULL;
+    Inode *inode = path_buckets[hash_path(path) & (bucket_count - 1)];
+    while (inode && strcmp(inode->path, path) != 0)
+        inode = inode->path_next;
+    return inode;
+}
+
+static Inode *find_by_ino(uint64_t ino) {
+    if (ino == INODE_ROOT)
+        return &root_inode;
+    if (!ino_buckets)
+        return NULL;
+    Inode *inode = ino_buckets[ino & (bucket_count - 1)];
+    while (inode && inode->ino != ino)
+        inode = inode->ino_next;
+    return inode;
+}
+
+static int grow_buckets(void) {
+    size_t count = bucket_count ? bucket_count * 2 : 1024;
+    Inode **by_path = calloc(count, sizeof(Inode *));
+    Inode **by_ino = calloc(count, sizeof(Inode *));
+    if (!by_path || !by_ino) {
+        free(by_path);
+        free(by_ino);
+        return -1;
+    }
+
+    for (size_t i = 0; i < bucket_count; i++) {
+        Inode *inode = ino_buckets[i];
+        while (inode) {
+            Inode *next = inode->ino_next;
+            inode->ino_next = by_ino[inode->ino & (count - 1)];
+            by_ino[inode->ino & (count - 1)] = inode;
+            inode = next;
+        }
+        inode = path_buckets[i];
+        while (inode) {
+            Inode *next = inode->path_next;
+            size_t slot = hash_path(inode->path) & (count - 1);
+            inode->path_next = by_path[slot];
+            by_path[slot] = inode;
+            inode = next;
+        }
+    }
+    free(path_buckets);
+    free(ino_buckets);
+    path_buckets = by_path;
+    ino_buckets = by_ino;
+    bucket_count = count;
+    return 0;
+}
+
+static void unlink_path(Inode *inode) {
+    Inode **link = &path_buckets[hash_path(inode->path) & (bucket_count - 1)];
+    while (*link != inode)
+        link = &(*link)->path_next;
+    *link = inode->path_next;
+    inode->linked = 0;
+}
+
+// Find the inode for path, creating it if needed, and count one kernel
+// lookup against it. Returns 0 if it could not be created.
+uint64_t inode_table_lookup(const char *path) {
+    if (!path) return 0;
+
+    pthread_mutex_lock(&table_lock);
+    Inode *inode = find_by_path(path);
+    if (inode) {
+        inode->nlookup++;
+        uint64_t ino = inode->ino;
+        pthread_mutex_unlock(&table_lock);
+        return ino;
+    }
+
+    if (inode_count >= bucket_count && grow_buckets() != 0) {
+        pthread_mutex_unlock(&table_lock);
+        return 0;
+    }
+    inode = calloc(1, sizeof(Inode));
+    if (!inode || !(inode->path = strdup(path))) {
+        free(inode);
+        pthread_mutex_unlock(&table_lock);
+        return 0;
+    }
+    inode->ino = next_ino++;
+    inode->nlookup = 1;
+    inode->linked = 1;
+
+    size_t slot = hash_path(path) & (bucket_count - 1);
+    inode->path_next = path_buckets[slot];
+    path_buckets[slot] = inode;
+    inode->ino_next = ino_buckets[inode->ino & (bucket_count - 1)];
+    ino_buckets[inode->ino & (bucket_count - 1)] = inode;
+    inode_count++;
+
+    uint64_t ino = inode->ino;
+    pthread_mutex_unlock(&table_lock);
+    return ino;
+}
+
+// The inode currently named by path, without counting a lookup; 0 if the
+// kernel does not know it.
+uint64_t inode_table_peek(const char *path) {
+    if (!path) return 0;
+
+    pthread_mutex_lock(&table_lock);
+    Inode *inode = find_by_path(path);
+    uint64_t ino = inode ? inode->ino : 0;
+    pthread_mutex_unlock(&table_lock);
+    return ino;
+}
+
+const char *inode_table_path(uint64_t ino) {
+    pthread_mutex_lock(&table_lock);
+    Inode *inode = find_by_ino(ino);
+    const char *path = inode ? inode->path : NULL;
+    pthread_mutex_unlock(&table_lock);
+    return path;
+}
+
+void inode_table_forget(uint64_t ino, uint64_t nlookup) {
+    if (ino == INODE_ROOT) return;
+
+    pthread_mutex_lock(&table_lock);
+    Inode *inode = find_by_ino(ino);
+    if (inode) {
+        inode->nlookup = nlookup < inode->nlookup ? inode->nlookup - nlookup : 0;
+        if (inode->nlookup == 0) {
+            if (inode->linked)
+                unlink_path(inode);
+            Inode **link = &ino_buckets[ino & (bucket_count - 1)];
+            while (*link != inode)
+                link = &(*link)->ino_next;
+            *link = inode->ino_next;
+            inode_count--;
+            free(inode->path);
+            free(inode);
+        }
+    }
+    pthread_mutex_unlock(&table_lock);
+}
+
+// The name was removed: later lookups of path get a fresh inode, while the
+// old one keeps answering for handles that are still open on it.
+void inode_table_unlink(const char *path) {
+    if (!path || !*path) return;
+
+    pthread_mutex_lock(&table_lock);
+    Inode *inode = find_by_path(path);
+    if (inode)
+        unlink_path(inode);
+    pthread_mutex_unlock(&table_lock);
+}
+
+// Path of name inside directory inode parent. Fails with errno set if
+// parent is unknown or the result does not fit.
+int inode_table_child_path(uint64_t parent, const char *name, char *buf, size_t size) {
+    const char *dir = inode_table_path(parent);
+    if (!dir) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    int len = *dir ? snprintf(buf, size, "%s/%s", dir, name) : snprintf(buf, size, "%s", name);
+    if (len < 0 || (size_t) len >= size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,556 @@
+// src/journal.c
+#define _GNU_SOURCE // sync_file_range
+#include "journal.h"
+#include "metadata_manager.h"
+#include "metadata_cache.h"
+#include "version_manager.h"
+#include "snapshot.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#define JOURNAL_MAGIC "VFSJ"
+#define JOURNAL_COMMIT 1
+#define JOURNAL_UNLINK 2
+#define JOURNAL_SNAPSHOT 3
+
+// On-disk record, followed by name_length bytes of file name. The checksum
+// covers the record (with checksum zeroed) and the name, so a torn write
+// at the tail is recognised and ends the replay.
+typedef struct {
+    char magic[4];
+    uint32_t type;
+    uint64_t sequence;
+    uint64_t size;
+    int64_t timestamp;
+    int64_t mtime;
+    uint64_t epoch;
+    int32_t version_id;
+    int32_t data_version;
+    uint32_t flags;
+    uint32_t reserved;
+    uint32_t name_length;
+    uint32_t checksum;
+} JournalRecord;
+
+typedef struct {
+    JournalRecord record;
+    char *filename;
+    int dropped;
+} ReplayEntry;
+
+static int journal_fd = -1;
+static uint64_t appended_sequence; // Last sequence written to the journal
+static uint64_t durable_sequence;  // Last sequence known to be on disk
+static uint64_t current_epoch;     // Last epoch handed out, under append_lock
+static off_t journal_size;
+static uint64_t garbage_size;      // Bytes of files unlinked since the last checkpoint
+static pthread_mutex_t append_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t commit_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Files written for records that may not be durable yet, with their
+// directories; under pending_lock.
+static char **pending_files;
+static size_t pending_count;
+static size_t pending_capacity;
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Group commit state, under sync_lock. One committer at a time leads a
+// sync; the others wait on synced for it to cover their records.
+static pthread_mutex_t sync_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t joined = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t synced = PTHREAD_COND_INITIALIZER;
+static int sync_running;
+static int committing; // Between journal_begin and journal_end
+static int waiting;    // Inside journal_sync
+static long group_window_us = JOURNAL_DEFAULT_GROUP_WINDOW_US;
+static int group_size = JOURNAL_DEFAULT_GROUP_SIZE;
+
+static uint32_t checksum_record(const JournalRecord *record, const char *name) {
+    JournalRecord copy = *record;
+    copy.checksum = 0;
+
+    uint32_t hash = 2166136261u;
+    const unsigned char *bytes = (const unsigned char *) &copy;
+    for (size_t i = 0; i < sizeof(copy); i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    for (uint32_t i = 0; i < record->name_length; i++)
+        hash = (hash ^ (unsigned char) name[i]) * 16777619u;
+    return hash;
+}
+
+static int push_pending(const char *path) {
+    if (pending_count == pending_capacity) {
+        size_t grown = pending_capacity ? pending_capacity * 2 : 256;
+        char **larger = realloc(pending_files, sizeof(char *) * grown);
+        if (!larger)
+            return -1;
+        pending_files = larger;
+        pending_capacity = grown;
+    }
+    char *copy = strdup(path);
+    if (!copy)
+        return -1;
+    pending_files[pending_count++] = copy;
+    return 0;
+}
+
+// Note a file written for a commit, so the sync that makes its record
+// durable makes the file, and its name in its directory, durable too.
+// Call before the record is appended, and for a file that others may
+// find and reuse (a chunk) before it appears under its final name.
+int journal_note_file(const char *path) {
+    if (!path || journal_fd < 0) return 0;
+
+    const char *slash = strrchr(path, '/');
+    char dirpath[1024];
+    snprintf(dirpath, sizeof(dirpath), "%.*s", slash ? (int) (slash - path) : 1, slash ? path : ".");
+
+    pthread_mutex_lock(&pending_lock);
+    int rc = push_pending(path) == 0 && push_pending(dirpath) == 0 ? 0 : -1;
+    pthread_mutex_unlock(&pending_lock);
+    return rc;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+// fdatasync each file once. Writeback of all of them is started first, so
+// the waits overlap and the filesystem can commit their metadata together.
+// Files removed since they were written need no sync.
+static int sync_files(char **paths, size_t count) {
+    if (count == 0)
+        return 0;
+    qsort(paths, count, sizeof(char *), compare_paths);
+    int rc = 0;
+    for (int pass = 0; pass < 2 && rc == 0; pass++) {
+        for (size_t i = 0; i < count && rc == 0; i++) {
+            if (i > 0 && strcmp(paths[i], paths[i - 1]) == 0)
+                continue;
+            int fd = open(paths[i], O_RDONLY);
+            if (fd < 0) {
+                rc = errno == ENOENT ? 0 : -1;
+                continue;
+            }
+            if (pass == 0)
+                sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+            else
+                rc = fdatasync(fd);
+            close(fd);
+        }
+    }
+    return rc;
+}
+
+// Make every record appended so far durable: first the files noted for
+// them, then the journal itself. Nothing else on the filesystem is waited
+// for. If it fails, the files stay noted for the next attempt.
+static int sync_store(int fd) {
+    pthread_mutex_lock(&pending_lock);
+    char **paths = pending_files;
+    size_t count = pending_count;
+    pending_files = NULL;
+    pending_count = 0;
+    pending_capacity = 0;
+    pthread_mutex_unlock(&pending_lock);
+
+    int rc = sync_files(paths, count);
+    if (rc == 0)
+        rc = fdatasync(fd);
+
+    if (rc == 0) {
+        for (size_t i = 0; i < count; i++)
+            free(paths[i]);
+    } else {
+        pthread_mutex_lock(&pending_lock);
+        for (size_t i = 0; i < count; i++) {
+            if (push_pending(paths[i]) != 0)
+                break; // What cannot be kept is at worst synced with the next checkpoint
+        }
+        for (size_t i = 0; i < count; i++)
+            free(paths[i]);
+        pthread_mutex_unlock(&pending_lock);
+    }
+    free(paths);
+    return rc;
+}
+
+// Make a rename or a new file in dirpath durable.
+static int sync_directory(const char *dirpath) {
+    int fd = open(dirpath, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return -1;
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+static int read_all(int fd, void *buf, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, (char *) buf + done, size - done);
+        if (n <= 0)
+            return -1;
+        done += (size_t) n;
+    }
+    return 0;
+}
+
+// The epoch counter is saved at every checkpoint; epochs handed out since
+// are in the journal.
+static uint64_t read_epoch(void) {
+    uint64_t epoch = 0;
+    int fd = open(JOURNAL_EPOCH_PATH, O_RDONLY);
+    if (fd >= 0) {
+        if (read_all(fd, &epoch, sizeof(epoch)) != 0)
+            epoch = 0;
+        close(fd);
+    }
+    return epoch;
+}
+
+static int write_epoch(uint64_t epoch) {
+    char tmppath[64];
+    snprintf(tmppath, sizeof(tmppath), "%s.tmp", JOURNAL_EPOCH_PATH);
+    int fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    int ok = write(fd, &epoch, sizeof(epoch)) == (ssize_t) sizeof(epoch) && fdatasync(fd) == 0;
+    if (close(fd) != 0 || !ok || rename(tmppath, JOURNAL_EPOCH_PATH) != 0) {
+        unlink(tmppath);
+        return -1;
+    }
+    return sync_directory(".versions");
+}
+
+// Read records up to the end of the journal or the first damaged one.
+static ReplayEntry *read_journal(int fd, size_t *count) {
+    ReplayEntry *entries = NULL;
+    size_t capacity = 0;
+    *count = 0;
+
+    JournalRecord record;
+    while (read_all(fd, &record, sizeof(record)) == 0) {
+        if (memcmp(record.magic, JOURNAL_MAGIC, 4) != 0 || record.name_length == 0 || record.name_length >= 1024)
+            break;
+        char *filename = malloc(record.name_length + 1);
+        if (!filename)
+            break;
+        if (read_all(fd, filename, record.name_length) != 0 || checksum_record(&record, filename) != record.checksum) {
+            free(filename);
+            break;
+        }
+        filename[record.name_length] = '\0';
+
+        if (*count == capacity) {
+            size_t grown = capacity ? capacity * 2 : 64;
+            ReplayEntry *larger = realloc(entries, sizeof(ReplayEntry) * grown);
+            if (!larger) {
+                free(filename);
+                break;
+            }
+            entries = larger;
+            capacity = grown;
+        }
+        entries[(*count)++] = (ReplayEntry) { record, filename, 0 };
+    }
+    return entries;
+}
+
+// Apply one commit record to the file's .meta unless it is already there
+// or its version's data never reached the disk.
+static int replay_commit(const ReplayEntry *entry) {
+    FileMetadata *metadata = load_metadata(entry->filename);
+    if (!metadata)
+        return 0; // Unlinked, or its creation was lost
+
+    const JournalRecord *record = &entry->record;
+    int latest = metadata->version_count > 0 ? metadata->version_list[metadata->version_count - 1].version_id : 0;
+    int rc = 0;
+    int data_version = record->data_version > 0 ? record->data_version : record->version_id;
+    if (record->version_id > latest && version_verify(entry->filename, data_version, record->size)) {
+        VersionInfo *version = append_version(metadata);
+        if (version) {
+            version->version_id = record->version_id;
+            version->data_version = record->data_version;
+            version->flags = record->flags;
+            version->timestamp = record->timestamp;
+            version->epoch = record->epoch;
+            metadata->attributes.st_size = (off_t) record->size;
+            metadata->attributes.st_mtime = (time_t) record->mtime;
+            rc = save_metadata(metadata);
+        } else {
+            rc = -1;
+        }
+    }
+    destroy_file_metadata(metadata);
+    return rc;
+}
+
+// A snapshot whose record reached the journal but not the snapshot list.
+static int replay_snapshot(const ReplayEntry *entry) {
+    Snapshot snapshot;
+    if (snapshot_find(entry->filename, &snapshot) == 0)
+        return 0;
+
+    memset(&snapshot, 0, sizeof(snapshot));
+    snprintf(snapshot.name, sizeof(snapshot.name), "%s", entry->filename);
+    snapshot.epoch = entry->record.epoch;
+    snapshot.timestamp = entry->record.timestamp;
+    return snapshot_record(&snapshot);
+}
+
+int journal_recover(void) {
+    current_epoch = read_epoch();
+    int fd = open(JOURNAL_PATH, O_RDWR);
+    if (fd < 0)
+        return errno == ENOENT ? 0 : -1;
+
+    size_t count;
+    ReplayEntry *entries = read_journal(fd, &count);
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].record.epoch > current_epoch)
+            current_epoch = entries[i].record.epoch;
+    }
+
+    // Records of a file before it was unlinked belong to the old file.
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].record.type != JOURNAL_UNLINK)
+            continue;
+        for (size_t j = 0; j < i; j++) {
+            if (strcmp(entries[j].filename, entries[i].filename) == 0)
+                entries[j].dropped = 1;
+        }
+    }
+
+    int rc = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (rc == 0 && !entries[i].dropped && entries[i].record.type == JOURNAL_COMMIT)
+            rc = replay_commit(&entries[i]);
+        else if (rc == 0 && entries[i].record.type == JOURNAL_SNAPSHOT)
+            rc = replay_snapshot(&entries[i]);
+        free(entries[i].filename);
+    }
+    free(entries);
+
+    // Only forget the records once what they describe is on disk; the
+    // .meta files replay wrote are already.
+    if (rc == 0 && (write_epoch(current_epoch) != 0 || ftruncate(fd, 0) != 0 || fdatasync(fd) != 0))
+        rc = -1;
+    close(fd);
+    return rc;
+}
+
+int journal_open(void) {
+    if (ensure_directory_exists(".versions") != 0)
+        return -1;
+    journal_fd = open(JOURNAL_PATH, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (journal_fd < 0 || sync_directory(".versions") != 0)
+        return -1;
+
+    struct stat st;
+    journal_size = fstat(journal_fd, &st) == 0 ? st.st_size : 0;
+    return 0;
+}
+
+void journal_close(void) {
+    if (journal_fd >= 0) {
+        close(journal_fd);
+        journal_fd = -1;
+    }
+}
+
+void journal_set_group(long window_us, int size) {
+    pthread_mutex_lock(&sync_lock);
+    group_window_us = window_us > 0 ? window_us : 0;
+    group_size = size > 0 ? size : 1;
+    pthread_mutex_unlock(&sync_lock);
+}
+
+void journal_begin(void) {
+    pthread_rwlock_rdlock(&commit_lock);
+    pthread_mutex_lock(&sync_lock);
+    committing++;
+    pthread_mutex_unlock(&sync_lock);
+}
+
+void journal_end(void) {
+    pthread_mutex_lock(&sync_lock);
+    committing--;
+    pthread_cond_signal(&joined);
+    pthread_mutex_unlock(&sync_lock);
+    pthread_rwlock_unlock(&commit_lock);
+}
+
+// Append a record; commits and snapshots are given the next epoch, stored
+// in version or epoch.
+static int append_record(uint32_t type, const char *filename, VersionInfo *version, uint64_t size,
+                         int64_t mtime, uint64_t *epoch, uint64_t *sequence) {
+    if (!filename) return -1;
+    JournalRecord record;
+    memset(&record, 0, sizeof(record));
+    memcpy(record.magic, JOURNAL_MAGIC, 4);
+    record.type = type;
+    record.size = size;
+    record.mtime = mtime;
+    if (version) {
+        record.version_id = version->version_id;
+        record.data_version = version->data_version;
+        record.flags = version->flags;
+        record.timestamp = version->timestamp;
+    }
+    record.name_length = (uint32_t) strlen(filename);
+
+    pthread_mutex_lock(&append_lock);
+    if (type != JOURNAL_UNLINK) {
+        record.epoch = ++current_epoch;
+        if (version)
+            version->epoch = record.epoch;
+        if (epoch)
+            *epoch = record.epoch;
+    }
+    if (journal_fd < 0) {
+        // No journal open, as in offline tools: nothing to sync against.
+        pthread_mutex_unlock(&append_lock);
+        if (sequence)
+            *sequence = 0;
+        return 0;
+    }
+    record.sequence = appended_sequence + 1;
+    record.checksum = checksum_record(&record, filename);
+    struct iovec iov[2] = {
+        { &record, sizeof(record) },
+        { (void *) filename, record.name_length },
+    };
+    ssize_t expected = (ssize_t) (sizeof(record) + record.name_length);
+    int rc = writev(journal_fd, iov, 2) == expected ? 0 : -1;
+    if (rc == 0) {
+        __atomic_store_n(&appended_sequence, record.sequence, __ATOMIC_RELAXED);
+        journal_size += expected;
+        if (sequence)
+            *sequence = record.sequence;
+    }
+    pthread_mutex_unlock(&append_lock);
+    return rc;
+}
+
+int journal_log_commit(const char *filename, VersionInfo *version, uint64_t size, int64_t mtime,
+                       uint64_t *sequence) {
+    if (!version) return -1;
+    return append_record(JOURNAL_COMMIT, filename, version, size, mtime, NULL, sequence);
+}
+
+// A snapshot record carries the snapshot's name in place of a file name.
+int journal_log_snapshot(const char *name, int64_t timestamp, uint64_t *epoch, uint64_t *sequence) {
+    VersionInfo stamp = { 0, 0, timestamp, 0, 0, 0 };
+    return append_record(JOURNAL_SNAPSHOT, name, &stamp, 0, 0, epoch, sequence);
+}
+
+uint64_t journal_epoch(void) {
+    pthread_mutex_lock(&append_lock);
+    uint64_t epoch = current_epoch;
+    pthread_mutex_unlock(&append_lock);
+    return epoch;
+}
+
+// Unlinks are only recorded so replay does not bring back versions of a
+// removed file; they become durable with the next commit's sync. size,
+// what the file held, counts towards a checkpoint to collect its chunks.
+int journal_log_unlink(const char *filename, uint64_t size) {
+    int rc = append_record(JOURNAL_UNLINK, filename, NULL, size, 0, NULL, NULL);
+    pthread_mutex_lock(&append_lock);
+    garbage_size += size;
+    pthread_mutex_unlock(&append_lock);
+    return rc;
+}
+
+// Wait until the record with this sequence is durable. The first committer
+// to need a sync leads the group: while other commits are still on their
+// way to the journal it waits for them, up to the group window or until
+// group_size records are pending, then issues one sync for all of them and
+// wakes every waiter it covered. A lone committer syncs straight away.
+int journal_sync(uint64_t sequence) {
+    if (journal_fd < 0 || sequence == 0) return 0;
+
+    pthread_mutex_lock(&sync_lock);
+    waiting++;
+    pthread_cond_signal(&joined);
+    int rc = 0;
+    while (durable_sequence < sequence) {
+        if (sync_running) {
+            pthread_cond_wait(&synced, &sync_lock);
+            continue;
+        }
+        sync_running = 1;
+
+        if (group_window_us > 0 && committing > waiting) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (group_window_us % 1000000) * 1000;
+            deadline.tv_sec += group_window_us / 1000000 + deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+            while (committing > waiting && (int) (__atomic_load_n(&appended_sequence, __ATOMIC_RELAXED) -
+                                                  durable_sequence) < group_size &&
+                   pthread_cond_timedwait(&joined, &sync_lock, &deadline) == 0)
+                ;
+        }
+        uint64_t target = __atomic_load_n(&appended_sequence, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&sync_lock);
+
+        rc = sync_store(journal_fd);
+
+        pthread_mutex_lock(&sync_lock);
+        sync_running = 0;
+        if (rc == 0 && target > durable_sequence)
+            durable_sequence = target;
+        pthread_cond_broadcast(&synced);
+        if (rc != 0)
+            break; // Waiters retry the sync themselves
+    }
+    waiting--;
+    pthread_mutex_unlock(&sync_lock);
+    return rc;
+}
+
+int journal_needs_checkpoint(void) {
+    pthread_mutex_lock(&append_lock);
+    int needed = journal_fd >= 0 && (journal_size > JOURNAL_CHECKPOINT_SIZE || garbage_size > JOURNAL_GARBAGE_SIZE);
+    pthread_mutex_unlock(&append_lock);
+    return needed;
+}
+
+// Write all cached metadata back and make it durable, after which the
+// records describing it are no longer needed. With every commit held off,
+// this is also when chunks left unreferenced by unlinks (or by commits a
+// crash cut short) can be swept; a failed collection is retried by the
+// next checkpoint.
+int journal_checkpoint(void) {
+    pthread_rwlock_wrlock(&commit_lock);
+    int rc = metadata_cache_flush();
+    if (rc == 0 && version_manager_collect() >= 0) {
+        pthread_mutex_lock(&append_lock);
+        garbage_size = 0;
+        pthread_mutex_unlock(&append_lock);
+    }
+    if (rc == 0 && journal_fd >= 0)
+        rc = write_epoch(journal_epoch());
+    if (rc == 0 && journal_fd >= 0)
+        rc = sync_store(journal_fd);
+    if (rc == 0 && journal_fd >= 0) {
+        pthread_mutex_lock(&append_lock);
+        rc = ftruncate(journal_fd, 0);
+        if (rc == 0)
+            journal_size = 0;
+        pthread_mutex_unlock(&append_lock);
+    }
+    pthread_rwlock_unlock(&commit_lock);
+    return rc;
+}
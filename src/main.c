@@ -1,6 +1,6 @@
 #define FUSE_USE_VERSION 31
 
-#include <fuse3/fuse.h>
+#include <fuse3/fuse_lowlevel.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -11,331 +11,1301 @@
 #include <sys/stat.h>
 #include <dirent.h>
 #include <time.h>
-#include <unistd.h>
+#include <stdint.h>
+#include <stddef.h>
 
 #include "file_metadata.h"
 #include "metadata_manager.h"
 #include "version_manager.h"
+#include "open_file.h"
+#include "metadata_cache.h"
+#include "codec.h"
+#include "path_lock.h"
+#include "inode_table.h"
+#include "block_cache.h"
+#include "readahead.h"
+#include "journal.h"
+#include "snapshot.h"
+#include "time_view.h"
+#include "diff.h"
+#include "rollback.h"
+#include "chunk_store.h"
 
 
 #define METADATA_DIR ".metadata"
 #define VERSIONS_DIR ".versions"
 
-static int fs_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi) {
-    (void) fi;
+// Filesystem-specific mount options, e.g. -o codec=dense
+struct fs_options {
+    const char *codec;
+    double attr_timeout;
+    double entry_timeout;
+    double negative_timeout;
+    int keep_cache;
+    int block_cache_mb;
+    long commit_window_us;
+    int commit_batch;
+};
+
+static const struct fuse_opt fs_opts[] = {
+    { "codec=%s", offsetof(struct fs_options, codec), 1 },
+    { "attr_timeout=%lf", offsetof(struct fs_options, attr_timeout), 0 },
+    { "entry_timeout=%lf", offsetof(struct fs_options, entry_timeout), 0 },
+    { "negative_timeout=%lf", offsetof(struct fs_options, negative_timeout), 0 },
+    { "keep_cache", offsetof(struct fs_options, keep_cache), 1 },
+    { "nokeep_cache", offsetof(struct fs_options, keep_cache), 0 },
+    { "block_cache_mb=%d", offsetof(struct fs_options, block_cache_mb), 0 },
+    { "commit_window_us=%ld", offsetof(struct fs_options, commit_window_us), 0 },
+    { "commit_batch=%d", offsetof(struct fs_options, commit_batch), 0 },
+    FUSE_OPT_END
+};
+
+// Every change goes through this mount and is pushed to the kernel with
+// an invalidation, so by default it may cache names, attributes and file
+// contents for a long time. A name can still appear without one (a file
+// brought back by journal replay or a rollback), so its absence is only
+// cached briefly.
+#define DEFAULT_CACHE_TIMEOUT 3600.0
+#define DEFAULT_NEGATIVE_TIMEOUT 1.0
+
+static struct fs_options options = {
+    NULL, DEFAULT_CACHE_TIMEOUT, DEFAULT_CACHE_TIMEOUT, DEFAULT_NEGATIVE_TIMEOUT, 1, -1,
+    JOURNAL_DEFAULT_GROUP_WINDOW_US, JOURNAL_DEFAULT_GROUP_SIZE
+};
+static struct fuse_session *session;
+
+// Used for directory entries the kernel has not looked up yet
+#define UNKNOWN_INO 0xffffffff
+
+// A directory's entries, read once at opendir and served by index. The
+// attributes are only loaded for readdirplus; a zero st_mode marks an
+// entry that has disappeared since.
+typedef struct {
+    size_t count;
+    char **names;
+    unsigned char *types; // DT_REG or DT_DIR
+    struct stat *attrs;
+} DirListing;
+
+// Location of a store path ("" is the root) under one of the backing
+// directories. Fails with errno set if it does not fit.
+static int backing_path(const char *root, const char *path, char *buf, size_t size) {
+    int len = *path ? snprintf(buf, size, "%s/%s", root, path) : snprintf(buf, size, "%s", root);
+    if (len < 0 || (size_t) len >= size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+static OpenFile *file_handle(struct fuse_file_info *fi) {
+    return fi ? (OpenFile *) (uintptr_t) fi->fh : NULL;
+}
+
+// Whether path is in one of the read-only virtual trees.
+static int virtual_path(const char *path) {
+    return time_view_contains(path) || diff_contains(path);
+}
+
+// How long the kernel may cache a name or attributes of path. The virtual
+// trees are worked out from the store and change without any invalidation
+// being sent (a diff against the latest version after a commit, a view
+// after an unlink), so they are not cached at all.
+static double cache_timeout(const char *path, double timeout) {
+    return virtual_path(path) ? 0 : timeout;
+}
+
+// Whether a file at path would keep its versions where the store keeps
+// its own state: the chunks, journal, epoch, snapshot list and staging
+// files are all in .versions, next to the per-file directories. Each
+// name is reserved along with the temporary names derived from it.
+static int reserved_path(const char *path) {
+    const char *internal[] = { CHUNKS_DIR, JOURNAL_PATH, JOURNAL_EPOCH_PATH, SNAPSHOTS_PATH, STAGING_PATH };
+    char versions_path[1024];
+    if (backing_path(VERSIONS_DIR, path, versions_path, sizeof(versions_path)) != 0)
+        return 0;
+    for (size_t i = 0; i < sizeof(internal) / sizeof(internal[0]); i++) {
+        size_t len = strlen(internal[i]);
+        if (strncmp(versions_path, internal[i], len) == 0 &&
+            (versions_path[len] == '\0' || versions_path[len] == '.' || versions_path[len] == '/'))
+            return 1;
+    }
+    return 0;
+}
+
+// Attributes of path, accounting for writes still buffered in handle.
+// Returns 0 or a negative errno.
+static int stat_path(const char *path, struct stat *stbuf, OpenFile *handle) {
     memset(stbuf, 0, sizeof(struct stat));
 
     // Root directory
-    if (strcmp(path, "/") == 0) {
+    if (!*path) {
         stbuf->st_mode = S_IFDIR | 0755;
         stbuf->st_nlink = 2;
         return 0;
     }
 
-    // Check if it's a directory
-    char dirpath[1024];
-    snprintf(dirpath, sizeof(dirpath), ".metadata%s", path);
-    struct stat st;
-    if (stat(dirpath, &st) == 0 && S_ISDIR(st.st_mode)) {
-        stbuf->st_mode = S_IFDIR | 0755;
-        stbuf->st_nlink = 2;
-        return 0;
+    // Past states of the store, resolved without touching the present
+    if (time_view_contains(path)) {
+        TimeView view;
+        if (time_view_parse(path, &view) != 0)
+            return -ENOENT;
+        return time_view_stat(&view, stbuf);
+    }
+    if (diff_contains(path)) {
+        int rc = diff_stat(path, stbuf);
+        // An open diff knows its size
+        if (rc == 0 && handle && handle->contents)
+            stbuf->st_size = handle->size;
+        return rc;
     }
 
-    // Load metadata for files
-    FileMetadata *metadata = load_metadata(path + 1); // Skip leading '/'
-    if (!metadata) {
+    // Files are answered from the metadata cache without touching disk
+    path_lock_read(path);
+    FileMetadata *metadata = metadata_cache_acquire(path);
+    if (metadata) {
+        *stbuf = metadata->attributes;
+        metadata_cache_release(metadata, 0);
+    } else {
+        path_unlock(path);
+        // Check if it's a directory
+        char dirpath[1024];
+        struct stat st;
+        if (backing_path(METADATA_DIR, path, dirpath, sizeof(dirpath)) == 0 &&
+            stat(dirpath, &st) == 0 && S_ISDIR(st.st_mode)) {
+            stbuf->st_mode = S_IFDIR | 0755;
+            stbuf->st_nlink = 2;
+            return 0;
+        }
         return -ENOENT;
     }
 
-    // Set file attributes
-    *stbuf = metadata->attributes;
-    destroy_file_metadata(metadata);
+    if (handle && handle->size > stbuf->st_size)
+        stbuf->st_size = handle->size;
+    path_unlock(path);
     return 0;
 }
 
-static int fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-                      off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags) {
-    (void) offset;
-    (void) fi;
-    (void) flags;
+// Look up path on behalf of the kernel: fill e and count the lookup.
+static int make_entry(const char *path, struct fuse_entry_param *e) {
+    memset(e, 0, sizeof(*e));
+    int rc = stat_path(path, &e->attr, NULL);
+    if (rc != 0)
+        return rc;
+
+    e->ino = inode_table_lookup(path);
+    if (!e->ino)
+        return -ENOMEM;
+    e->attr.st_ino = e->ino;
+    e->attr_timeout = cache_timeout(path, options.attr_timeout);
+    e->entry_timeout = cache_timeout(path, options.entry_timeout);
+    return 0;
+}
+
+// Drop the kernel's cached attributes of ino and, if data is set, its
+// cached contents. Only attributes change on commit: the written bytes
+// already went through the kernel's page cache.
+static void invalidate_inode(fuse_ino_t ino, int data) {
+    if (session && ino)
+        fuse_lowlevel_notify_inval_inode(session, ino, data ? 0 : -1, 0);
+}
+
+// Drop the kernel's cached lookup of path, e.g. a negative entry for a
+// name that has come back.
+static void invalidate_entry(const char *path) {
+    if (!session)
+        return;
+
+    const char *slash = strrchr(path, '/');
+    const char *name = slash ? slash + 1 : path;
+    fuse_ino_t parent = INODE_ROOT;
+    if (slash) {
+        char parent_path[1024];
+        snprintf(parent_path, sizeof(parent_path), "%.*s", (int) (slash - path), path);
+        parent = inode_table_peek(parent_path);
+        if (!parent)
+            return;
+    }
+    fuse_lowlevel_notify_inval_entry(session, parent, name, strlen(name));
+}
+
+// Commit a handle's pending writes and tell the kernel what changed.
+// Call with the path lock held exclusively.
+static int commit_handle(fuse_ino_t ino, OpenFile *handle) {
+    if (handle->extent_count == 0)
+        return 0;
+
+    // A commit after the file was unlinked brings the name back.
+    FileMetadata *metadata = metadata_cache_acquire(handle->filename);
+    int existed = metadata != NULL;
+    if (metadata)
+        metadata_cache_release(metadata, 0);
+
+    int rc = open_file_commit(handle);
+    if (rc < 0)
+        return -1;
+    if (rc > 0) // Nothing changed
+        return 0;
+    invalidate_inode(ino, 0);
+    if (!existed)
+        invalidate_entry(handle->filename);
+    if (journal_needs_checkpoint() && journal_checkpoint() != 0)
+        fprintf(stderr, "Failed to checkpoint the journal.\n");
+    return 0;
+}
+
+static void fs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    char path[1024];
+    if (inode_table_child_path(parent, name, path, sizeof(path)) != 0) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    struct fuse_entry_param e;
+    // Names in the virtual trees can appear without a change to the store
+    // (a new snapshot, time passing, a new version), so their absence is
+    // not cached.
+    int rc = reserved_path(path) ? -ENOENT : make_entry(path, &e);
+    if (rc == -ENOENT && options.negative_timeout > 0 && !virtual_path(path)) {
+        // Inode 0 tells the kernel to remember that the name is absent
+        memset(&e, 0, sizeof(e));
+        e.entry_timeout = options.negative_timeout;
+        fuse_reply_entry(req, &e);
+    } else if (rc != 0) {
+        fuse_reply_err(req, -rc);
+    } else {
+        fuse_reply_entry(req, &e);
+    }
+}
+
+static void fs_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup) {
+    inode_table_forget(ino, nlookup);
+    fuse_reply_none(req);
+}
+
+static void fs_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data *forgets) {
+    for (size_t i = 0; i < count; i++)
+        inode_table_forget(forgets[i].ino, forgets[i].nlookup);
+    fuse_reply_none(req);
+}
+
+static void fs_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    const char *path = inode_table_path(ino);
+    if (!path) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    struct stat stbuf;
+    int rc = stat_path(path, &stbuf, file_handle(fi));
+    if (rc != 0) {
+        fuse_reply_err(req, -rc);
+        return;
+    }
+    stbuf.st_ino = ino;
+    fuse_reply_attr(req, &stbuf, cache_timeout(path, options.attr_timeout));
+}
+
+static void free_listing(DirListing *listing) {
+    if (listing) {
+        for (size_t i = 0; i < listing->count; i++)
+            free(listing->names[i]);
+        free(listing->names);
+        free(listing->types);
+        free(listing->attrs);
+        free(listing);
+    }
+}
 
-    // Construct the directory path in .metadata
+static int add_listing_entry(DirListing *listing, size_t *capacity, const char *name, size_t len,
+                             unsigned char type) {
+    if (listing->count == *capacity) {
+        size_t grown = *capacity ? *capacity * 2 : 64;
+        char **names = realloc(listing->names, sizeof(char *) * grown);
+        if (!names)
+            return -1;
+        listing->names = names;
+        unsigned char *types = realloc(listing->types, grown);
+        if (!types)
+            return -1;
+        listing->types = types;
+        *capacity = grown;
+    }
+
+    char *copy = strndup(name, len);
+    if (!copy)
+        return -1;
+    listing->names[listing->count] = copy;
+    listing->types[listing->count] = type;
+    listing->count++;
+    return 0;
+}
+
+// Add the entries of the store directory at path, as found in .metadata.
+// Returns 0 or an errno.
+static int read_listing(const char *path, DirListing *listing, size_t *capacity) {
     char dirpath[1024];
-    snprintf(dirpath, sizeof(dirpath), ".metadata%s", path);
+    if (backing_path(METADATA_DIR, path, dirpath, sizeof(dirpath)) != 0)
+        return errno;
 
     DIR *d;
     struct dirent *dir;
     d = opendir(dirpath);
     if (!d)
-        return -ENOENT;
-
-    filler(buf, ".", NULL, 0, 0);
-    filler(buf, "..", NULL, 0, 0);
+        return ENOENT;
 
-    while ((dir = readdir(d)) != NULL) {
+    int rc = 0;
+    while (rc == 0 && (dir = readdir(d)) != NULL) {
         if (dir->d_name[0] == '.')
             continue; // Skip hidden files
 
-        // Remove '.json' extension if it's a file
-        char filename[256];
+        // Strip the metadata extension if it's a file
         if (dir->d_type == DT_REG) {
-            size_t len = strlen(dir->d_name);
-            if (len > 5 && strcmp(dir->d_name + len - 5, ".json") == 0) {
-                strncpy(filename, dir->d_name, len - 5);
-                filename[len - 5] = '\0';
-                filler(buf, filename, NULL, 0, 0);
-            }
+            size_t ext_len = metadata_extension_length(dir->d_name);
+            if (ext_len > 0)
+                rc = add_listing_entry(listing, capacity, dir->d_name,
+                                       strlen(dir->d_name) - ext_len, DT_REG);
         } else if (dir->d_type == DT_DIR) {
             // Directory
-            filler(buf, dir->d_name, NULL, 0, 0);
+            rc = add_listing_entry(listing, capacity, dir->d_name, strlen(dir->d_name), DT_DIR);
         }
     }
     closedir(d);
+    return rc == 0 ? 0 : ENOMEM;
+}
+
+static int list_snapshots(DirListing *listing, size_t *capacity) {
+    size_t count;
+    Snapshot *snapshots = snapshot_list(&count);
+    if (!snapshots)
+        return EIO;
+
+    int rc = 0;
+    for (size_t i = 0; rc == 0 && i < count; i++)
+        rc = add_listing_entry(listing, capacity, snapshots[i].name,
+                               strnlen(snapshots[i].name, SNAPSHOT_NAME_MAX), DT_DIR);
+    free(snapshots);
+    return rc == 0 ? 0 : ENOMEM;
+}
+
+// Drop the files a view does not show and load the attributes of the
+// rest, which readdirplus would otherwise take from the present.
+static int resolve_view_listing(const TimeView *view, DirListing *listing) {
+    listing->attrs = calloc(listing->count ? listing->count : 1, sizeof(struct stat));
+    if (!listing->attrs)
+        return ENOMEM;
+
+    size_t kept = 0;
+    for (size_t i = 0; i < listing->count; i++) {
+        struct stat *attr = &listing->attrs[kept];
+        int keep = 1;
+        if (listing->types[i] == DT_DIR) {
+            attr->st_mode = S_IFDIR | 0555;
+            attr->st_nlink = 2;
+        } else {
+            char child[1024];
+            int len = *view->path ? snprintf(child, sizeof(child), "%s/%s", view->path, listing->names[i])
+                                  : snprintf(child, sizeof(child), "%s", listing->names[i]);
+            TimeView entry = *view;
+            entry.path = child;
+            keep = len >= 0 && (size_t) len < sizeof(child) && time_view_file(&entry, NULL, attr) == 0;
+        }
+
+        if (keep) {
+            listing->names[kept] = listing->names[i];
+            listing->types[kept] = listing->types[i];
+            kept++;
+        } else {
+            free(listing->names[i]);
+            memset(attr, 0, sizeof(*attr));
+        }
+    }
+    listing->count = kept;
     return 0;
 }
 
-static int fs_open(const char *path, struct fuse_file_info *fi) {
-    FileMetadata *metadata = load_metadata(path + 1);
-    if (!metadata) {
-        return -ENOENT;
+static void fs_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    const char *path = inode_table_path(ino);
+    TimeView view;
+    if (!path || time_view_parse(path, &view) != 0) {
+        fuse_reply_err(req, ENOENT);
+        return;
     }
 
-    // Check permissions
-    if ((fi->flags & O_ACCMODE) != O_RDONLY && !(metadata->attributes.st_mode & 0222)) {
-        destroy_file_metadata(metadata);
-        return -EACCES;
+    DirListing *listing = calloc(1, sizeof(DirListing));
+    size_t capacity = 0;
+    int rc = listing ? 0 : ENOMEM;
+    if (rc == 0 && (add_listing_entry(listing, &capacity, ".", 1, DT_DIR) != 0 ||
+                    add_listing_entry(listing, &capacity, "..", 2, DT_DIR) != 0))
+        rc = ENOMEM;
+
+    if (rc == 0 && diff_contains(path)) {
+        // Diffs list nothing: any pair of versions can be looked up
+        struct stat st;
+        if (diff_stat(path, &st) != 0)
+            rc = ENOENT;
+        else if (!S_ISDIR(st.st_mode))
+            rc = ENOTDIR;
+    } else if (rc == 0 && view.kind == TIME_VIEW_NONE) {
+        rc = read_listing(path, listing, &capacity);
+        // The virtual trees are hidden entries of the root
+        if (rc == 0 && !*path &&
+            (add_listing_entry(listing, &capacity, TIME_VIEW_SNAPSHOTS_DIR,
+                               strlen(TIME_VIEW_SNAPSHOTS_DIR), DT_DIR) != 0 ||
+             add_listing_entry(listing, &capacity, TIME_VIEW_AT_DIR, strlen(TIME_VIEW_AT_DIR), DT_DIR) != 0 ||
+             add_listing_entry(listing, &capacity, DIFF_DIR, strlen(DIFF_DIR), DT_DIR) != 0))
+            rc = ENOMEM;
+    } else if (rc == 0) {
+        // .at lists nothing: any moment in the past can be looked up in it
+        if (view.kind == TIME_VIEW_SNAPSHOTS)
+            rc = list_snapshots(listing, &capacity);
+        else if (view.kind == TIME_VIEW_TREE)
+            rc = read_listing(view.path, listing, &capacity);
+        if (rc == 0)
+            rc = resolve_view_listing(&view, listing);
     }
-    destroy_file_metadata(metadata);
+
+    if (rc != 0) {
+        free_listing(listing);
+        fuse_reply_err(req, rc);
+        return;
+    }
+    fi->fh = (uint64_t) (uintptr_t) listing;
+    fuse_reply_open(req, fi);
+}
+
+// Entries are numbered from 1; off is the number already returned.
+static void fs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                       struct fuse_file_info *fi) {
+    (void) ino;
+    DirListing *listing = (DirListing *) (uintptr_t) fi->fh;
+
+    char *buf = malloc(size ? size : 1);
+    if (!buf) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    size_t used = 0;
+    for (size_t i = (size_t) off; i < listing->count; i++) {
+        struct stat st;
+        memset(&st, 0, sizeof(st));
+        st.st_ino = UNKNOWN_INO;
+        st.st_mode = listing->types[i] == DT_DIR ? S_IFDIR : S_IFREG;
+
+        size_t entry_size = fuse_add_direntry(req, buf + used, size - used, listing->names[i], &st,
+                                              (off_t) (i + 1));
+        if (entry_size > size - used)
+            break;
+        used += entry_size;
+    }
+    fuse_reply_buf(req, buf, used);
+    free(buf);
+}
+
+// Load the attributes of every entry in one pass: the metadata cache
+// answers what it holds, and the rest come from the fixed-size headers
+// of the metadata files, opened relative to the directory.
+static int load_listing_attributes(fuse_ino_t ino, DirListing *listing) {
+    const char *path = inode_table_path(ino);
+    char dirpath[1024];
+    if (!path || backing_path(METADATA_DIR, path, dirpath, sizeof(dirpath)) != 0)
+        return -1;
+
+    listing->attrs = calloc(listing->count ? listing->count : 1, sizeof(struct stat));
+    if (!listing->attrs)
+        return -1;
+
+    int dirfd = open(dirpath, O_RDONLY | O_DIRECTORY);
+    for (size_t i = 0; i < listing->count; i++) {
+        struct stat *attr = &listing->attrs[i];
+        if (listing->types[i] == DT_DIR) {
+            attr->st_mode = S_IFDIR | 0755;
+            attr->st_nlink = 2;
+            continue;
+        }
+
+        char child[1024];
+        if (inode_table_child_path(ino, listing->names[i], child, sizeof(child)) != 0)
+            continue;
+        path_lock_read(child);
+        int rc = metadata_cache_peek(child, attr);
+        if (rc < 0)
+            rc = load_metadata_attributes(dirfd, child, attr) == 0 ? 0 : 1;
+        if (rc != 0)
+            memset(attr, 0, sizeof(*attr));
+        path_unlock(child);
+    }
+    if (dirfd >= 0)
+        close(dirfd);
     return 0;
 }
 
+// Like readdir, but each entry comes with its attributes and counts as a
+// lookup, so `ls -l` needs no getattr per file.
+static void fs_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                           struct fuse_file_info *fi) {
+    DirListing *listing = (DirListing *) (uintptr_t) fi->fh;
+    if (!listing->attrs && load_listing_attributes(ino, listing) != 0) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
 
-// Implementation of fs_read
-static int fs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
-{
-    (void) fi;
-    size_t len;
-    size_t out_size;
-    FileMetadata *metadata = load_metadata(path + 1);
-    if (!metadata) 
-    {
-        return -ENOENT;
+    char *buf = malloc(size ? size : 1);
+    if (!buf) {
+        fuse_reply_err(req, ENOMEM);
+        return;
     }
-    if (metadata->version_count == 0) 
-    {
-        destroy_file_metadata(metadata);
-        return 0;
+
+    size_t used = 0;
+    for (size_t i = (size_t) off; i < listing->count; i++) {
+        const char *name = listing->names[i];
+        struct fuse_entry_param e;
+        memset(&e, 0, sizeof(e));
+
+        // The kernel does not look up . and ..; an inode of 0 says so.
+        int dot = strcmp(name, ".") == 0 || strcmp(name, "..") == 0;
+        if (dot) {
+            e.attr.st_ino = UNKNOWN_INO;
+            e.attr.st_mode = S_IFDIR;
+        } else {
+            char child[1024];
+            if (listing->attrs[i].st_mode == 0 ||
+                inode_table_child_path(ino, name, child, sizeof(child)) != 0)
+                continue;
+            e.ino = inode_table_lookup(child);
+            if (!e.ino)
+                break;
+            e.attr = listing->attrs[i];
+            e.attr.st_ino = e.ino;
+            e.attr_timeout = cache_timeout(child, options.attr_timeout);
+            e.entry_timeout = cache_timeout(child, options.entry_timeout);
+        }
+
+        size_t entry_size = fuse_add_direntry_plus(req, buf + used, size - used, name, &e,
+                                                   (off_t) (i + 1));
+        if (entry_size > size - used) {
+            // Not sent, so the lookup does not count
+            if (!dot)
+                inode_table_forget(e.ino, 1);
+            break;
+        }
+        used += entry_size;
     }
+    fuse_reply_buf(req, buf, used);
+    free(buf);
+}
 
-    // Read the latest version
-    VersionInfo *latest_version = &metadata->version_list[metadata->version_count - 1];
-    char *data = load_version(path + 1, latest_version->version_id, &out_size);
-    if (!data) 
-    {
-        destroy_file_metadata(metadata);
-        return -EIO;
+static void fs_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    (void) ino;
+    free_listing((DirListing *) (uintptr_t) fi->fh);
+    fuse_reply_err(req, 0);
+}
+
+// A file in one of the virtual trees opens read-only on the version it
+// shows, so reads are served from that version's existing blobs.
+static void open_view(fuse_req_t req, const char *path, struct fuse_file_info *fi) {
+    TimeView view;
+    int version_id;
+    struct stat st;
+    if (time_view_parse(path, &view) != 0 || time_view_file(&view, &version_id, &st) != 0) {
+        fuse_reply_err(req, ENOENT);
+        return;
     }
-    len = out_size;
-    if (offset < len) 
-    {
-        if (offset + size > len)
-            size = len - offset;
-        memcpy(buf, data + offset, size);
+    if ((fi->flags & O_ACCMODE) != O_RDONLY || (fi->flags & O_TRUNC)) {
+        fuse_reply_err(req, EROFS);
+        return;
     }
-    else
-    {
-        size = 0;
+
+    OpenFile *handle = open_file_create_at(view.path, version_id, st.st_size);
+    if (!handle) {
+        fuse_reply_err(req, ENOMEM);
+        return;
     }
+    fi->fh = (uint64_t) (uintptr_t) handle;
+    // A version never changes, but which one a path in the view shows can,
+    // so contents are only cached while the file is open
+    fi->keep_cache = 0;
+    fuse_reply_open(req, fi);
+}
 
-    free(data);
-    destroy_file_metadata(metadata);
-    return size;
+// A diff is worked out when it is opened and read from memory, so reads
+// bypass the page cache. The size stat reports is that of the same diff.
+static void open_diff(fuse_req_t req, const char *path, struct fuse_file_info *fi) {
+    char filename[1024];
+    int version_a, version_b;
+    if (diff_parse(path, filename, sizeof(filename), &version_a, &version_b) != 0) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if ((fi->flags & O_ACCMODE) != O_RDONLY || (fi->flags & O_TRUNC)) {
+        fuse_reply_err(req, EROFS);
+        return;
+    }
+
+    size_t size;
+    char *diff = diff_versions(filename, version_a, version_b, &size);
+    if (!diff) {
+        fuse_reply_err(req, errno == ENOENT || errno == ENOMEM ? errno : EIO);
+        return;
+    }
+    OpenFile *handle = open_file_create_contents(filename, diff, size);
+    if (!handle) {
+        free(diff);
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    fi->fh = (uint64_t) (uintptr_t) handle;
+    fi->direct_io = 1;
+    fuse_reply_open(req, fi);
 }
 
-static int fs_write(const char *path, const char *buf, size_t size, off_t offset,
-                    struct fuse_file_info *fi) {
-    (void) fi;
-    FileMetadata *metadata = load_metadata(path + 1);
-    char *new_data = NULL;
-    size_t new_size = 0;
+static void fs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    const char *path = inode_table_path(ino);
+    if (!path) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if (time_view_contains(path)) {
+        open_view(req, path, fi);
+        return;
+    }
+    if (diff_contains(path)) {
+        open_diff(req, path, fi);
+        return;
+    }
 
+    path_lock_read(path);
+    FileMetadata *metadata = metadata_cache_acquire(path);
     if (!metadata) {
-        // Create new metadata
-        metadata = create_file_metadata(path + 1);
-        metadata->attributes.st_mode = S_IFREG | 0644;
-        metadata->attributes.st_nlink = 1;
-        metadata->attributes.st_size = 0;
-    }
-
-    // Load existing data if any
-    if (metadata->version_count > 0) {
-        VersionInfo *latest_version = &metadata->version_list[metadata->version_count - 1];
-        size_t existing_size;
-        char *existing_data = load_version(path + 1, latest_version->version_id, &existing_size);
-
-        // Adjust the size if offset + size exceeds current size
-        new_size = offset + size > existing_size ? offset + size : existing_size;
-        new_data = malloc(new_size);
-        memset(new_data, 0, new_size);
-
-        // Copy existing data
-        memcpy(new_data, existing_data, existing_size);
-        free(existing_data);
+        path_unlock(path);
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    // Check permissions
+    int writable = metadata->attributes.st_mode & 0222;
+    metadata_cache_release(metadata, 0);
+    if ((fi->flags & O_ACCMODE) != O_RDONLY && !writable) {
+        path_unlock(path);
+        fuse_reply_err(req, EACCES);
+        return;
+    }
+
+    OpenFile *handle = open_file_create(path);
+    path_unlock(path);
+    if (!handle) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    fi->fh = (uint64_t) (uintptr_t) handle;
+    fi->keep_cache = options.keep_cache;
+    fuse_reply_open(req, fi);
+}
+
+
+// Implementation of fs_read. Committed data stored verbatim is passed to
+// libfuse as file descriptors, so it can be spliced from the backing files
+// to /dev/fuse without passing through this process.
+static void fs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+    (void) ino;
+    OpenFile *handle = file_handle(fi);
+    if (!handle) {
+        fuse_reply_err(req, EBADF);
+        return;
+    }
+
+    VersionMap map = { NULL, 0, 0 };
+    path_lock_read(handle->filename);
+    int read_size = open_file_map(handle, size, offset, &map);
+    path_unlock(handle->filename);
+
+    struct fuse_bufvec *bufv = NULL;
+    if (read_size >= 0 && map.count > 0)
+        bufv = malloc(sizeof(struct fuse_bufvec) + sizeof(struct fuse_buf) * (size_t) (map.count - 1));
+
+    if (read_size < 0) {
+        fuse_reply_err(req, EIO);
+    } else if (map.count == 0) {
+        fuse_reply_buf(req, NULL, 0);
+    } else if (!bufv) {
+        fuse_reply_err(req, ENOMEM);
     } else {
-        new_size = offset + size;
-        new_data = malloc(new_size);
-        memset(new_data, 0, new_size);
+        bufv->count = (size_t) map.count;
+        bufv->idx = 0;
+        bufv->off = 0;
+        for (int i = 0; i < map.count; i++) {
+            const VersionExtent *extent = &map.extents[i];
+            struct fuse_buf *buf = &bufv->buf[i];
+            memset(buf, 0, sizeof(*buf));
+            buf->size = extent->size;
+            if (extent->fd >= 0) {
+                buf->flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+                buf->fd = extent->fd;
+                buf->pos = extent->pos;
+            } else {
+                buf->mem = extent->data;
+                buf->fd = -1;
+            }
+        }
+        fuse_reply_data(req, bufv, FUSE_BUF_SPLICE_MOVE);
     }
+    free(bufv);
+    version_map_release(&map);
+}
 
-    // Write new data at the given offset
-    memcpy(new_data + offset, buf, size);
+// Writes only land in the handle's buffer; the new version is created once
+// the handle is flushed, fsync'd or released.
+static void fs_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t offset,
+                     struct fuse_file_info *fi) {
+    (void) ino;
+    OpenFile *handle = file_handle(fi);
+    if (!handle) {
+        fuse_reply_err(req, EBADF);
+        return;
+    }
 
-    // Save new version
-    int new_version_id = metadata->version_count + 1;
-    if (save_version(path + 1, new_data, new_size, new_version_id) != 0) {
-        free(new_data);
-        destroy_file_metadata(metadata);
-        return -EIO;
-    }
-
-    // Update metadata
-    metadata->attributes.st_size = new_size;
-    metadata->attributes.st_mtime = time(NULL);
-    metadata->version_list = realloc(metadata->version_list, sizeof(VersionInfo) * new_version_id);
-    metadata->version_count = new_version_id;
-    VersionInfo *new_version = &metadata->version_list[new_version_id - 1];
-    new_version->version_id = new_version_id;
-    new_version->timestamp = time(NULL);
-    new_version->data_pointer = malloc(256);
-    snprintf(new_version->data_pointer, 256, ".versions/%s/version_%d", path + 1, new_version_id);
-
-    if (save_metadata(metadata) != 0) {
-        free(new_data);
-        destroy_file_metadata(metadata);
-        return -EIO;
+    path_lock_write(handle->filename);
+    int rc = open_file_write(handle, buf, size, offset);
+    path_unlock(handle->filename);
+    if (rc != 0)
+        fuse_reply_err(req, ENOMEM);
+    else
+        fuse_reply_write(req, size);
+}
+
+// Preferred over fs_write by libfuse. Requests it has read into memory are
+// buffered as usual; requests still sitting in a pipe, as libfuse leaves
+// large writes when it can splice, are spliced into the handle's staging
+// file without ever being copied into this process.
+static void fs_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *in_buf, off_t offset,
+                         struct fuse_file_info *fi) {
+    (void) ino;
+    OpenFile *handle = file_handle(fi);
+    if (!handle) {
+        fuse_reply_err(req, EBADF);
+        return;
     }
 
-    free(new_data);
-    destroy_file_metadata(metadata);
-    return size;
+    size_t size = fuse_buf_size(in_buf);
+    int in_memory = in_buf->count == 1 && !(in_buf->buf[0].flags & FUSE_BUF_IS_FD);
+    ssize_t written;
+
+    path_lock_write(handle->filename);
+    if (in_memory) {
+        written = open_file_write(handle, in_buf->buf[0].mem, size, offset) == 0 ? (ssize_t) size : -ENOMEM;
+    } else {
+        int fd = open_file_staging_fd(handle);
+        if (fd < 0) {
+            written = -EIO;
+        } else {
+            struct fuse_bufvec out_buf = FUSE_BUFVEC_INIT(size);
+            out_buf.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+            out_buf.buf[0].fd = fd;
+            out_buf.buf[0].pos = offset;
+            written = fuse_buf_copy(&out_buf, in_buf, FUSE_BUF_SPLICE_MOVE);
+            if (written > 0 && open_file_mark_staged(handle, offset, (size_t) written) != 0)
+                written = -ENOMEM;
+        }
+    }
+    path_unlock(handle->filename);
+
+    if (written < 0)
+        fuse_reply_err(req, (int) -written);
+    else
+        fuse_reply_write(req, (size_t) written);
+}
+
+// Commits take the path lock exclusively, so concurrent handles on the same
+// file each get their own version number and metadata update.
+static void fs_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    OpenFile *handle = file_handle(fi);
+    int rc = 0;
+    if (handle) {
+        path_lock_write(handle->filename);
+        if (commit_handle(ino, handle) != 0)
+            rc = errno == ESTALE ? ESTALE : EIO;
+        path_unlock(handle->filename);
+    }
+    fuse_reply_err(req, rc);
+}
+
+static void fs_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi) {
+    (void) datasync;
+    OpenFile *handle = file_handle(fi);
+    int rc = 0;
+    if (handle) {
+        path_lock_write(handle->filename);
+        if (commit_handle(ino, handle) != 0)
+            rc = errno == ESTALE ? ESTALE : EIO;
+        path_unlock(handle->filename);
+    }
+    fuse_reply_err(req, rc);
+}
+
+// The last close commits pending writes. Once committed they are in the
+// journal, so the metadata is left for the cache to write back.
+static void fs_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    OpenFile *handle = file_handle(fi);
+    int rc = 0;
+    if (handle) {
+        path_lock_write(handle->filename);
+        if (commit_handle(ino, handle) != 0)
+            rc = errno == ESTALE ? ESTALE : EIO;
+        path_unlock(handle->filename);
+        open_file_destroy(handle);
+        fi->fh = 0;
+    }
+    fuse_reply_err(req, rc);
 }
 
 
 // Implementation of fs_create
-static int fs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+static void fs_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode,
+                      struct fuse_file_info *fi)
 {
-    (void) fi;
-    FileMetadata *metadata = create_file_metadata(path + 1);
+    char path[1024];
+    if (inode_table_child_path(parent, name, path, sizeof(path)) != 0)
+    {
+        fuse_reply_err(req, errno);
+        return;
+    }
+    if (virtual_path(path))
+    {
+        fuse_reply_err(req, EROFS);
+        return;
+    }
+    if (reserved_path(path))
+    {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
+    FileMetadata *metadata = create_file_metadata(path);
     if (!metadata)
-        return -ENOMEM;
-    
+    {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
     metadata->attributes.st_mode = S_IFREG | mode;
     metadata->attributes.st_nlink = 1;
     metadata->attributes.st_size = 0;
-    metadata->version_count = 0;
-    metadata->version_list = NULL;
 
-    if (save_metadata(metadata) != 0) 
+    path_lock_write(path);
+    if (save_metadata(metadata) != 0)
     {
+        path_unlock(path);
         destroy_file_metadata(metadata);
-        return -EIO;
+        fuse_reply_err(req, EIO);
+        return;
     }
-
     destroy_file_metadata(metadata);
-    return 0;
+    metadata_cache_forget(path);
+
+    OpenFile *handle = open_file_create(path);
+    path_unlock(path);
+    if (!handle)
+    {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    struct fuse_entry_param e;
+    int rc = make_entry(path, &e);
+    if (rc != 0)
+    {
+        open_file_destroy(handle);
+        fuse_reply_err(req, -rc);
+        return;
+    }
+    fi->fh = (uint64_t) (uintptr_t) handle;
+    fi->keep_cache = options.keep_cache;
+    fuse_reply_create(req, &e, fi);
 }
 
 // Implementation of fs_unlink
-static int fs_unlink(const char *path) {
-    // Remove metadata file
-    char filepath[1024];
-    snprintf(filepath, sizeof(filepath), "%s/%s.json", METADATA_DIR, path + 1);
-    if (unlink(filepath) != 0)
-        return -errno;
+static void fs_unlink(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    char path[1024];
+    if (inode_table_child_path(parent, name, path, sizeof(path)) != 0) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+    if (virtual_path(path)) {
+        fuse_reply_err(req, EROFS);
+        return;
+    }
+
+    path_lock_write(path);
+
+    // Remove metadata file. The cached copy is held meanwhile and a
+    // checkpoint held off, so nothing writes it back over the removal, and
+    // it is only forgotten once the removal worked: until it is written
+    // back it holds versions the file on disk does not have yet.
+    journal_begin();
+    FileMetadata *metadata = metadata_cache_acquire(path);
+    // What the file held counts towards collecting its chunks
+    uint64_t size = metadata ? (uint64_t) metadata->attributes.st_size : 0;
+    if (remove_metadata(path) != 0) {
+        int rc = errno;
+        if (metadata)
+            metadata_cache_release(metadata, 0);
+        journal_end();
+        path_unlock(path);
+        fuse_reply_err(req, rc);
+        return;
+    }
+    metadata_cache_forget(path);
+    if (metadata)
+        metadata_cache_release(metadata, 0);
+    version_manager_invalidate(path);
+    inode_table_unlink(path);
+    int logged = journal_log_unlink(path, size) == 0;
+    journal_end();
+
+    // Without its record, replay would apply the file's earlier commits to
+    // a file created later under its name, so a checkpoint drops them
+    // instead. Until one does, the versions they name are kept.
+    if (!logged && journal_checkpoint() != 0) {
+        path_unlock(path);
+        fuse_reply_err(req, EIO);
+        return;
+    }
 
     // Remove version directory
-    char dirpath[1024];
-    snprintf(dirpath, sizeof(dirpath), "%s/%s", VERSIONS_DIR, path + 1);
     // Remove all versions
-    DIR *d = opendir(dirpath);
+    char dirpath[1024];
+    DIR *d = NULL;
+    if (backing_path(VERSIONS_DIR, path, dirpath, sizeof(dirpath)) == 0)
+        d = opendir(dirpath);
     if (d) {
         struct dirent *dir;
         while ((dir = readdir(d)) != NULL) {
             if (dir->d_name[0] == '.')
                 continue;
             char version_path[1024];
-            snprintf(version_path, sizeof(version_path), "%s/%s", dirpath, dir->d_name);
-            unlink(version_path);
+            if (backing_path(dirpath, dir->d_name, version_path, sizeof(version_path)) == 0)
+                unlink(version_path);
         }
         closedir(d);
         rmdir(dirpath);
     }
-    return 0;
+    path_unlock(path);
+
+    // Its chunks may be shared, so they are only freed by a collection,
+    // which a checkpoint runs once enough has been unlinked.
+    if (journal_needs_checkpoint() && journal_checkpoint() != 0)
+        fprintf(stderr, "Failed to checkpoint the journal.\n");
+    fuse_reply_err(req, 0);
 }
 
 
-static int fs_mkdir(const char *path, mode_t mode) {
+static void fs_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode) {
+    char path[1024];
+    if (inode_table_child_path(parent, name, path, sizeof(path)) != 0) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+    if (virtual_path(path)) {
+        fuse_reply_err(req, EROFS);
+        return;
+    }
+    if (reserved_path(path)) {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
     // Create directory in .metadata
     char dirpath[1024];
-    snprintf(dirpath, sizeof(dirpath), ".metadata%s", path);
-    if (mkdir(dirpath, mode) != 0) {
-        return -EIO;
+    if (backing_path(METADATA_DIR, path, dirpath, sizeof(dirpath)) != 0 || mkdir(dirpath, mode) != 0) {
+        fuse_reply_err(req, EIO);
+        return;
     }
 
     // Create directory in .versions
-    snprintf(dirpath, sizeof(dirpath), ".versions%s", path);
-    if (mkdir(dirpath, mode) != 0) {
-        return -EIO;
+    if (backing_path(VERSIONS_DIR, path, dirpath, sizeof(dirpath)) != 0 || mkdir(dirpath, mode) != 0) {
+        fuse_reply_err(req, EIO);
+        return;
     }
 
-    return 0;
+    struct fuse_entry_param e;
+    int rc = make_entry(path, &e);
+    if (rc != 0)
+        fuse_reply_err(req, -rc);
+    else
+        fuse_reply_entry(req, &e);
 }
 
-static int fs_rmdir(const char *path) {
+static void fs_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    char path[1024];
+    if (inode_table_child_path(parent, name, path, sizeof(path)) != 0) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+    if (virtual_path(path)) {
+        fuse_reply_err(req, EROFS);
+        return;
+    }
+
     // Remove directory from .metadata
     char dirpath[1024];
-    snprintf(dirpath, sizeof(dirpath), ".metadata%s", path);
-    if (rmdir(dirpath) != 0) {
-        return -EIO;
+    if (backing_path(METADATA_DIR, path, dirpath, sizeof(dirpath)) != 0 || rmdir(dirpath) != 0) {
+        fuse_reply_err(req, EIO);
+        return;
     }
 
     // Remove directory from .versions
-    snprintf(dirpath, sizeof(dirpath), ".versions%s", path);
-    if (rmdir(dirpath) != 0) {
-        return -EIO;
+    if (backing_path(VERSIONS_DIR, path, dirpath, sizeof(dirpath)) != 0 || rmdir(dirpath) != 0) {
+        fuse_reply_err(req, EIO);
+        return;
     }
 
-    return 0;
+    inode_table_unlink(path);
+    fuse_reply_err(req, 0);
+}
+
+// Commits invalidate exactly what they change, so the kernel need not
+// re-check attributes on every read to notice new contents.
+static void fs_init(void *userdata, struct fuse_conn_info *conn)
+{
+    (void) userdata;
+    conn->want &= ~FUSE_CAP_AUTO_INVAL_DATA;
+
+    // Reads reply with backing file descriptors and writes are spliced
+    // into staging files; let libfuse use splice in both directions.
+    if (conn->capable & FUSE_CAP_SPLICE_WRITE)
+        conn->want |= FUSE_CAP_SPLICE_WRITE;
+    if (conn->capable & FUSE_CAP_SPLICE_MOVE)
+        conn->want |= FUSE_CAP_SPLICE_MOVE;
+    if (conn->capable & FUSE_CAP_SPLICE_READ)
+        conn->want |= FUSE_CAP_SPLICE_READ;
+}
+
+// Filesystem-wide controls, as extended attributes of the root:
+//   setfattr -n user.snapshot -v <name> <mnt>   take a snapshot
+//   getfattr -n user.epoch <mnt>                current commit epoch
+// and of any file or directory:
+//   setfattr -n user.rollback -v .snapshots/<name> <path>
+//   setfattr -n user.rollback -v .at/<unix-time> <path>
+//                                               roll back to that view
+#define XATTR_SNAPSHOT "user.snapshot"
+#define XATTR_EPOCH "user.epoch"
+#define XATTR_ROLLBACK "user.rollback"
+
+static void notify_rolled_back(const char *filename, void *context) {
+    (void) context;
+    invalidate_inode(inode_table_peek(filename), 1);
+}
+
+// The target is named by the root of its view, so it reads the same as a
+// path a user would cp from.
+static void rollback_xattr(fuse_req_t req, fuse_ino_t ino, const char *value, size_t size) {
+    const char *path = inode_table_path(ino);
+    if (!path) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if (virtual_path(path)) {
+        fuse_reply_err(req, EROFS);
+        return;
+    }
+
+    char target_path[1024];
+    TimeView target;
+    if (size == 0 || size >= sizeof(target_path)) {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+    memcpy(target_path, value, size);
+    target_path[size] = '\0';
+    if (time_view_parse(target_path, &target) != 0) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if (target.kind != TIME_VIEW_TREE || *target.path) {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
+    fuse_reply_err(req, rollback_path(path, &target, notify_rolled_back, NULL) == 0 ? 0 : errno);
+}
+
+static void fs_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name, const char *value, size_t size,
+                        int flags) {
+    (void) flags;
+    if (strcmp(name, XATTR_ROLLBACK) == 0) {
+        rollback_xattr(req, ino, value, size);
+        return;
+    }
+    if (ino != INODE_ROOT || strcmp(name, XATTR_SNAPSHOT) != 0) {
+        fuse_reply_err(req, ENOTSUP);
+        return;
+    }
+
+    char snapshot_name[SNAPSHOT_NAME_MAX];
+    if (size == 0 || size >= sizeof(snapshot_name)) {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+    memcpy(snapshot_name, value, size);
+    snapshot_name[size] = '\0';
+
+    fuse_reply_err(req, snapshot_create(snapshot_name, NULL) == 0 ? 0 : errno);
+}
+
+static void fs_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size) {
+    if (ino != INODE_ROOT || strcmp(name, XATTR_EPOCH) != 0) {
+        fuse_reply_err(req, ENODATA);
+        return;
+    }
+
+    char value[32];
+    int len = snprintf(value, sizeof(value), "%llu", (unsigned long long) journal_epoch());
+    if (size == 0)
+        fuse_reply_xattr(req, (size_t) len);
+    else if (size < (size_t) len)
+        fuse_reply_err(req, ERANGE);
+    else
+        fuse_reply_buf(req, value, (size_t) len);
+}
+
+// Unmount: write back everything still dirty in the metadata cache and
+// empty the journal
+static void fs_destroy(void *userdata)
+{
+    (void) userdata;
+    readahead_shutdown();
+    if (journal_checkpoint() != 0)
+        fprintf(stderr, "Failed to write back cached metadata.\n");
 }
 
-static struct fuse_operations fs_operations = 
+static struct fuse_lowlevel_ops fs_operations =
 {
-    .getattr    = fs_getattr,
-    .readdir    = fs_readdir,
-    .open       = fs_open,
-    .read       = fs_read,
-    .write      = fs_write,
-    .create     = fs_create,
-    .unlink     = fs_unlink,
-    .mkdir      = fs_mkdir,
-    .rmdir      = fs_rmdir,
+    .init         = fs_init,
+    .lookup       = fs_lookup,
+    .forget       = fs_forget,
+    .forget_multi = fs_forget_multi,
+    .getattr      = fs_getattr,
+    .opendir      = fs_opendir,
+    .readdir      = fs_readdir,
+    .readdirplus  = fs_readdirplus,
+    .releasedir   = fs_releasedir,
+    .open         = fs_open,
+    .read         = fs_read,
+    .write        = fs_write,
+    .write_buf    = fs_write_buf,
+    .flush        = fs_flush,
+    .fsync        = fs_fsync,
+    .release      = fs_release,
+    .create       = fs_create,
+    .unlink       = fs_unlink,
+    .mkdir        = fs_mkdir,
+    .rmdir        = fs_rmdir,
+    .setxattr     = fs_setxattr,
+    .getxattr     = fs_getxattr,
+    .destroy      = fs_destroy,
 };
 
 
-int main(int argc, char *argv[]) 
+int main(int argc, char *argv[])
 {
     // Ensure metadata and versions directories exist
-    if (ensure_directory_exists(METADATA_DIR) != 0) 
+    if (ensure_directory_exists(METADATA_DIR) != 0)
     {
         fprintf(stderr, "Failed to create metadata directory.\n");
         return 1;
     }
-    if (ensure_directory_exists(VERSIONS_DIR) != 0) 
+    if (ensure_directory_exists(VERSIONS_DIR) != 0)
     {
         fprintf(stderr, "Failed to create versions directory.\n");
         return 1;
     }
 
-    return fuse_main(argc, argv, &fs_operations, NULL);
-}
\ No newline at end of file
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    if (fuse_opt_parse(&args, &options, fs_opts, NULL) == -1)
+        return 1;
+
+    if (options.codec)
+    {
+        int codec = codec_from_name(options.codec);
+        if (codec < 0)
+        {
+            fprintf(stderr, "Unknown codec '%s' (expected none, fast or dense).\n", options.codec);
+            fuse_opt_free_args(&args);
+            return 1;
+        }
+        codec_set_default(codec);
+    }
+    if (options.block_cache_mb >= 0)
+        block_cache_set_budget((size_t) options.block_cache_mb * 1024 * 1024);
+    journal_set_group(options.commit_window_us, options.commit_batch);
+
+    struct fuse_cmdline_opts opts;
+    if (fuse_parse_cmdline(&args, &opts) != 0)
+    {
+        fuse_opt_free_args(&args);
+        return 1;
+    }
+
+    int ret = 1;
+    if (opts.show_help)
+    {
+        printf("usage: %s [options] <mountpoint>\n\n", argv[0]);
+        printf("    -o codec=none|fast|dense   compression for new versions\n");
+        printf("    -o attr_timeout=T          seconds to cache attributes (default: %.0f)\n", DEFAULT_CACHE_TIMEOUT);
+        printf("    -o entry_timeout=T         seconds to cache names (default: %.0f)\n", DEFAULT_CACHE_TIMEOUT);
+        printf("    -o negative_timeout=T      seconds to cache missing names (default: %.0f)\n", DEFAULT_NEGATIVE_TIMEOUT);
+        printf("    -o [no]keep_cache          keep file contents cached across opens (default: on)\n");
+        printf("    -o block_cache_mb=N        memory for decoded version data, 0 to disable (default: %zu)\n",
+               BLOCK_CACHE_DEFAULT_BUDGET / (1024 * 1024));
+        printf("    -o commit_window_us=N      how long a journal sync waits for concurrent commits (default: %d)\n",
+               JOURNAL_DEFAULT_GROUP_WINDOW_US);
+        printf("    -o commit_batch=N          commits that end the wait early (default: %d)\n",
+               JOURNAL_DEFAULT_GROUP_SIZE);
+        fuse_cmdline_help();
+        fuse_lowlevel_help();
+        ret = 0;
+    }
+    else if (opts.show_version)
+    {
+        fuse_lowlevel_version();
+        ret = 0;
+    }
+    else if (!opts.mountpoint)
+    {
+        fprintf(stderr, "usage: %s [options] <mountpoint>\n", argv[0]);
+    }
+    else if (journal_recover() != 0 || journal_open() != 0)
+    {
+        fprintf(stderr, "Failed to recover the commit journal.\n");
+    }
+    else
+    {
+        struct fuse_session *se = fuse_session_new(&args, &fs_operations, sizeof(fs_operations), NULL);
+        session = se;
+        if (se)
+        {
+            if (fuse_set_signal_handlers(se) == 0)
+            {
+                if (fuse_session_mount(se, opts.mountpoint) == 0)
+                {
+                    fuse_daemonize(opts.foreground);
+                    if (opts.singlethread)
+                        ret = fuse_session_loop(se);
+                    else
+                        ret = fuse_session_loop_mt(se, opts.clone_fd);
+                    fuse_session_unmount(se);
+                }
+                fuse_remove_signal_handlers(se);
+            }
+            session = NULL;
+            fuse_session_destroy(se);
+        }
+        journal_close();
+    }
+
+    free(opts.mountpoint);
+    fuse_opt_free_args(&args);
+    return ret ? 1 : 0;
+}
@@ -0,0 +1,334 @@
+// src/metadata_cache.c
+#include "metadata_cache.h"
+#include "metadata_manager.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct CacheEntry {
+    char *filename;
+    FileMetadata *metadata; // NULL: known not to exist
+    int refs;
+    int dirty;
+    int writing;  // Being written back with cache_lock dropped
+    int detached; // Forgotten while still referenced
+    struct CacheEntry *hash_next;
+    struct CacheEntry *lru_prev;
+    struct CacheEntry *lru_next;
+} CacheEntry;
+
+static CacheEntry **buckets;
+static size_t bucket_count;
+static size_t entry_count;
+static CacheEntry *lru_head; // Most recently used
+static CacheEntry *lru_tail;
+static CacheEntry *detached_list; // Forgotten while still referenced
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t written = PTHREAD_COND_INITIALIZER; // A write-back finished
+static int writing_count;
+static unsigned long write_back_failures;
+
+static uint64_t hash_name(const char *name) {
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+    for (; *name; name++) {
+        hash ^= (unsigned char) *name;
+        hash *= UINT64_C(0x100000001b3);
+    }
+    return hash;
+}
+
+static CacheEntry *find_entry(const char *filename) {
+    if (!buckets)
+        return NULL;
+    CacheEntry *entry = buckets[hash_name(filename) & (bucket_count - 1)];
+    while (entry && strcmp(entry->filename, filename) != 0)
+        entry = entry->hash_next;
+    return entry;
+}
+
+static void lru_unlink(CacheEntry *entry) {
+    if (entry->lru_prev)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        lru_head = entry->lru_next;
+    if (entry->lru_next)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        lru_tail = entry->lru_prev;
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void lru_push_front(CacheEntry *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+    if (lru_head)
+        lru_head->lru_prev = entry;
+    lru_head = entry;
+    if (!lru_tail)
+        lru_tail = entry;
+}
+
+static int grow_buckets(void) {
+    size_t count = bucket_count ? bucket_count * 2 : 1024;
+    CacheEntry **grown = calloc(count, sizeof(CacheEntry *));
+    if (!grown)
+        return -1;
+
+    for (size_t i = 0; i < bucket_count; i++) {
+        CacheEntry *entry = buckets[i];
+        while (entry) {
+            CacheEntry *next = entry->hash_next;
+            size_t slot = hash_name(entry->filename) & (count - 1);
+            entry->hash_next = grown[slot];
+            grown[slot] = entry;
+            entry = next;
+        }
+    }
+    free(buckets);
+    buckets = grown;
+    bucket_count = count;
+    return 0;
+}
+
+static void unlink_entry(CacheEntry *entry) {
+    CacheEntry **link = &buckets[hash_name(entry->filename) & (bucket_count - 1)];
+    while (*link != entry)
+        link = &(*link)->hash_next;
+    *link = entry->hash_next;
+    lru_unlink(entry);
+    entry_count--;
+}
+
+static void free_entry(CacheEntry *entry) {
+    destroy_file_metadata(entry->metadata);
+    free(entry->filename);
+    free(entry);
+}
+
+static void drop_ref(CacheEntry *entry) {
+    if (--entry->refs > 0 || !entry->detached)
+        return;
+    CacheEntry **link = &detached_list;
+    while (*link != entry)
+        link = &(*link)->hash_next;
+    *link = entry->hash_next;
+    free_entry(entry);
+}
+
+// Find an entry once any write-back of it is over. Returns with cache_lock
+// held, but may have dropped it while waiting.
+static CacheEntry *find_settled_entry(const char *filename) {
+    CacheEntry *entry;
+    while ((entry = find_entry(filename)) && entry->writing)
+        pthread_cond_wait(&written, &cache_lock);
+    return entry;
+}
+
+// Disk I/O runs with cache_lock dropped, so lookups of other files never
+// wait behind it. The entry is pinned so it cannot be freed, and marked
+// so it is not handed out until it is written; nobody holding it changes
+// it meanwhile, since eviction only writes entries nobody holds and a
+// flush runs with commits held off.
+static void begin_write_back(CacheEntry *entry) {
+    entry->refs++;
+    entry->writing = 1;
+    writing_count++;
+}
+
+static void end_write_back(CacheEntry *entry, int rc) {
+    if (rc == 0)
+        entry->dirty = 0;
+    else
+        write_back_failures++;
+    entry->writing = 0;
+    writing_count--;
+    pthread_cond_broadcast(&written);
+    drop_ref(entry);
+}
+
+// Drop least recently used entries that nobody holds. Dirty ones are
+// written back first and kept if that fails.
+static void evict_overflow(void) {
+    while (entry_count > METADATA_CACHE_CAPACITY) {
+        CacheEntry *entry = lru_tail;
+        while (entry && (entry->refs > 0 || entry->writing))
+            entry = entry->lru_prev;
+        if (!entry)
+            return;
+
+        if (!entry->dirty) {
+            unlink_entry(entry);
+            free_entry(entry);
+            continue;
+        }
+        begin_write_back(entry);
+        pthread_mutex_unlock(&cache_lock);
+        int rc = save_metadata(entry->metadata);
+        pthread_mutex_lock(&cache_lock);
+        end_write_back(entry, rc);
+        if (rc != 0)
+            return; // Try again on the next miss
+    }
+}
+
+FileMetadata *metadata_cache_acquire(const char *filename) {
+    if (!filename) return NULL;
+
+    pthread_mutex_lock(&cache_lock);
+    CacheEntry *entry = find_settled_entry(filename);
+    if (entry) {
+        lru_unlink(entry);
+        lru_push_front(entry);
+        if (entry->metadata)
+            entry->refs++;
+        FileMetadata *metadata = entry->metadata;
+        pthread_mutex_unlock(&cache_lock);
+        return metadata;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    // Miss: parse outside the lock, then publish unless someone beat us to it.
+    FileMetadata *loaded = load_metadata(filename);
+
+    pthread_mutex_lock(&cache_lock);
+    entry = find_settled_entry(filename);
+    if (!entry) {
+        entry = calloc(1, sizeof(CacheEntry));
+        if (entry)
+            entry->filename = strdup(filename);
+        if (!entry || !entry->filename || (entry_count + 1 > bucket_count && grow_buckets() != 0)) {
+            if (entry)
+                free(entry->filename);
+            free(entry);
+            pthread_mutex_unlock(&cache_lock);
+            if (loaded) // Still usable, just not cached
+                destroy_file_metadata(loaded);
+            return NULL;
+        }
+        entry->metadata = loaded;
+        loaded = NULL;
+
+        size_t slot = hash_name(filename) & (bucket_count - 1);
+        entry->hash_next = buckets[slot];
+        buckets[slot] = entry;
+        lru_push_front(entry);
+        entry_count++;
+    }
+    if (entry->metadata)
+        entry->refs++;
+    FileMetadata *metadata = entry->metadata;
+    evict_overflow();
+    pthread_mutex_unlock(&cache_lock);
+
+    destroy_file_metadata(loaded);
+    return metadata;
+}
+
+// Copy a cached file's attributes without loading anything on a miss.
+// Returns 0 if the file is cached, 1 if it is cached as missing and -1 if
+// the cache does not know it.
+int metadata_cache_peek(const char *filename, struct stat *attributes) {
+    if (!filename) return -1;
+
+    pthread_mutex_lock(&cache_lock);
+    CacheEntry *entry = find_entry(filename);
+    int rc = -1;
+    if (entry) {
+        rc = entry->metadata ? 0 : 1;
+        if (entry->metadata && attributes)
+            *attributes = entry->metadata->attributes;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return rc;
+}
+
+void metadata_cache_release(FileMetadata *metadata, int dirty) {
+    if (!metadata) return;
+
+    pthread_mutex_lock(&cache_lock);
+    CacheEntry *entry = find_entry(metadata->filename);
+    if (entry && entry->metadata == metadata) {
+        entry->refs--;
+        if (dirty)
+            entry->dirty = 1;
+    } else {
+        entry = detached_list;
+        while (entry && entry->metadata != metadata)
+            entry = entry->hash_next;
+        if (entry)
+            drop_ref(entry);
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// Write back every dirty entry, and wait for any an eviction is writing.
+// Changes are marked dirty before their commit ends, so with commits held
+// off this leaves nothing unwritten unless it fails.
+int metadata_cache_flush(void) {
+    pthread_mutex_lock(&cache_lock);
+    unsigned long failures = write_back_failures;
+    CacheEntry **batch = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    int rc = 0;
+    for (CacheEntry *entry = lru_head; entry && rc == 0; entry = entry->lru_next) {
+        if (!entry->dirty || !entry->metadata || entry->writing)
+            continue;
+        if (count == capacity) {
+            size_t grown = capacity ? capacity * 2 : 64;
+            CacheEntry **larger = realloc(batch, sizeof(CacheEntry *) * grown);
+            if (!larger) {
+                rc = -1;
+                break;
+            }
+            batch = larger;
+            capacity = grown;
+        }
+        begin_write_back(entry);
+        batch[count++] = entry;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    int *results = malloc(sizeof(int) * (count ? count : 1));
+    for (size_t i = 0; i < count; i++) {
+        int saved = save_metadata(batch[i]->metadata);
+        if (results)
+            results[i] = saved;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    for (size_t i = 0; i < count; i++)
+        end_write_back(batch[i], results ? results[i] : -1);
+    while (writing_count > 0)
+        pthread_cond_wait(&written, &cache_lock);
+    if (write_back_failures != failures)
+        rc = -1;
+    pthread_mutex_unlock(&cache_lock);
+    free(results);
+    free(batch);
+    return rc;
+}
+
+// Drop an entry without writing it back, for files that were just created
+// or removed on disk. A write-back already under way is waited for; one
+// that would land after a removal is ruled out by holding the entry and a
+// checkpoint off across it. Holders keep their reference until they
+// release it.
+void metadata_cache_forget(const char *filename) {
+    if (!filename) return;
+
+    pthread_mutex_lock(&cache_lock);
+    CacheEntry *entry = find_settled_entry(filename);
+    if (entry) {
+        unlink_entry(entry);
+        if (entry->refs > 0) {
+            entry->detached = 1;
+            entry->hash_next = detached_list;
+            detached_list = entry;
+        } else {
+            free_entry(entry);
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,120 @@
+// src/metadata_json.c
+#include "metadata_json.h"
+#include <stdlib.h>
+#include <string.h>
+#include "cJSON.h"
+
+char *metadata_to_json(const FileMetadata *metadata) {
+    if (!metadata || !metadata->filename) return NULL;
+
+    cJSON *json = cJSON_CreateObject();
+    if (!json)
+        return NULL;
+
+    cJSON_AddStringToObject(json, "filename", metadata->filename);
+    cJSON_AddNumberToObject(json, "version_count", metadata->version_count);
+
+    cJSON *attr = cJSON_CreateObject();
+    if (!attr) {
+        cJSON_Delete(json);
+        return NULL;
+    }
+    cJSON_AddNumberToObject(attr, "st_mode", metadata->attributes.st_mode);
+    cJSON_AddNumberToObject(attr, "st_size", metadata->attributes.st_size);
+    cJSON_AddNumberToObject(attr, "st_mtime", metadata->attributes.st_mtime);
+    cJSON_AddItemToObject(json, "attributes", attr);
+
+    cJSON *versions = cJSON_CreateArray();
+    if (!versions) {
+        cJSON_Delete(json);
+        return NULL;
+    }
+    for (int i = 0; i < metadata->version_count; i++) {
+        cJSON *ver = cJSON_CreateObject();
+        if (!ver)
+            continue;
+        char data_pointer[1024];
+        version_data_pointer(metadata->filename, &metadata->version_list[i], data_pointer, sizeof(data_pointer));
+        cJSON_AddNumberToObject(ver, "version_id", metadata->version_list[i].version_id);
+        cJSON_AddNumberToObject(ver, "timestamp", metadata->version_list[i].timestamp);
+        cJSON_AddNumberToObject(ver, "epoch", (double) metadata->version_list[i].epoch);
+        cJSON_AddNumberToObject(ver, "data_version", metadata->version_list[i].data_version);
+        cJSON_AddStringToObject(ver, "data_pointer", data_pointer);
+        cJSON_AddItemToArray(versions, ver);
+    }
+    cJSON_AddItemToObject(json, "version_list", versions);
+
+    char *json_str = cJSON_Print(json);
+    cJSON_Delete(json);
+    return json_str;
+}
+
+FileMetadata *metadata_from_json(const char *filename, const char *content) {
+    if (!filename || !content) return NULL;
+
+    cJSON *json = cJSON_Parse(content);
+    if (!json) return NULL;
+
+    FileMetadata *metadata = create_file_metadata(filename);
+    if (!metadata) {
+        cJSON_Delete(json);
+        return NULL;
+    }
+
+    cJSON *version_count_item = cJSON_GetObjectItemCaseSensitive(json, "version_count");
+    if (cJSON_IsNumber(version_count_item))
+        metadata->version_count = version_count_item->valueint;
+
+    cJSON *attr = cJSON_GetObjectItemCaseSensitive(json, "attributes");
+    if (cJSON_IsObject(attr)) {
+        cJSON *st_mode_item = cJSON_GetObjectItemCaseSensitive(attr, "st_mode");
+        cJSON *st_size_item = cJSON_GetObjectItemCaseSensitive(attr, "st_size");
+        cJSON *st_mtime_item = cJSON_GetObjectItemCaseSensitive(attr, "st_mtime");
+
+        if (cJSON_IsNumber(st_mode_item))
+            metadata->attributes.st_mode = (mode_t) st_mode_item->valueint;
+        if (cJSON_IsNumber(st_size_item))
+            metadata->attributes.st_size = (off_t) st_size_item->valuedouble;
+        if (cJSON_IsNumber(st_mtime_item))
+            metadata->attributes.st_mtime = (time_t) st_mtime_item->valuedouble;
+    }
+
+    cJSON *versions = cJSON_GetObjectItemCaseSensitive(json, "version_list");
+    if (cJSON_IsArray(versions) && metadata->version_count > 0) {
+        metadata->version_list = calloc(metadata->version_count, sizeof(VersionInfo));
+        if (!metadata->version_list) {
+            destroy_file_metadata(metadata);
+            cJSON_Delete(json);
+            return NULL;
+        }
+        metadata->version_capacity = metadata->version_count;
+
+        int i = 0;
+        cJSON *ver;
+        cJSON_ArrayForEach(ver, versions) {
+            if (i >= metadata->version_count)
+                break;
+
+            cJSON *version_id_item = cJSON_GetObjectItemCaseSensitive(ver, "version_id");
+            cJSON *timestamp_item = cJSON_GetObjectItemCaseSensitive(ver, "timestamp");
+            cJSON *epoch_item = cJSON_GetObjectItemCaseSensitive(ver, "epoch");
+            cJSON *data_version_item = cJSON_GetObjectItemCaseSensitive(ver, "data_version");
+
+            if (cJSON_IsNumber(version_id_item))
+                metadata->version_list[i].version_id = version_id_item->valueint;
+            if (cJSON_IsNumber(timestamp_item))
+                metadata->version_list[i].timestamp = (int64_t) timestamp_item->valuedouble;
+            if (cJSON_IsNumber(epoch_item))
+                metadata->version_list[i].epoch = (uint64_t) epoch_item->valuedouble;
+            if (cJSON_IsNumber(data_version_item))
+                metadata->version_list[i].data_version = data_version_item->valueint;
+            i++;
+        }
+        metadata->version_count = i;
+    } else {
+        metadata->version_count = 0;
+    }
+
+    cJSON_Delete(json);
+    return metadata;
+}
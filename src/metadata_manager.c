@@ -1,88 +1,162 @@
 #include "metadata_manager.h"
+#include "metadata_json.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include "cJSON.h"
+#include <sys/uio.h>
 
 #define METADATA_DIR ".metadata"
+#define METADATA_MAGIC "VFSM"
+#define METADATA_FORMAT 1
+
+// On-disk layout of .metadata/<file>.meta: this header followed by an
+// append-only log of packed VersionInfo records, record_size bytes each.
+// A commit appends its new records and then rewrites the header in place,
+// so it costs the same however long the history is; the header write is
+// what makes the records visible, and anything past version_count is
+// ignored on load. When record_size matches sizeof(VersionInfo) the whole
+// file is loaded with a single preadv and no parsing.
+typedef struct {
+    char magic[4];
+    uint32_t format;
+    uint32_t record_size;
+    uint32_t version_count;
+    uint32_t mode;
+    uint32_t nlink;
+    uint32_t uid;
+    uint32_t gid;
+    int64_t size;
+    int64_t atime;
+    int64_t mtime;
+    int64_t ctime;
+} MetadataHeader;
 
 int ensure_directory_exists(const char *path) {
     struct stat st = {0};
     if (stat(path, &st) == -1) {
-        if (mkdir(path, 0755) != 0)
+        // Another thread may create it first
+        if (mkdir(path, 0755) != 0 && errno != EEXIST)
             return -1;
     }
     return 0;
 }
 
+static void metadata_path(const char *filename, const char *extension, char *path, size_t size) {
+    snprintf(path, size, "%s/%s%s", METADATA_DIR, filename, extension);
+}
+
+// Make a new name in path's directory durable.
+static int sync_parent(const char *path) {
+    char dirpath[1024];
+    const char *slash = strrchr(path, '/');
+    snprintf(dirpath, sizeof(dirpath), "%.*s", slash ? (int) (slash - path) : 1, slash ? path : ".");
+    int fd = open(dirpath, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return -1;
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
 int save_metadata(FileMetadata *metadata) {
     if (!metadata || !metadata->filename) return -1;
 
     char filepath[1024];
-    snprintf(filepath, sizeof(filepath), "%s/%s.json", METADATA_DIR, metadata->filename);
+    metadata_path(metadata->filename, METADATA_EXTENSION, filepath, sizeof(filepath));
 
     if (ensure_directory_exists(METADATA_DIR) != 0)
         return -1;
 
-    cJSON *json = cJSON_CreateObject();
-    if (!json)
-        return -1;
+    MetadataHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, METADATA_MAGIC, 4);
+    header.format = METADATA_FORMAT;
+    header.record_size = sizeof(VersionInfo);
+    header.version_count = (uint32_t) metadata->version_count;
+    header.mode = metadata->attributes.st_mode;
+    header.nlink = (uint32_t) metadata->attributes.st_nlink;
+    header.uid = metadata->attributes.st_uid;
+    header.gid = metadata->attributes.st_gid;
+    header.size = metadata->attributes.st_size;
+    header.atime = metadata->attributes.st_atime;
+    header.mtime = metadata->attributes.st_mtime;
+    header.ctime = metadata->attributes.st_ctime;
 
-    cJSON_AddStringToObject(json, "filename", metadata->filename);
-    cJSON_AddNumberToObject(json, "version_count", metadata->version_count);
+    int fd = -1;
+    if (metadata->persisted_count >= 0 && metadata->persisted_count <= metadata->version_count)
+        fd = open(filepath, O_WRONLY);
 
-    cJSON *attr = cJSON_CreateObject();
-    if (!attr) {
-        cJSON_Delete(json);
-        return -1;
+    if (fd >= 0) {
+        // Append the records added since the last save, then publish them.
+        // The records must be on disk before the header that points at
+        // them, and the header before the journal can forget them.
+        size_t persisted = (size_t) metadata->persisted_count;
+        size_t appended = (size_t) metadata->version_count - persisted;
+        ssize_t record_bytes = (ssize_t) (sizeof(VersionInfo) * appended);
+        if (appended > 0 &&
+            (pwrite(fd, metadata->version_list + persisted, (size_t) record_bytes,
+                    (off_t) (sizeof(header) + sizeof(VersionInfo) * persisted)) != record_bytes ||
+             fdatasync(fd) != 0)) {
+            close(fd);
+            return -1;
+        }
+        int ok = pwrite(fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header) && fdatasync(fd) == 0;
+        if (close(fd) != 0 || !ok)
+            return -1;
+        metadata->persisted_count = metadata->version_count;
+        return 0;
     }
-    cJSON_AddNumberToObject(attr, "st_mode", metadata->attributes.st_mode);
-    cJSON_AddNumberToObject(attr, "st_size", metadata->attributes.st_size);
-    cJSON_AddNumberToObject(attr, "st_mtime", metadata->attributes.st_mtime);
-    cJSON_AddItemToObject(json, "attributes", attr);
-
-    cJSON *versions = cJSON_CreateArray();
-    if (!versions) {
-        cJSON_Delete(json);
+
+    // No log yet, or one that cannot be appended to: write it out in full
+    // under a temporary name and rename it over the old one, so a crash
+    // leaves either the old log or the new one, never a truncated file.
+    char tmppath[1100];
+    snprintf(tmppath, sizeof(tmppath), "%s.tmp", filepath);
+    fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
         return -1;
-    }
-    for (int i = 0; i < metadata->version_count; i++) {
-        cJSON *ver = cJSON_CreateObject();
-        if (!ver)
-            continue;
-        cJSON_AddNumberToObject(ver, "version_id", metadata->version_list[i].version_id);
-        cJSON_AddNumberToObject(ver, "timestamp", metadata->version_list[i].timestamp);
-        cJSON_AddStringToObject(ver, "data_pointer", metadata->version_list[i].data_pointer);
-        cJSON_AddItemToArray(versions, ver);
-    }
-    cJSON_AddItemToObject(json, "version_list", versions);
 
-    FILE *file = fopen(filepath, "w");
-    if (!file) {
-        cJSON_Delete(json);
+    struct iovec iov[2] = {
+        { &header, sizeof(header) },
+        { metadata->version_list, sizeof(VersionInfo) * (size_t) metadata->version_count },
+    };
+    ssize_t expected = (ssize_t) (iov[0].iov_len + iov[1].iov_len);
+    int ok = pwritev(fd, iov, metadata->version_count > 0 ? 2 : 1, 0) == expected && fdatasync(fd) == 0;
+    if (close(fd) != 0 || !ok || rename(tmppath, filepath) != 0) {
+        unlink(tmppath);
         return -1;
     }
-    char *json_str = cJSON_Print(json);
-    if (!json_str) {
-        fclose(file);
-        cJSON_Delete(json);
+    if (sync_parent(filepath) != 0)
         return -1;
-    }
-    fputs(json_str, file);
-    fclose(file);
+    metadata->persisted_count = metadata->version_count;
 
-    free(json_str);
-    cJSON_Delete(json);
+    // Drop the JSON file this one replaces, if it was migrated from one.
+    metadata_path(metadata->filename, METADATA_LEGACY_EXTENSION, filepath, sizeof(filepath));
+    unlink(filepath);
     return 0;
 }
 
-FileMetadata *load_metadata(const char *filename) {
-    if (!filename) return NULL;
+static void attributes_from_header(const MetadataHeader *header, struct stat *attributes) {
+    attributes->st_mode = header->mode;
+    attributes->st_nlink = header->nlink;
+    attributes->st_uid = header->uid;
+    attributes->st_gid = header->gid;
+    attributes->st_size = header->size;
+    attributes->st_atime = header->atime;
+    attributes->st_mtime = header->mtime;
+    attributes->st_ctime = header->ctime;
+}
 
+// Metadata from before the binary format: parse the JSON file.
+static FileMetadata *load_legacy_metadata(const char *filename) {
     char filepath[1024];
-    snprintf(filepath, sizeof(filepath), "%s/%s.json", METADATA_DIR, filename);
+    metadata_path(filename, METADATA_LEGACY_EXTENSION, filepath, sizeof(filepath));
 
     FILE *file = fopen(filepath, "r");
     if (!file) return NULL;
@@ -99,63 +173,148 @@ FileMetadata *load_metadata(const char *filename) {
     content[read_size] = '\0';
     fclose(file);
 
-    cJSON *json = cJSON_Parse(content);
+    FileMetadata *metadata = metadata_from_json(filename, content);
     free(content);
-    if (!json) return NULL;
+    return metadata;
+}
+
+FileMetadata *load_metadata(const char *filename) {
+    if (!filename) return NULL;
+
+    char filepath[1024];
+    metadata_path(filename, METADATA_EXTENSION, filepath, sizeof(filepath));
+
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0)
+        return errno == ENOENT ? load_legacy_metadata(filename) : NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(MetadataHeader)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t records_size = (size_t) st.st_size - sizeof(MetadataHeader);
+    MetadataHeader header;
+    char *records = malloc(records_size ? records_size : 1);
+    if (!records) {
+        close(fd);
+        return NULL;
+    }
+
+    struct iovec iov[2] = { { &header, sizeof(header) }, { records, records_size } };
+    ssize_t read_size = preadv(fd, iov, 2, 0);
+    close(fd);
+
+    if (read_size != st.st_size || memcmp(header.magic, METADATA_MAGIC, 4) != 0 ||
+        header.record_size == 0 || (size_t) header.version_count * header.record_size > records_size) {
+        free(records);
+        return NULL;
+    }
 
     FileMetadata *metadata = create_file_metadata(filename);
     if (!metadata) {
-        cJSON_Delete(json);
+        free(records);
         return NULL;
     }
 
-    cJSON *version_count_item = cJSON_GetObjectItemCaseSensitive(json, "version_count");
-    if (cJSON_IsNumber(version_count_item))
-        metadata->version_count = version_count_item->valueint;
-
-    cJSON *attr = cJSON_GetObjectItemCaseSensitive(json, "attributes");
-    if (cJSON_IsObject(attr)) {
-        cJSON *st_mode_item = cJSON_GetObjectItemCaseSensitive(attr, "st_mode");
-        cJSON *st_size_item = cJSON_GetObjectItemCaseSensitive(attr, "st_size");
-        cJSON *st_mtime_item = cJSON_GetObjectItemCaseSensitive(attr, "st_mtime");
-
-        if (cJSON_IsNumber(st_mode_item))
-            metadata->attributes.st_mode = (mode_t) st_mode_item->valueint;
-        if (cJSON_IsNumber(st_size_item))
-            metadata->attributes.st_size = (off_t) st_size_item->valueint;
-        if (cJSON_IsNumber(st_mtime_item))
-            metadata->attributes.st_mtime = (time_t) st_mtime_item->valueint;
-    }
+    attributes_from_header(&header, &metadata->attributes);
+    metadata->version_count = (int) header.version_count;
+    metadata->version_capacity = (int) header.version_count;
 
-    cJSON *versions = cJSON_GetObjectItemCaseSensitive(json, "version_list");
-    if (cJSON_IsArray(versions)) {
-        metadata->version_list = malloc(sizeof(VersionInfo) * metadata->version_count);
+    if (header.version_count == 0) {
+        free(records);
+        if (header.record_size == sizeof(VersionInfo))
+            metadata->persisted_count = 0;
+    } else if (header.record_size == sizeof(VersionInfo)) {
+        // Records beyond version_count were never published; the next
+        // append overwrites them.
+        metadata->version_list = (VersionInfo *) records;
+        metadata->persisted_count = metadata->version_count;
+    } else {
+        // Records written with a different layout: copy the common prefix.
+        metadata->version_list = calloc(header.version_count, sizeof(VersionInfo));
         if (!metadata->version_list) {
+            free(records);
             destroy_file_metadata(metadata);
-            cJSON_Delete(json);
             return NULL;
         }
-
-        int i = 0;
-        cJSON *ver;
-        cJSON_ArrayForEach(ver, versions) {
-            if (i >= metadata->version_count)
-                break;
-
-            cJSON *version_id_item = cJSON_GetObjectItemCaseSensitive(ver, "version_id");
-            cJSON *timestamp_item = cJSON_GetObjectItemCaseSensitive(ver, "timestamp");
-            cJSON *data_pointer_item = cJSON_GetObjectItemCaseSensitive(ver, "data_pointer");
-
-            if (cJSON_IsNumber(version_id_item))
-                metadata->version_list[i].version_id = version_id_item->valueint;
-            if (cJSON_IsNumber(timestamp_item))
-                metadata->version_list[i].timestamp = (time_t) timestamp_item->valuedouble;
-            if (cJSON_IsString(data_pointer_item))
-                metadata->version_list[i].data_pointer = strdup(data_pointer_item->valuestring);
-            i++;
-        }
+        size_t common = header.record_size < sizeof(VersionInfo) ? header.record_size : sizeof(VersionInfo);
+        for (uint32_t i = 0; i < header.version_count; i++)
+            memcpy(&metadata->version_list[i], records + (size_t) i * header.record_size, common);
+        free(records);
     }
 
-    cJSON_Delete(json);
     return metadata;
 }
+
+// Remove a file's metadata in whichever format it is stored. Fails with
+// errno set if there was none.
+int remove_metadata(const char *filename) {
+    if (!filename) return -1;
+
+    char filepath[1024];
+    metadata_path(filename, METADATA_EXTENSION, filepath, sizeof(filepath));
+    int removed = unlink(filepath) == 0;
+    int saved_errno = errno;
+
+    metadata_path(filename, METADATA_LEGACY_EXTENSION, filepath, sizeof(filepath));
+    if (unlink(filepath) == 0)
+        removed = 1;
+    else if (!removed && errno == ENOENT)
+        errno = saved_errno;
+
+    return removed ? 0 : -1;
+}
+
+// Length of the metadata extension name ends with, or 0 if it has none.
+size_t metadata_extension_length(const char *name) {
+    const char *extensions[] = { METADATA_EXTENSION, METADATA_LEGACY_EXTENSION };
+    size_t len = strlen(name);
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+        size_t ext_len = strlen(extensions[i]);
+        if (len > ext_len && strcmp(name + len - ext_len, extensions[i]) == 0)
+            return ext_len;
+    }
+    return 0;
+}
+
+// Just the attributes of a file, from the fixed-size header and without
+// reading its version log. dirfd, if not -1, is an open descriptor for the
+// .metadata directory holding the file, so listing a directory does not
+// resolve the full path of every entry.
+int load_metadata_attributes(int dirfd, const char *filename, struct stat *attributes) {
+    if (!filename || !attributes) return -1;
+
+    char filepath[1024];
+    int fd;
+    if (dirfd >= 0) {
+        const char *base = strrchr(filename, '/');
+        snprintf(filepath, sizeof(filepath), "%s%s", base ? base + 1 : filename, METADATA_EXTENSION);
+        fd = openat(dirfd, filepath, O_RDONLY);
+    } else {
+        metadata_path(filename, METADATA_EXTENSION, filepath, sizeof(filepath));
+        fd = open(filepath, O_RDONLY);
+    }
+
+    if (fd < 0) {
+        if (errno != ENOENT)
+            return -1;
+        FileMetadata *metadata = load_legacy_metadata(filename);
+        if (!metadata)
+            return -1;
+        *attributes = metadata->attributes;
+        destroy_file_metadata(metadata);
+        return 0;
+    }
+
+    MetadataHeader header;
+    ssize_t read_size = pread(fd, &header, sizeof(header), 0);
+    close(fd);
+    if (read_size != (ssize_t) sizeof(header) || memcmp(header.magic, METADATA_MAGIC, 4) != 0)
+        return -1;
+
+    memset(attributes, 0, sizeof(*attributes));
+    attributes_from_header(&header, attributes);
+    return 0;
+}
@@ -0,0 +1,62 @@
+// src/metadump.c
+// Converts per-file metadata between the binary .meta format and JSON, for
+// debugging and export. Run it from the filesystem's backing directory:
+//   metadump export <file>   print .metadata/<file>.meta as JSON
+//   metadump import <file>   rewrite .metadata/<file>.json as .meta
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metadata_manager.h"
+#include "metadata_json.h"
+
+static int export_metadata(const char *filename) {
+    FileMetadata *metadata = load_metadata(filename);
+    if (!metadata) {
+        fprintf(stderr, "No metadata for '%s'.\n", filename);
+        return 1;
+    }
+
+    char *json = metadata_to_json(metadata);
+    destroy_file_metadata(metadata);
+    if (!json) {
+        fprintf(stderr, "Failed to convert metadata for '%s'.\n", filename);
+        return 1;
+    }
+    puts(json);
+    free(json);
+    return 0;
+}
+
+// load_metadata falls back to the JSON file when there is no .meta yet,
+// and save_metadata replaces the JSON file, so import is a load and save.
+static int import_metadata(const char *filename) {
+    FileMetadata *metadata = load_metadata(filename);
+    if (!metadata) {
+        fprintf(stderr, "No metadata for '%s'.\n", filename);
+        return 1;
+    }
+
+    int rc = save_metadata(metadata);
+    destroy_file_metadata(metadata);
+    if (rc != 0) {
+        fprintf(stderr, "Failed to write metadata for '%s'.\n", filename);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s export|import <file>\n", argv[0]);
+        return 2;
+    }
+
+    if (strcmp(argv[1], "export") == 0)
+        return export_metadata(argv[2]);
+    if (strcmp(argv[1], "import") == 0)
+        return import_metadata(argv[2]);
+
+    fprintf(stderr, "Unknown command '%s'.\n", argv[1]);
+    return 2;
+}
@@ -0,0 +1,566 @@
+// src/open_file.c
+#include "open_file.h"
+#include "metadata_manager.h"
+#include "metadata_cache.h"
+#include "version_manager.h"
+#include "simd.h"
+#include "journal.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Piece size for comparing pending writes with committed data.
+#define COMPARE_BUFFER_SIZE (256 * 1024)
+
+static unsigned long staging_counter;
+
+OpenFile *open_file_create(const char *filename) {
+    if (!filename) return NULL;
+
+    OpenFile *handle = malloc(sizeof(OpenFile));
+    if (!handle) return NULL;
+
+    handle->filename = strdup(filename);
+    if (!handle->filename) {
+        free(handle);
+        return NULL;
+    }
+
+    handle->metadata = NULL;
+    handle->size = 0;
+    handle->version_id = 0;
+    handle->contents = NULL;
+    handle->extent_count = 0;
+    handle->extent_capacity = 0;
+    handle->extents = NULL;
+    handle->staging_fd = -1;
+    readahead_init(&handle->readahead);
+
+    // Held until the handle is destroyed: while it is, the cache keeps this
+    // copy, and an unlink detaches it, so whether the name still refers to
+    // the file opened is a pointer comparison.
+    handle->metadata = metadata_cache_acquire(filename);
+    if (handle->metadata)
+        handle->size = handle->metadata->attributes.st_size;
+
+    return handle;
+}
+
+OpenFile *open_file_create_at(const char *filename, int version_id, off_t size) {
+    if (version_id <= 0) return NULL;
+
+    OpenFile *handle = open_file_create(filename);
+    if (handle) {
+        handle->version_id = version_id;
+        handle->size = size;
+    }
+    return handle;
+}
+
+// A read-only handle on contents, which it takes ownership of on success.
+OpenFile *open_file_create_contents(const char *filename, char *contents, size_t size) {
+    if (!contents) return NULL;
+
+    OpenFile *handle = open_file_create(filename);
+    if (handle) {
+        handle->contents = contents;
+        handle->size = (off_t) size;
+    }
+    return handle;
+}
+
+static int read_only(const OpenFile *handle) {
+    return handle->version_id > 0 || handle->contents != NULL;
+}
+
+static void clear_extents(OpenFile *handle) {
+    for (int i = 0; i < handle->extent_count; i++) {
+        free(handle->extents[i].data);
+    }
+    handle->extent_count = 0;
+    // Give the staged bytes back to the filesystem, keep the file for reuse
+    if (handle->staging_fd >= 0 && ftruncate(handle->staging_fd, 0) != 0)
+        perror("ftruncate");
+}
+
+void open_file_destroy(OpenFile *handle) {
+    if (handle) {
+        clear_extents(handle);
+        free(handle->extents);
+        if (handle->staging_fd >= 0)
+            close(handle->staging_fd);
+        readahead_destroy(&handle->readahead);
+        metadata_cache_release(handle->metadata, 0);
+        free(handle->contents);
+        free(handle->filename);
+        free(handle);
+    }
+}
+
+static off_t extent_end(const DirtyExtent *extent) {
+    return extent->offset + (off_t) extent->size;
+}
+
+// Index of the first extent that ends at or after offset.
+static int first_touching_extent(const OpenFile *handle, off_t offset) {
+    int lo = 0, hi = handle->extent_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (extent_end(&handle->extents[mid]) < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static int grow_extent(DirtyExtent *extent, size_t needed) {
+    if (needed <= extent->capacity)
+        return 0;
+
+    size_t capacity = extent->capacity ? extent->capacity : 4096;
+    while (capacity < needed)
+        capacity *= 2;
+
+    char *data = realloc(extent->data, capacity);
+    if (!data)
+        return -1;
+    extent->data = data;
+    extent->capacity = capacity;
+    return 0;
+}
+
+static int reserve_extent(OpenFile *handle) {
+    if (handle->extent_count < handle->extent_capacity)
+        return 0;
+
+    int capacity = handle->extent_capacity ? handle->extent_capacity * 2 : 8;
+    DirtyExtent *extents = realloc(handle->extents, sizeof(DirtyExtent) * capacity);
+    if (!extents)
+        return -1;
+    handle->extents = extents;
+    handle->extent_capacity = capacity;
+    return 0;
+}
+
+static int pwrite_all(int fd, const char *buf, size_t size, off_t offset) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pwrite(fd, buf + done, size - done, offset + (off_t) done);
+        if (n <= 0)
+            return -1;
+        done += (size_t) n;
+    }
+    return 0;
+}
+
+static int pread_all(int fd, char *buf, size_t size, off_t offset) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, buf + done, size - done, offset + (off_t) done);
+        if (n <= 0)
+            return -1;
+        done += (size_t) n;
+    }
+    return 0;
+}
+
+// The handle's staging file, created on first use. Anything buffered in
+// memory so far moves into it, so from then on every pending byte is in
+// the file and extents only record ranges.
+int open_file_staging_fd(OpenFile *handle) {
+    if (!handle || read_only(handle)) return -1;
+    if (handle->staging_fd >= 0) return handle->staging_fd;
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s.%ld.%lu", STAGING_PATH, (long) getpid(),
+             __atomic_fetch_add(&staging_counter, 1, __ATOMIC_RELAXED));
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return -1;
+    unlink(path);
+
+    for (int i = 0; i < handle->extent_count; i++) {
+        DirtyExtent *extent = &handle->extents[i];
+        if (pwrite_all(fd, extent->data, extent->size, extent->offset) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    for (int i = 0; i < handle->extent_count; i++) {
+        free(handle->extents[i].data);
+        handle->extents[i].data = NULL;
+        handle->extents[i].capacity = 0;
+    }
+    handle->staging_fd = fd;
+    return fd;
+}
+
+// Record that [offset, offset + size) of the staging file now holds
+// pending data, merging the range with every extent it touches.
+int open_file_mark_staged(OpenFile *handle, off_t offset, size_t size) {
+    if (!handle || handle->staging_fd < 0) return -1;
+    if (size == 0) return 0;
+
+    off_t end = offset + (off_t) size;
+    int first = first_touching_extent(handle, offset);
+    int last = first;
+    while (last < handle->extent_count && handle->extents[last].offset <= end)
+        last++;
+    last--;
+
+    if (first > last) {
+        if (reserve_extent(handle) != 0)
+            return -1;
+        memmove(&handle->extents[first + 1], &handle->extents[first],
+                sizeof(DirtyExtent) * (handle->extent_count - first));
+        handle->extents[first] = (DirtyExtent) { offset, size, 0, NULL };
+        handle->extent_count++;
+    } else {
+        off_t start = handle->extents[first].offset < offset ? handle->extents[first].offset : offset;
+        off_t stop = extent_end(&handle->extents[last]) > end ? extent_end(&handle->extents[last]) : end;
+        handle->extents[first] = (DirtyExtent) { start, (size_t) (stop - start), 0, NULL };
+        memmove(&handle->extents[first + 1], &handle->extents[last + 1],
+                sizeof(DirtyExtent) * (handle->extent_count - last - 1));
+        handle->extent_count -= last - first;
+    }
+
+    if (end > handle->size)
+        handle->size = end;
+    return 0;
+}
+
+int open_file_write(OpenFile *handle, const char *buf, size_t size, off_t offset) {
+    if (!handle || !buf || read_only(handle)) return -1;
+    if (size == 0) return 0;
+
+    if (handle->staging_fd >= 0) {
+        if (pwrite_all(handle->staging_fd, buf, size, offset) != 0)
+            return -1;
+        return open_file_mark_staged(handle, offset, size);
+    }
+
+    off_t end = offset + (off_t) size;
+    int first = first_touching_extent(handle, offset);
+    int last = first;
+    while (last < handle->extent_count && handle->extents[last].offset <= end)
+        last++;
+    last--;
+
+    if (first > last) {
+        // No overlap: insert a fresh extent, keeping the list sorted.
+        if (reserve_extent(handle) != 0)
+            return -1;
+
+        DirtyExtent extent = { offset, 0, 0, NULL };
+        if (grow_extent(&extent, size) != 0)
+            return -1;
+        memcpy(extent.data, buf, size);
+        extent.size = size;
+
+        memmove(&handle->extents[first + 1], &handle->extents[first],
+                sizeof(DirtyExtent) * (handle->extent_count - first));
+        handle->extents[first] = extent;
+        handle->extent_count++;
+    } else if (first == last && handle->extents[first].offset <= offset) {
+        // Overwrite or append within a single extent; this is the
+        // sequential write path and grows the buffer geometrically.
+        DirtyExtent *extent = &handle->extents[first];
+        size_t needed = (size_t) (end - extent->offset);
+        if (needed > extent->size) {
+            if (grow_extent(extent, needed) != 0)
+                return -1;
+            extent->size = needed;
+        }
+        memcpy(extent->data + (offset - extent->offset), buf, size);
+    } else {
+        // Coalesce every extent the write touches into a single one.
+        off_t start = handle->extents[first].offset < offset ? handle->extents[first].offset : offset;
+        off_t stop = extent_end(&handle->extents[last]) > end ? extent_end(&handle->extents[last]) : end;
+
+        DirtyExtent merged = { start, 0, 0, NULL };
+        if (grow_extent(&merged, (size_t) (stop - start)) != 0)
+            return -1;
+        merged.size = (size_t) (stop - start);
+
+        for (int i = first; i <= last; i++) {
+            DirtyExtent *extent = &handle->extents[i];
+            memcpy(merged.data + (extent->offset - start), extent->data, extent->size);
+            free(extent->data);
+        }
+        memcpy(merged.data + (offset - start), buf, size);
+
+        handle->extents[first] = merged;
+        memmove(&handle->extents[first + 1], &handle->extents[last + 1],
+                sizeof(DirtyExtent) * (handle->extent_count - last - 1));
+        handle->extent_count -= last - first;
+    }
+
+    if (end > handle->size)
+        handle->size = end;
+    return 0;
+}
+
+// Copy the parts of [offset, offset + size) covered by dirty extents into buf.
+static int overlay_extents(const OpenFile *handle, char *buf, size_t size, off_t offset) {
+    off_t end = offset + (off_t) size;
+    for (int i = first_touching_extent(handle, offset); i < handle->extent_count; i++) {
+        const DirtyExtent *extent = &handle->extents[i];
+        if (extent->offset >= end)
+            break;
+
+        off_t from = extent->offset > offset ? extent->offset : offset;
+        off_t to = extent_end(extent) < end ? extent_end(extent) : end;
+        if (from >= to)
+            continue;
+        if (extent->data)
+            memcpy(buf + (from - offset), extent->data + (from - extent->offset), (size_t) (to - from));
+        else if (pread_all(handle->staging_fd, buf + (from - offset), (size_t) (to - from), from) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+// The version a handle reads and the size of the file through it: the
+// latest version, grown by pending writes, or the version it was opened
+// on. A handle on generated contents reads no version.
+static int read_target(const OpenFile *handle, int *version_id, off_t *file_size) {
+    *version_id = handle->version_id;
+    *file_size = handle->size;
+    if (read_only(handle))
+        return 0;
+
+    FileMetadata *metadata = metadata_cache_acquire(handle->filename);
+    if (!metadata) return -1;
+    if (metadata->version_count > 0) {
+        *version_id = version_data_id(&metadata->version_list[metadata->version_count - 1]);
+        if (metadata->attributes.st_size > *file_size)
+            *file_size = metadata->attributes.st_size;
+    }
+    metadata_cache_release(metadata, 0);
+    return 0;
+}
+
+int open_file_read(OpenFile *handle, char *buf, size_t size, off_t offset) {
+    if (!handle || !buf) return -1;
+
+    int version_id;
+    off_t file_size;
+    if (read_target(handle, &version_id, &file_size) != 0)
+        return -1;
+
+    if (offset >= file_size)
+        return 0;
+    if (offset + (off_t) size > file_size)
+        size = (size_t) (file_size - offset);
+
+    if (handle->contents) {
+        memcpy(buf, handle->contents + offset, size);
+        return (int) size;
+    }
+
+    // Committed bytes first, zero-fill any hole, then pending writes on top.
+    ssize_t committed = 0;
+    if (version_id > 0) {
+        committed = load_version_range(handle->filename, version_id, offset, size, buf);
+        if (committed < 0)
+            return -1;
+    }
+    memset(buf + committed, 0, size - (size_t) committed);
+    if (overlay_extents(handle, buf, size, offset) != 0)
+        return -1;
+
+    return (int) size;
+}
+
+// Like open_file_read, but describes the bytes in map instead of copying
+// them, so committed data stored verbatim can be spliced straight from the
+// backing files. Ranges with pending writes are read into memory. Returns
+// the number of bytes mapped; on failure map must still be released.
+int open_file_map(OpenFile *handle, size_t size, off_t offset, VersionMap *map) {
+    if (!handle || !map) return -1;
+
+    int version_id;
+    off_t file_size;
+    if (read_target(handle, &version_id, &file_size) != 0)
+        return -1;
+
+    if (offset >= file_size)
+        return 0;
+    if (offset + (off_t) size > file_size)
+        size = (size_t) (file_size - offset);
+    if (version_id > 0)
+        readahead_observe(&handle->readahead, handle->filename, version_id, offset, size, file_size);
+
+    int i = first_touching_extent(handle, offset);
+    if (handle->contents ||
+        (i < handle->extent_count && handle->extents[i].offset < offset + (off_t) size)) {
+        char *buf = malloc(size ? size : 1);
+        int read_size = buf ? open_file_read(handle, buf, size, offset) : -1;
+        if (read_size < 0 || version_map_add_data(map, buf, (size_t) read_size) != 0) {
+            free(buf);
+            return -1;
+        }
+        return read_size;
+    }
+
+    ssize_t committed = 0;
+    if (version_id > 0) {
+        committed = map_version_range(handle->filename, version_id, offset, size, map);
+        if (committed < 0)
+            return -1;
+    }
+    if ((size_t) committed < size) {
+        // A hole past the committed data, from a write further on
+        char *zeros = calloc(size - (size_t) committed, 1);
+        if (!zeros || version_map_add_data(map, zeros, size - (size_t) committed) != 0) {
+            free(zeros);
+            return -1;
+        }
+    }
+    return (int) size;
+}
+
+// The file the handle was opened on, to commit into. If it was unlinked
+// while the handle was open, committing brings it back, as writes through
+// the handle did before. If another file has been created under its name
+// since, the writes are not that file's: fails with ESTALE.
+static FileMetadata *acquire_opened(OpenFile *handle) {
+    FileMetadata *metadata = metadata_cache_acquire(handle->filename);
+    if (metadata && handle->metadata && metadata != handle->metadata) {
+        metadata_cache_release(metadata, 0);
+        errno = ESTALE;
+        return NULL;
+    }
+    if (!metadata) {
+        metadata = create_file_metadata(handle->filename);
+        if (!metadata)
+            return NULL;
+        int rc = save_metadata(metadata);
+        destroy_file_metadata(metadata);
+        if (rc != 0)
+            return NULL;
+
+        metadata_cache_forget(handle->filename);
+        metadata = metadata_cache_acquire(handle->filename);
+        if (!metadata)
+            return NULL;
+    }
+
+    // From now on the handle is on the file it commits into; the path
+    // lock a commit holds keeps the name on it meanwhile.
+    if (metadata != handle->metadata) {
+        metadata_cache_release(handle->metadata, 0);
+        handle->metadata = metadata;
+        metadata = metadata_cache_acquire(handle->filename);
+    }
+    return metadata;
+}
+
+// Whether the dirty extents only rewrite what base_version already holds,
+// compared a piece at a time so memory stays bounded.
+static int rewrites_committed(const OpenFile *handle, int base_version) {
+    char *committed = malloc(COMPARE_BUFFER_SIZE);
+    char *pending = malloc(COMPARE_BUFFER_SIZE);
+    int same = committed && pending;
+    for (int i = 0; same && i < handle->extent_count; i++) {
+        const DirtyExtent *extent = &handle->extents[i];
+        for (size_t done = 0; same && done < extent->size; done += COMPARE_BUFFER_SIZE) {
+            size_t length = extent->size - done < COMPARE_BUFFER_SIZE ? extent->size - done : COMPARE_BUFFER_SIZE;
+            off_t offset = extent->offset + (off_t) done;
+            const char *written = extent->data ? extent->data + done : pending;
+            same = load_version_range(handle->filename, base_version, offset, length, committed) == (ssize_t) length &&
+                   (extent->data || pread_all(handle->staging_fd, pending, length, offset) == 0) &&
+                   simd_equal(written, committed, length);
+        }
+    }
+    free(committed);
+    free(pending);
+    return same;
+}
+
+static int commit_overlay(void *context, char *buf, size_t size, off_t offset) {
+    return overlay_extents(context, buf, size, offset);
+}
+
+int open_file_commit(OpenFile *handle) {
+    if (!handle) return -1;
+    if (handle->extent_count == 0) return 0;
+
+    FileMetadata *metadata = acquire_opened(handle);
+    if (!metadata)
+        return -1;
+
+    // The new version is the latest one with the dirty extents written
+    // over it; the version engine streams it rather than building it here.
+    // After a rollback the latest version's data is an earlier version's.
+    int base_version = 0;
+    uint64_t new_size = (uint64_t) handle->size;
+    if (metadata->version_count > 0) {
+        base_version = version_data_id(&metadata->version_list[metadata->version_count - 1]);
+        if ((uint64_t) metadata->attributes.st_size > new_size)
+            new_size = (uint64_t) metadata->attributes.st_size;
+    }
+
+    // Editors and sync tools often write back identical bytes: keep the
+    // latest version rather than adding a copy of it.
+    if (base_version > 0 && new_size == (uint64_t) metadata->attributes.st_size &&
+        rewrites_committed(handle, base_version)) {
+        metadata_cache_release(metadata, 0);
+        clear_extents(handle);
+        return 1;
+    }
+    VersionRange *dirty = malloc(sizeof(VersionRange) * handle->extent_count);
+    if (!dirty) {
+        metadata_cache_release(metadata, 0);
+        return -1;
+    }
+    for (int i = 0; i < handle->extent_count; i++)
+        dirty[i] = (VersionRange) { (uint64_t) handle->extents[i].offset, handle->extents[i].size };
+
+    // Save new version. From here on the commit counts as in flight, so a
+    // concurrent group sync can wait for it to join.
+    int new_version_id = metadata->version_count + 1;
+    journal_begin();
+    int rc = save_version_overlay(handle->filename, new_version_id, base_version, new_size, dirty,
+                                  handle->extent_count, commit_overlay, handle);
+    free(dirty);
+    if (rc != 0) {
+        journal_end();
+        metadata_cache_release(metadata, 0);
+        return -1;
+    }
+
+    // Journal the commit and wait for it to be durable; only then update
+    // the cached metadata, whose new record is appended to the log on sync
+    // or eviction.
+    VersionInfo version = { new_version_id, 0, time(NULL), 0, 0, 0 };
+    int64_t mtime = version.timestamp;
+    uint64_t sequence;
+    if (journal_log_commit(handle->filename, &version, new_size, mtime, &sequence) != 0 ||
+        journal_sync(sequence) != 0) {
+        journal_end();
+        metadata_cache_release(metadata, 0);
+        return -1;
+    }
+    VersionInfo *new_version = append_version(metadata);
+    if (!new_version) {
+        journal_end();
+        metadata_cache_release(metadata, 0);
+        return -1;
+    }
+    *new_version = version;
+    metadata->attributes.st_size = (off_t) new_size;
+    metadata->attributes.st_mtime = (time_t) mtime;
+    // Marked dirty before the commit ends, so a checkpoint cannot miss it
+    metadata_cache_release(metadata, 1);
+    journal_end();
+
+    clear_extents(handle);
+    handle->size = (off_t) new_size;
+    return 0;
+}
@@ -0,0 +1,59 @@
+// src/path_lock.c
+#include "path_lock.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+static pthread_rwlock_t shards[PATH_LOCK_SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+
+static void init_shards(void) {
+    for (int i = 0; i < PATH_LOCK_SHARDS; i++)
+        pthread_rwlock_init(&shards[i], NULL);
+}
+
+static pthread_rwlock_t *shard_for(const char *path) {
+    pthread_once(&shards_once, init_shards);
+
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+    for (; *path; path++) {
+        hash ^= (unsigned char) *path;
+        hash *= UINT64_C(0x100000001b3);
+    }
+    return &shards[hash % PATH_LOCK_SHARDS];
+}
+
+void path_lock_read(const char *path) {
+    pthread_rwlock_rdlock(shard_for(path));
+}
+
+void path_lock_write(const char *path) {
+    pthread_rwlock_wrlock(shard_for(path));
+}
+
+void path_unlock(const char *path) {
+    pthread_rwlock_unlock(shard_for(path));
+}
+
+// The shards a set of paths fall on, each once however many paths share it.
+static void shards_of(const char *const *paths, size_t count, unsigned char *used) {
+    memset(used, 0, PATH_LOCK_SHARDS);
+    for (size_t i = 0; i < count; i++)
+        used[shard_for(paths[i]) - shards] = 1;
+}
+
+void path_lock_write_set(const char *const *paths, size_t count) {
+    unsigned char used[PATH_LOCK_SHARDS];
+    shards_of(paths, count, used);
+    for (int i = 0; i < PATH_LOCK_SHARDS; i++)
+        if (used[i])
+            pthread_rwlock_wrlock(&shards[i]);
+}
+
+void path_unlock_set(const char *const *paths, size_t count) {
+    unsigned char used[PATH_LOCK_SHARDS];
+    shards_of(paths, count, used);
+    for (int i = PATH_LOCK_SHARDS - 1; i >= 0; i--)
+        if (used[i])
+            pthread_rwlock_unlock(&shards[i]);
+}
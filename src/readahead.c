@@ -0,0 +1,151 @@
+// src/readahead.c
+#include "readahead.h"
+#include "version_manager.h"
+#include "path_lock.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    char *filename;
+    int version_id;
+    off_t offset;
+    size_t size;
+} ReadaheadRequest;
+
+// Requests are handed to a single worker through a fixed ring; when it is
+// full new requests are dropped, as readahead is only ever a hint.
+static ReadaheadRequest queue[READAHEAD_QUEUE_SIZE];
+static int queue_head;
+static int queue_count;
+static int worker_started;
+static int stopping;
+static pthread_t worker;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+
+static void *readahead_worker(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&queue_lock);
+    for (;;) {
+        while (queue_count == 0 && !stopping)
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        if (stopping)
+            break;
+
+        ReadaheadRequest request = queue[queue_head];
+        queue_head = (queue_head + 1) % READAHEAD_QUEUE_SIZE;
+        queue_count--;
+        pthread_mutex_unlock(&queue_lock);
+
+        // Hold the file's read lock so an unlink cannot delete the versions
+        // (and free their numbers for reuse) while blocks are being cached.
+        path_lock_read(request.filename);
+        prefetch_version_range(request.filename, request.version_id, request.offset, request.size);
+        path_unlock(request.filename);
+        free(request.filename);
+
+        pthread_mutex_lock(&queue_lock);
+    }
+    pthread_mutex_unlock(&queue_lock);
+    return NULL;
+}
+
+static void submit(const char *filename, int version_id, off_t offset, size_t size) {
+    char *copy = strdup(filename);
+    if (!copy) return;
+
+    pthread_mutex_lock(&queue_lock);
+    if (!worker_started && !stopping) {
+        if (pthread_create(&worker, NULL, readahead_worker, NULL) == 0)
+            worker_started = 1;
+    }
+    if (!worker_started || queue_count == READAHEAD_QUEUE_SIZE) {
+        pthread_mutex_unlock(&queue_lock);
+        free(copy);
+        return;
+    }
+    ReadaheadRequest *request = &queue[(queue_head + queue_count) % READAHEAD_QUEUE_SIZE];
+    request->filename = copy;
+    request->version_id = version_id;
+    request->offset = offset;
+    request->size = size;
+    queue_count++;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+void readahead_init(ReadaheadState *state) {
+    pthread_mutex_init(&state->lock, NULL);
+    state->next = 0;
+    state->end = 0;
+    state->window = 0;
+}
+
+void readahead_destroy(ReadaheadState *state) {
+    pthread_mutex_destroy(&state->lock);
+}
+
+// Record a read of [offset, offset + size) of version_id. A read that
+// starts where the previous one ended (or at the start of the file) is
+// sequential: the window opens at READAHEAD_MIN_WINDOW and doubles each
+// time the reader catches up with the second half of what was already
+// requested, so the next window is fetched while the current one is being
+// consumed. Any other read closes the window.
+void readahead_observe(ReadaheadState *state, const char *filename, int version_id, off_t offset,
+                       size_t size, off_t file_size) {
+    if (!state || !filename || size == 0) return;
+
+    pthread_mutex_lock(&state->lock);
+    off_t read_end = offset + (off_t) size;
+    if (offset != state->next) {
+        state->next = read_end;
+        state->end = 0;
+        state->window = 0;
+        pthread_mutex_unlock(&state->lock);
+        return;
+    }
+    state->next = read_end;
+
+    off_t start = 0;
+    size_t length = 0;
+    if (state->end < read_end)
+        state->end = read_end;
+    if (state->end - read_end <= (off_t) (state->window / 2) && state->end < file_size) {
+        if (state->window == 0)
+            state->window = size * 4 > READAHEAD_MIN_WINDOW ? size * 4 : READAHEAD_MIN_WINDOW;
+        else if (state->window < READAHEAD_MAX_WINDOW)
+            state->window *= 2;
+        if (state->window > READAHEAD_MAX_WINDOW)
+            state->window = READAHEAD_MAX_WINDOW;
+
+        start = state->end;
+        length = state->window;
+        if ((off_t) length > file_size - start)
+            length = (size_t) (file_size - start);
+        state->end = start + (off_t) length;
+    }
+    pthread_mutex_unlock(&state->lock);
+
+    if (length > 0)
+        submit(filename, version_id, start, length);
+}
+
+// Stop the worker and drop whatever is still queued; called at unmount.
+void readahead_shutdown(void) {
+    pthread_mutex_lock(&queue_lock);
+    stopping = 1;
+    int started = worker_started;
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+    if (started)
+        pthread_join(worker, NULL);
+
+    pthread_mutex_lock(&queue_lock);
+    while (queue_count > 0) {
+        free(queue[queue_head].filename);
+        queue_head = (queue_head + 1) % READAHEAD_QUEUE_SIZE;
+        queue_count--;
+    }
+    worker_started = 0;
+    pthread_mutex_unlock(&queue_lock);
+}
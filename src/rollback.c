@@ -0,0 +1,386 @@
+// src/rollback.c
+#include "rollback.h"
+#include "metadata_manager.h"
+#include "metadata_cache.h"
+#include "version_manager.h"
+#include "path_lock.h"
+#include "journal.h"
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define METADATA_DIR ".metadata"
+
+// State shared by the workers of one tree walk, under lock. Directories
+// waiting to be listed form a stack any worker can take from, so a wide
+// or deep tree keeps every worker busy.
+typedef struct {
+    const TimeView *target;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    char **pending;
+    size_t pending_count;
+    size_t pending_capacity;
+    int listing; // Workers listing a directory, which may add more
+    int error;   // First errno hit; stops the walk
+    char **changed;
+    size_t changed_count;
+    size_t changed_capacity;
+} RollbackWalk;
+
+// A file the walk found showing something other than its latest version.
+// Its cached metadata stays held until its batch is done, so the batch
+// rarely waits on the disk with its path locks held.
+typedef struct {
+    char *filename;
+    FileMetadata *held;
+    int data_version; // Of the version the view showed
+    uint64_t size;
+    FileMetadata *metadata; // Where its logged version goes, while the batch syncs
+    VersionInfo version;
+    int changed;
+} RollbackFile;
+
+typedef struct {
+    RollbackFile files[ROLLBACK_BATCH];
+    size_t count;
+} RollbackBatch;
+
+static int latest_data_id(const FileMetadata *metadata) {
+    return version_data_id(&metadata->version_list[metadata->version_count - 1]);
+}
+
+// See whether filename needs rolling back to the version target shows, and
+// if so fill in file. Returns 1 if it does, 0 if it already has that
+// data, or -1 with errno set: ENOENT if it had no version then.
+static int plan_roll_back(const char *filename, const TimeView *target, RollbackFile *file) {
+    path_lock_read(filename);
+    FileMetadata *metadata = metadata_cache_acquire(filename);
+    const VersionInfo *shown = metadata ? time_view_version(target, metadata) : NULL;
+    int rc = 0;
+    if (!shown) {
+        errno = ENOENT;
+        rc = -1;
+    } else if (version_data_id(shown) != latest_data_id(metadata)) {
+        memset(file, 0, sizeof(*file));
+        file->data_version = version_data_id(shown);
+        if (version_size(filename, file->data_version, &file->size) != 0) {
+            errno = EIO;
+            rc = -1;
+        } else if (!(file->filename = strdup(filename))) {
+            errno = ENOMEM;
+            rc = -1;
+        } else {
+            file->held = metadata;
+            metadata = NULL;
+            rc = 1;
+        }
+    }
+    if (metadata)
+        metadata_cache_release(metadata, 0);
+    path_unlock(filename);
+    return rc;
+}
+
+// Log a new version for one file of a batch, whose data is that of the
+// version target shows now: the file may have been committed to or
+// unlinked since it was planned. Returns 1 if it was logged, 0 if the file
+// no longer needs it, or -1 with errno set.
+static int log_roll_back(RollbackFile *file, const TimeView *target, int64_t now, uint64_t *sequence) {
+    FileMetadata *metadata = metadata_cache_acquire(file->filename);
+    const VersionInfo *shown = metadata ? time_view_version(target, metadata) : NULL;
+    int data_version = shown ? version_data_id(shown) : 0;
+    int rc = 0;
+    if (shown && data_version != latest_data_id(metadata)) {
+        if (data_version != file->data_version && version_size(file->filename, data_version, &file->size) != 0) {
+            errno = EIO;
+            rc = -1;
+        } else {
+            file->version = (VersionInfo) { metadata->version_count + 1, 0, now, 0, data_version, 0 };
+            if (journal_log_commit(file->filename, &file->version, file->size, now, sequence) == 0) {
+                file->metadata = metadata;
+                metadata = NULL;
+                rc = 1;
+            } else {
+                errno = EIO;
+                rc = -1;
+            }
+        }
+    }
+    if (metadata)
+        metadata_cache_release(metadata, 0);
+    return rc;
+}
+
+// Point every file of a batch at the version target shows, as a new
+// version whose data is that version's. Their records are all appended and
+// then made durable by one journal sync, and only after it do the versions
+// show in the cached metadata, so, as with a commit, nothing a crash can
+// undo is ever seen and no epoch is handed out twice. The batch's path
+// locks are held throughout, so no commit can take a version id the batch
+// has logged before it shows. Returns 0, or -1 with errno set; files
+// logged before a failure are still synced and shown.
+static int commit_batch(RollbackBatch *batch, const TimeView *target) {
+    const char *names[ROLLBACK_BATCH];
+    for (size_t i = 0; i < batch->count; i++)
+        names[i] = batch->files[i].filename;
+    path_lock_write_set(names, batch->count);
+    journal_begin();
+
+    int64_t now = time(NULL);
+    uint64_t last = 0;
+    int logged = 0, error = 0;
+    for (size_t i = 0; i < batch->count && !error; i++) {
+        uint64_t sequence;
+        int rc = log_roll_back(&batch->files[i], target, now, &sequence);
+        if (rc > 0) {
+            last = sequence;
+            logged++;
+        } else if (rc < 0) {
+            error = errno;
+        }
+    }
+    int synced = logged > 0 && journal_sync(last) == 0;
+    if (logged > 0 && !synced)
+        error = EIO;
+
+    for (size_t i = 0; i < batch->count; i++) {
+        RollbackFile *file = &batch->files[i];
+        if (!file->metadata)
+            continue;
+        VersionInfo *added = synced ? append_version(file->metadata) : NULL;
+        if (added) {
+            *added = file->version;
+            file->metadata->attributes.st_size = (off_t) file->size;
+            file->metadata->attributes.st_mtime = (time_t) now;
+            file->changed = 1;
+        } else if (!error) {
+            error = EIO;
+        }
+        // Marked dirty before the commit ends, so a checkpoint cannot miss it
+        metadata_cache_release(file->metadata, added != NULL);
+        file->metadata = NULL;
+    }
+    journal_end();
+    path_unlock_set(names, batch->count);
+
+    if (error) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+static void clear_batch(RollbackBatch *batch) {
+    for (size_t i = 0; i < batch->count; i++) {
+        metadata_cache_release(batch->files[i].held, 0);
+        free(batch->files[i].filename);
+    }
+    batch->count = 0;
+}
+
+static int push_name(char ***names, size_t *count, size_t *capacity, const char *name) {
+    if (*count == *capacity) {
+        size_t grown = *capacity ? *capacity * 2 : 64;
+        char **larger = realloc(*names, sizeof(char *) * grown);
+        if (!larger)
+            return -1;
+        *names = larger;
+        *capacity = grown;
+    }
+    char *copy = strdup(name);
+    if (!copy)
+        return -1;
+    (*names)[(*count)++] = copy;
+    return 0;
+}
+
+static void free_names(char **names, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        free(names[i]);
+    free(names);
+}
+
+static int walk_failed(RollbackWalk *walk) {
+    pthread_mutex_lock(&walk->lock);
+    int error = walk->error;
+    pthread_mutex_unlock(&walk->lock);
+    return error;
+}
+
+static void walk_fail(RollbackWalk *walk, int error) {
+    pthread_mutex_lock(&walk->lock);
+    if (!walk->error)
+        walk->error = error;
+    pthread_mutex_unlock(&walk->lock);
+}
+
+// Commit a worker's batch and note the files it changed.
+static void flush_batch(RollbackWalk *walk, RollbackBatch *batch) {
+    if (batch->count == 0)
+        return;
+    if (commit_batch(batch, walk->target) != 0)
+        walk_fail(walk, errno);
+    pthread_mutex_lock(&walk->lock);
+    for (size_t i = 0; i < batch->count; i++) {
+        if (batch->files[i].changed &&
+            push_name(&walk->changed, &walk->changed_count, &walk->changed_capacity, batch->files[i].filename) != 0 &&
+            !walk->error)
+            walk->error = ENOMEM;
+    }
+    pthread_mutex_unlock(&walk->lock);
+    clear_batch(batch);
+}
+
+// Plan the files of one directory into the worker's batch, committing it
+// whenever it fills, and queue the subdirectories.
+static void walk_directory(RollbackWalk *walk, const char *dir, RollbackBatch *batch) {
+    char dirpath[1024];
+    int len = *dir ? snprintf(dirpath, sizeof(dirpath), "%s/%s", METADATA_DIR, dir)
+                   : snprintf(dirpath, sizeof(dirpath), "%s", METADATA_DIR);
+    DIR *d = len >= 0 && (size_t) len < sizeof(dirpath) ? opendir(dirpath) : NULL;
+    if (!d) {
+        if (errno != ENOENT) // Removed since it was queued
+            walk_fail(walk, errno);
+        return;
+    }
+
+    struct dirent *entry;
+    while (!walk_failed(walk) && (entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        size_t ext_length = entry->d_type == DT_REG ? metadata_extension_length(entry->d_name) : 0;
+        size_t name_length = entry->d_type == DT_DIR ? strlen(entry->d_name)
+                           : ext_length > 0 ? strlen(entry->d_name) - ext_length : 0;
+        char child[1024];
+        len = *dir ? snprintf(child, sizeof(child), "%s/%.*s", dir, (int) name_length, entry->d_name)
+                   : snprintf(child, sizeof(child), "%.*s", (int) name_length, entry->d_name);
+        if (name_length == 0 || len < 0 || (size_t) len >= sizeof(child))
+            continue;
+
+        if (entry->d_type == DT_DIR) {
+            pthread_mutex_lock(&walk->lock);
+            if (push_name(&walk->pending, &walk->pending_count, &walk->pending_capacity, child) != 0 &&
+                !walk->error)
+                walk->error = ENOMEM;
+            pthread_cond_signal(&walk->ready);
+            pthread_mutex_unlock(&walk->lock);
+            continue;
+        }
+
+        int rc = plan_roll_back(child, walk->target, &batch->files[batch->count]);
+        if (rc < 0 && errno != ENOENT)
+            walk_fail(walk, errno);
+        else if (rc > 0 && ++batch->count == ROLLBACK_BATCH)
+            flush_batch(walk, batch);
+    }
+    closedir(d);
+}
+
+// Take directories off the stack until it is empty and no other worker
+// can add to it, then commit what is left of this worker's batch.
+static void *walk_worker(void *arg) {
+    RollbackWalk *walk = arg;
+    RollbackBatch *batch = calloc(1, sizeof(RollbackBatch));
+    pthread_mutex_lock(&walk->lock);
+    if (!batch && !walk->error)
+        walk->error = ENOMEM;
+    for (;;) {
+        while (walk->pending_count == 0 && walk->listing > 0 && !walk->error)
+            pthread_cond_wait(&walk->ready, &walk->lock);
+        if (walk->pending_count == 0 || walk->error)
+            break;
+
+        char *dir = walk->pending[--walk->pending_count];
+        walk->listing++;
+        pthread_mutex_unlock(&walk->lock);
+        walk_directory(walk, dir, batch);
+        free(dir);
+        pthread_mutex_lock(&walk->lock);
+        walk->listing--;
+    }
+    pthread_cond_broadcast(&walk->ready);
+    pthread_mutex_unlock(&walk->lock);
+
+    // Files already planned are rolled back even if the walk failed, like
+    // those of batches committed before it did
+    if (batch)
+        flush_batch(walk, batch);
+    free(batch);
+    return NULL;
+}
+
+static int rollback_tree(const char *path, const TimeView *target, RollbackNotify notify, void *context) {
+    RollbackWalk walk;
+    memset(&walk, 0, sizeof(walk));
+    walk.target = target;
+    pthread_mutex_init(&walk.lock, NULL);
+    pthread_cond_init(&walk.ready, NULL);
+
+    if (push_name(&walk.pending, &walk.pending_count, &walk.pending_capacity, path) != 0) {
+        walk.error = ENOMEM;
+    } else {
+        pthread_t threads[ROLLBACK_WORKERS];
+        int started = 0;
+        while (started < ROLLBACK_WORKERS && pthread_create(&threads[started], NULL, walk_worker, &walk) == 0)
+            started++;
+        if (started == 0)
+            walk_worker(&walk);
+        for (int i = 0; i < started; i++)
+            pthread_join(threads[i], NULL);
+    }
+
+    // What changed is announced even if the walk stopped part way.
+    for (size_t i = 0; notify && i < walk.changed_count; i++)
+        notify(walk.changed[i], context);
+
+    free_names(walk.pending, walk.pending_count);
+    free_names(walk.changed, walk.changed_count);
+    pthread_cond_destroy(&walk.ready);
+    pthread_mutex_destroy(&walk.lock);
+    if (walk.error) {
+        errno = walk.error;
+        return -1;
+    }
+    return 0;
+}
+
+int rollback_path(const char *path, const TimeView *target, RollbackNotify notify, void *context) {
+    if (!path || !target || target->kind != TIME_VIEW_TREE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    char dirpath[1024];
+    struct stat st;
+    int len = *path ? snprintf(dirpath, sizeof(dirpath), "%s/%s", METADATA_DIR, path)
+                    : snprintf(dirpath, sizeof(dirpath), "%s", METADATA_DIR);
+    if (len < 0 || (size_t) len >= sizeof(dirpath)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (stat(dirpath, &st) == 0 && S_ISDIR(st.st_mode))
+        return rollback_tree(path, target, notify, context);
+
+    RollbackBatch *batch = calloc(1, sizeof(RollbackBatch));
+    if (!batch)
+        return -1;
+    int rc = plan_roll_back(path, target, &batch->files[0]);
+    if (rc > 0) {
+        batch->count = 1;
+        rc = commit_batch(batch, target);
+        int error = errno;
+        if (batch->files[0].changed && notify)
+            notify(path, context);
+        clear_batch(batch);
+        errno = error;
+    }
+    free(batch);
+    return rc < 0 ? -1 : 0;
+}
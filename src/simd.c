@@ -0,0 +1,175 @@
+// src/simd.c
+#include "simd.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static int equal_avx2(const char *a, const char *b, size_t size) {
+    size_t i = 0;
+    // Four vectors per round, folded into one test.
+    for (; i + 128 <= size; i += 128) {
+        __m256i x0 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (a + i)),
+                                      _mm256_loadu_si256((const __m256i *) (b + i)));
+        __m256i x1 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (a + i + 32)),
+                                      _mm256_loadu_si256((const __m256i *) (b + i + 32)));
+        __m256i x2 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (a + i + 64)),
+                                      _mm256_loadu_si256((const __m256i *) (b + i + 64)));
+        __m256i x3 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (a + i + 96)),
+                                      _mm256_loadu_si256((const __m256i *) (b + i + 96)));
+        __m256i any = _mm256_or_si256(_mm256_or_si256(x0, x1), _mm256_or_si256(x2, x3));
+        if (!_mm256_testz_si256(any, any))
+            return 0;
+    }
+    for (; i + 32 <= size; i += 32) {
+        __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (a + i)),
+                                     _mm256_loadu_si256((const __m256i *) (b + i)));
+        if (!_mm256_testz_si256(x, x))
+            return 0;
+    }
+    return memcmp(a + i, b + i, size - i) == 0;
+}
+
+__attribute__((target("sse2")))
+static int equal_sse2(const char *a, const char *b, size_t size) {
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        __m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i)),
+                                    _mm_loadu_si128((const __m128i *) (b + i)));
+        __m128i e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i + 16)),
+                                    _mm_loadu_si128((const __m128i *) (b + i + 16)));
+        __m128i e2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i + 32)),
+                                    _mm_loadu_si128((const __m128i *) (b + i + 32)));
+        __m128i e3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i + 48)),
+                                    _mm_loadu_si128((const __m128i *) (b + i + 48)));
+        __m128i all = _mm_and_si128(_mm_and_si128(e0, e1), _mm_and_si128(e2, e3));
+        if (_mm_movemask_epi8(all) != 0xffff)
+            return 0;
+    }
+    for (; i + 16 <= size; i += 16) {
+        __m128i e = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i)),
+                                   _mm_loadu_si128((const __m128i *) (b + i)));
+        if (_mm_movemask_epi8(e) != 0xffff)
+            return 0;
+    }
+    return memcmp(a + i, b + i, size - i) == 0;
+}
+
+// Find byte 32 bytes at a time, as a mask with one bit per input byte:
+// counted when offsets is NULL, else expanded into offsets. Stops short of
+// the last partial 32 bytes, setting scanned to where it stopped.
+__attribute__((target("avx2,popcnt")))
+static size_t scan_avx2(const char *data, size_t size, char byte, size_t *offsets, size_t *scanned) {
+    __m256i needle = _mm256_set1_epi8(byte);
+    size_t found = 0;
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (data + i)), needle));
+        if (!offsets) {
+            found += (size_t) __builtin_popcount(mask);
+            continue;
+        }
+        while (mask) {
+            offsets[found++] = i + (size_t) __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    *scanned = i;
+    return found;
+}
+
+__attribute__((target("sse2")))
+static size_t scan_sse2(const char *data, size_t size, char byte, size_t *offsets, size_t *scanned) {
+    __m128i needle = _mm_set1_epi8(byte);
+    size_t found = 0;
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        uint32_t low = (uint32_t) _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (data + i)), needle));
+        uint32_t high = (uint32_t) _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (data + i + 16)), needle));
+        uint32_t mask = low | high << 16;
+        if (!offsets) {
+            found += (size_t) __builtin_popcount(mask);
+            continue;
+        }
+        while (mask) {
+            offsets[found++] = i + (size_t) __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    *scanned = i;
+    return found;
+}
+
+static int simd_level(void) {
+    static int level = -1;
+    int current = __atomic_load_n(&level, __ATOMIC_RELAXED);
+    if (current < 0) {
+        __builtin_cpu_init();
+        current = __builtin_cpu_supports("avx2") ? 2 : __builtin_cpu_supports("sse2") ? 1 : 0;
+        __atomic_store_n(&level, current, __ATOMIC_RELAXED);
+    }
+    return current;
+}
+
+int simd_equal(const char *a, const char *b, size_t size) {
+    int current = simd_level();
+    if (current == 2)
+        return equal_avx2(a, b, size);
+    if (current == 1)
+        return equal_sse2(a, b, size);
+    return memcmp(a, b, size) == 0;
+}
+
+static size_t scan(const char *data, size_t size, char byte, size_t *offsets) {
+    int current = simd_level();
+    size_t i = 0;
+    size_t found = current == 2 ? scan_avx2(data, size, byte, offsets, &i)
+                 : current == 1 ? scan_sse2(data, size, byte, offsets, &i) : 0;
+    const char *hit;
+    while (i < size && (hit = memchr(data + i, byte, size - i)) != NULL) {
+        i = (size_t) (hit - data);
+        if (offsets)
+            offsets[found] = i;
+        found++;
+        i++;
+    }
+    return found;
+}
+
+#else
+
+int simd_equal(const char *a, const char *b, size_t size) {
+    return memcmp(a, b, size) == 0;
+}
+
+static size_t scan(const char *data, size_t size, char byte, size_t *offsets) {
+    size_t found = 0;
+    size_t i = 0;
+    const char *hit;
+    while (i < size && (hit = memchr(data + i, byte, size - i)) != NULL) {
+        i = (size_t) (hit - data);
+        if (offsets)
+            offsets[found] = i;
+        found++;
+        i++;
+    }
+    return found;
+}
+
+#endif
+
+// How many times byte occurs in data.
+size_t simd_count_byte(const char *data, size_t size, char byte) {
+    return scan(data, size, byte, NULL);
+}
+
+// The offset of every occurrence of byte in data, in order, into offsets,
+// which must have room for simd_count_byte() of them. Returns how many.
+size_t simd_find_bytes(const char *data, size_t size, char byte, size_t *offsets) {
+    return scan(data, size, byte, offsets);
+}
@@ -0,0 +1,144 @@
+// src/snapshot.c
+#include "snapshot.h"
+#include "journal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Serializes creation, so two snapshots cannot take the same name.
+static pthread_mutex_t create_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Snapshot names become directory names, so they follow the same rules.
+static int valid_name(const char *name) {
+    size_t len = name ? strlen(name) : 0;
+    return len > 0 && len < SNAPSHOT_NAME_MAX && !strchr(name, '/') && strcmp(name, ".") != 0 &&
+           strcmp(name, "..") != 0;
+}
+
+// Every snapshot, oldest first, from the fixed-size records of the list.
+Snapshot *snapshot_list(size_t *count) {
+    if (!count) return NULL;
+    *count = 0;
+
+    int fd = open(SNAPSHOTS_PATH, O_RDONLY);
+    if (fd < 0)
+        return errno == ENOENT ? calloc(1, sizeof(Snapshot)) : NULL;
+
+    struct stat st;
+    Snapshot *snapshots = NULL;
+    if (fstat(fd, &st) == 0) {
+        // A record torn by a crash is ignored; the journal brings it back.
+        size_t records = (size_t) st.st_size / sizeof(Snapshot);
+        snapshots = malloc(records ? records * sizeof(Snapshot) : sizeof(Snapshot));
+        ssize_t expected = (ssize_t) (records * sizeof(Snapshot));
+        if (snapshots && pread(fd, snapshots, (size_t) expected, 0) == expected) {
+            *count = records;
+        } else {
+            free(snapshots);
+            snapshots = NULL;
+        }
+    }
+    close(fd);
+    return snapshots;
+}
+
+int snapshot_find(const char *name, Snapshot *snapshot) {
+    if (!name) return -1;
+
+    size_t count;
+    Snapshot *snapshots = snapshot_list(&count);
+    if (!snapshots) return -1;
+
+    int rc = -1;
+    for (size_t i = 0; i < count; i++) {
+        if (strncmp(snapshots[i].name, name, SNAPSHOT_NAME_MAX) == 0) {
+            if (snapshot)
+                *snapshot = snapshots[i];
+            rc = 0;
+            break;
+        }
+    }
+    free(snapshots);
+    if (rc != 0)
+        errno = ENOENT;
+    return rc;
+}
+
+// Append a snapshot to the list and make it durable there: the journal
+// record it was made from is dropped by the next checkpoint, and replay
+// writes it with no journal to sync it.
+int snapshot_record(const Snapshot *snapshot) {
+    if (!snapshot) return -1;
+
+    int created = 0;
+    int fd = open(SNAPSHOTS_PATH, O_WRONLY | O_APPEND);
+    if (fd < 0 && errno == ENOENT) {
+        fd = open(SNAPSHOTS_PATH, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        created = 1;
+    }
+    if (fd < 0)
+        return -1;
+
+    // Drop a record torn by a crash, so the ones after it stay aligned
+    struct stat st;
+    int ok = fstat(fd, &st) == 0 &&
+             (st.st_size % (off_t) sizeof(*snapshot) == 0 ||
+              ftruncate(fd, st.st_size - st.st_size % (off_t) sizeof(*snapshot)) == 0);
+    ok = ok && write(fd, snapshot, sizeof(*snapshot)) == (ssize_t) sizeof(*snapshot) && fdatasync(fd) == 0;
+    if (close(fd) != 0)
+        ok = 0;
+
+    // A new list also needs its name in .versions
+    if (ok && created) {
+        int dirfd = open(".versions", O_RDONLY | O_DIRECTORY);
+        ok = dirfd >= 0 && fsync(dirfd) == 0;
+        if (dirfd >= 0)
+            close(dirfd);
+    }
+    return ok ? 0 : -1;
+}
+
+// Take a snapshot of the whole filesystem under name. Fails with EINVAL
+// for a name that cannot be a directory name and EEXIST for one in use.
+int snapshot_create(const char *name, Snapshot *snapshot) {
+    if (!valid_name(name)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&create_lock);
+    Snapshot created;
+    if (snapshot_find(name, NULL) == 0) {
+        pthread_mutex_unlock(&create_lock);
+        errno = EEXIST;
+        return -1;
+    }
+
+    memset(&created, 0, sizeof(created));
+    snprintf(created.name, sizeof(created.name), "%s", name);
+    created.timestamp = time(NULL);
+
+    // The snapshot's epoch comes after every commit journaled before it,
+    // which are the commits it contains.
+    uint64_t sequence;
+    journal_begin();
+    int rc = journal_log_snapshot(name, created.timestamp, &created.epoch, &sequence);
+    if (rc == 0)
+        rc = journal_sync(sequence);
+    if (rc == 0)
+        rc = snapshot_record(&created);
+    journal_end();
+    pthread_mutex_unlock(&create_lock);
+
+    if (rc == 0 && snapshot)
+        *snapshot = created;
+    if (rc != 0)
+        errno = EIO;
+    return rc;
+}
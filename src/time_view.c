@@ -0,0 +1,155 @@
+// src/time_view.c
+#include "time_view.h"
+#include "snapshot.h"
+#include "metadata_cache.h"
+#include "version_manager.h"
+#include "path_lock.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define METADATA_DIR ".metadata"
+
+// The rest of path if its first component is name, else NULL.
+static const char *skip_component(const char *path, const char *name) {
+    size_t len = strlen(name);
+    if (strncmp(path, name, len) != 0 || (path[len] != '\0' && path[len] != '/'))
+        return NULL;
+    return path + len;
+}
+
+// Whether path is one of the virtual trees or inside one, without
+// resolving it. Nothing under them can be created or removed.
+int time_view_contains(const char *path) {
+    return path && (skip_component(path, TIME_VIEW_SNAPSHOTS_DIR) || skip_component(path, TIME_VIEW_AT_DIR));
+}
+
+// Work out which view, if any, a store path is in. Fails with ENOENT for
+// a snapshot that does not exist or a time that is not in the past; a
+// time in the current second may still gain commits.
+int time_view_parse(const char *path, TimeView *view) {
+    if (!path || !view) return -1;
+
+    memset(view, 0, sizeof(*view));
+    view->kind = TIME_VIEW_NONE;
+    view->path = path;
+
+    const char *rest;
+    int by_time;
+    if ((rest = skip_component(path, TIME_VIEW_SNAPSHOTS_DIR)) != NULL)
+        by_time = 0;
+    else if ((rest = skip_component(path, TIME_VIEW_AT_DIR)) != NULL)
+        by_time = 1;
+    else
+        return 0;
+
+    if (!*rest) {
+        view->kind = by_time ? TIME_VIEW_AT : TIME_VIEW_SNAPSHOTS;
+        view->path = rest;
+        return 0;
+    }
+
+    rest++;
+    const char *slash = strchr(rest, '/');
+    size_t len = slash ? (size_t) (slash - rest) : strlen(rest);
+    char name[SNAPSHOT_NAME_MAX];
+    if (len == 0 || len >= sizeof(name)) {
+        errno = ENOENT;
+        return -1;
+    }
+    memcpy(name, rest, len);
+    name[len] = '\0';
+
+    if (by_time) {
+        // Digits only, so each moment has exactly one name
+        char *end;
+        errno = 0;
+        long long moment = isdigit((unsigned char) name[0]) ? strtoll(name, &end, 10) : -1;
+        if (moment < 0 || errno != 0 || *end || moment >= (long long) time(NULL)) {
+            errno = ENOENT;
+            return -1;
+        }
+        view->time = moment;
+    } else {
+        Snapshot snapshot;
+        if (snapshot_find(name, &snapshot) != 0) {
+            errno = ENOENT;
+            return -1;
+        }
+        view->epoch = snapshot.epoch;
+        view->time = snapshot.timestamp;
+    }
+    view->kind = TIME_VIEW_TREE;
+    view->by_time = by_time;
+    view->path = slash ? slash + 1 : "";
+    return 0;
+}
+
+// The version of a file that a view shows, or NULL if it had none then.
+const VersionInfo *time_view_version(const TimeView *view, const FileMetadata *metadata) {
+    if (!view || !metadata) return NULL;
+    return view->by_time ? find_version_at_time(metadata, view->time)
+                         : find_version_before_epoch(metadata, view->epoch);
+}
+
+// Resolve a file inside a view to the stored version it shows and that
+// version's attributes: the file's own, minus write permission, with the
+// version's size and commit time. Returns 0 or -ENOENT.
+int time_view_file(const TimeView *view, int *version_id, struct stat *stbuf) {
+    if (!view || view->kind != TIME_VIEW_TREE || !*view->path || !stbuf) return -ENOENT;
+
+    path_lock_read(view->path);
+    FileMetadata *metadata = metadata_cache_acquire(view->path);
+    if (!metadata) {
+        path_unlock(view->path);
+        return -ENOENT;
+    }
+    const VersionInfo *version = time_view_version(view, metadata);
+    VersionInfo shown = version ? *version : (VersionInfo) { 0, 0, 0, 0, 0, 0 };
+    *stbuf = metadata->attributes;
+    metadata_cache_release(metadata, 0);
+
+    uint64_t size;
+    int data_version = shown.version_id > 0 ? version_data_id(&shown) : 0;
+    int rc = data_version > 0 && version_size(view->path, data_version, &size) == 0 ? 0 : -ENOENT;
+    path_unlock(view->path);
+    if (rc != 0) {
+        memset(stbuf, 0, sizeof(struct stat));
+        return rc;
+    }
+
+    stbuf->st_mode &= ~(mode_t) (S_IWUSR | S_IWGRP | S_IWOTH);
+    stbuf->st_size = (off_t) size;
+    stbuf->st_mtime = stbuf->st_ctime = (time_t) shown.timestamp;
+    if (version_id)
+        *version_id = data_version;
+    return 0;
+}
+
+// Attributes of anything in the virtual trees. The directories are
+// read-only, and a view's root carries the time it shows. Returns 0 or a
+// negative errno.
+int time_view_stat(const TimeView *view, struct stat *stbuf) {
+    if (!view || !stbuf || view->kind == TIME_VIEW_NONE) return -EINVAL;
+
+    memset(stbuf, 0, sizeof(struct stat));
+    if (view->kind == TIME_VIEW_TREE && *view->path) {
+        if (time_view_file(view, NULL, stbuf) == 0)
+            return 0;
+
+        char dirpath[1024];
+        struct stat st;
+        int len = snprintf(dirpath, sizeof(dirpath), "%s/%s", METADATA_DIR, view->path);
+        if (len < 0 || (size_t) len >= sizeof(dirpath) || stat(dirpath, &st) != 0 || !S_ISDIR(st.st_mode))
+            return -ENOENT;
+    }
+
+    stbuf->st_mode = S_IFDIR | 0555;
+    stbuf->st_nlink = 2;
+    if (view->kind == TIME_VIEW_TREE && !*view->path)
+        stbuf->st_mtime = stbuf->st_ctime = (time_t) view->time;
+    return 0;
+}
@@ -1,10 +1,15 @@
 #include "version_info.h"
-#include <stdlib.h>
+#include <stdio.h>
 
-void destroy_version_info(VersionInfo *version) 
+// The stored version holding a version's contents, which is what the
+// version store is asked for.
+int version_data_id(const VersionInfo *version)
 {
-    if (version) 
-    {
-        free(version->data_pointer);
-    }
+    return version->data_version > 0 ? version->data_version : version->version_id;
+}
+
+// Where a version's data lives, relative to the backing directory.
+void version_data_pointer(const char *filename, const VersionInfo *version, char *buf, size_t size)
+{
+    snprintf(buf, size, ".versions/%s/version_%d", filename, version_data_id(version));
 }
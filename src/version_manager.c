@@ -1,59 +1,1337 @@
 #include "version_manager.h"
 #include "metadata_manager.h"
+#include "chunk_store.h"
+#include "chunker.h"
+#include "delta.h"
+#include "codec.h"
+#include "fd_cache.h"
+#include "block_cache.h"
+#include "journal.h"
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
 
 #define VERSIONS_DIR ".versions"
+#define CHUNK_MANIFEST_MAGIC "VFSC"
+#define DELTA_MAGIC "VFSD"
+#define DELTA_ENCODED 0x1
 
-int save_version(const char *filename, const char *data, size_t size, int version_id) {
-    if (!filename || !data) return -1;
+// On-disk layout of a delta version: the header is followed by delta_size
+// bytes of delta against base_version, wrapped in a codec blob when flags
+// has DELTA_ENCODED. Chains always end in a keyframe
+// (a chunk manifest or a whole-file copy) at most VERSION_MAX_DELTA_CHAIN
+// deltas away.
+typedef struct {
+    char magic[4];
+    uint32_t base_version;
+    uint64_t size;
+    uint32_t chain_length;
+    uint32_t flags;
+    uint64_t chain_bytes;
+    uint64_t delta_size;
+} DeltaHeader;
 
-    char dirpath[512];
-    snprintf(dirpath, sizeof(dirpath), "%s/%s", VERSIONS_DIR, filename);
-    if (ensure_directory_exists(dirpath) != 0)
+// On-disk layout of a chunk manifest (.versions/<file>/version_N): the
+// header is followed by chunk_count references into the chunk store, in
+// file order. Identical chunks anywhere in the store are written once.
+typedef struct {
+    char magic[4];
+    uint32_t reserved;
+    uint64_t size;
+    uint64_t chunk_count;
+} ChunkManifestHeader;
+
+typedef struct {
+    unsigned char hash[SHA256_DIGEST_SIZE];
+    uint32_t length;
+    uint32_t flags;
+} ChunkRef;
+
+typedef struct {
+    uint64_t size;
+    uint64_t chunk_count;
+    ChunkRef *chunks;
+} ChunkManifest;
+
+// Returns 0 and fills manifest if filepath is a chunk manifest, 1 if it is
+// some other kind of version, -1 on error.
+static int read_chunk_manifest(const char *filepath, ChunkManifest *manifest) {
+    FILE *file = fopen(filepath, "rb");
+    if (!file) return -1;
+
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0) {
+        fclose(file);
         return -1;
+    }
+    uint64_t filesize = (uint64_t) st.st_size;
 
-    char filepath[1024];
-    snprintf(filepath, sizeof(filepath), "%s/version_%d", dirpath, version_id);
+    ChunkManifestHeader header;
+    if (filesize < sizeof(header) || fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, CHUNK_MANIFEST_MAGIC, 4) != 0 ||
+        filesize != sizeof(header) + header.chunk_count * sizeof(ChunkRef)) {
+        fclose(file);
+        return 1;
+    }
 
+    manifest->size = header.size;
+    manifest->chunk_count = header.chunk_count;
+    manifest->chunks = malloc(header.chunk_count ? header.chunk_count * sizeof(ChunkRef) : 1);
+    if (!manifest->chunks ||
+        fread(manifest->chunks, sizeof(ChunkRef), header.chunk_count, file) != header.chunk_count) {
+        free(manifest->chunks);
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    return 0;
+}
+
+static int write_chunk_manifest(const char *filepath, const ChunkManifest *manifest) {
+    ChunkManifestHeader header;
+    memcpy(header.magic, CHUNK_MANIFEST_MAGIC, 4);
+    header.reserved = 0;
+    header.size = manifest->size;
+    header.chunk_count = manifest->chunk_count;
+
+    if (journal_note_file(filepath) != 0) return -1;
     FILE *file = fopen(filepath, "wb");
     if (!file) return -1;
 
-    size_t written = fwrite(data, 1, size, file);
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             (manifest->chunk_count == 0 ||
+              fwrite(manifest->chunks, sizeof(ChunkRef), manifest->chunk_count, file) == manifest->chunk_count);
+    if (fclose(file) != 0)
+        ok = 0;
+    return ok ? 0 : -1;
+}
+
+// Returns 0 and fills header if filepath is a delta version, 1 if it is a
+// keyframe of some kind, -1 on error.
+static int read_delta_header(const char *filepath, DeltaHeader *header) {
+    FILE *file = fopen(filepath, "rb");
+    if (!file) return -1;
+
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0) {
+        fclose(file);
+        return -1;
+    }
+    uint64_t filesize = (uint64_t) st.st_size;
+
+    int kind = 1;
+    if (filesize >= sizeof(*header) && fread(header, sizeof(*header), 1, file) == 1 &&
+        memcmp(header->magic, DELTA_MAGIC, 4) == 0 &&
+        filesize == sizeof(*header) + header->delta_size)
+        kind = 0;
     fclose(file);
+    return kind;
+}
+
+// Where the bytes of a version being written come from: a base version
+// with pending writes patched over it, or zeros and the writes alone.
+typedef struct VersionIndex VersionIndex;
+
+typedef struct {
+    const VersionIndex *base;
+    VersionOverlay overlay;
+    void *context;
+} VersionSource;
+
+static int write_keyframe(const char *dirpath, int version_id, uint64_t size, const VersionSource *source,
+                          const VersionRange *dirty, int dirty_count);
+
+static int write_delta(const char *filepath, const DeltaHeader *header, const char *delta) {
+    if (journal_note_file(filepath) != 0) return -1;
+    FILE *file = fopen(filepath, "wb");
+    if (!file) return -1;
 
-    return written == size ? 0 : -1;
+    int ok = fwrite(header, sizeof(*header), 1, file) == 1 &&
+             fwrite(delta, 1, header->delta_size, file) == header->delta_size;
+    if (fclose(file) != 0)
+        ok = 0;
+    return ok ? 0 : -1;
 }
 
-char *load_version(const char *filename, int version_id, size_t *out_size) {
-    if (!filename || !out_size) return NULL;
+// The chain a delta against base_version would extend. Returns 1 when it
+// would grow past VERSION_MAX_DELTA_CHAIN and a keyframe is due.
+static int delta_chain(const char *dirpath, int base_version, uint32_t *chain_length, uint64_t *chain_bytes) {
+    char filepath[1024];
+    snprintf(filepath, sizeof(filepath), "%s/version_%d", dirpath, base_version);
+
+    DeltaHeader base;
+    int base_kind = read_delta_header(filepath, &base);
+    if (base_kind < 0)
+        return 1;
+    *chain_length = base_kind == 0 ? base.chain_length + 1 : 1;
+    *chain_bytes = base_kind == 0 ? base.chain_bytes : 0;
+    return *chain_length > VERSION_MAX_DELTA_CHAIN ? 1 : 0;
+}
+
+// Compress a raw delta and write it as version_id. Returns 1 when a
+// keyframe should be written instead.
+static int write_encoded_delta(const char *dirpath, int version_id, int base_version, uint64_t size,
+                               const char *raw_delta, size_t raw_delta_size) {
+    uint32_t chain_length;
+    uint64_t chain_bytes;
+    if (delta_chain(dirpath, base_version, &chain_length, &chain_bytes) != 0)
+        return 1;
+
+    char *delta = NULL;
+    size_t delta_size = 0;
+    if (codec_encode(raw_delta, raw_delta_size, &delta, &delta_size) != 0)
+        return 1;
+
+    // Once replaying the chain reads more than the version itself, a fresh
+    // keyframe is the cheaper way to store it.
+    if (chain_bytes + delta_size >= size) {
+        free(delta);
+        return 1;
+    }
+
+    DeltaHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DELTA_MAGIC, 4);
+    header.base_version = (uint32_t) base_version;
+    header.size = size;
+    header.chain_length = chain_length;
+    header.flags = DELTA_ENCODED;
+    header.chain_bytes = chain_bytes + delta_size;
+    header.delta_size = delta_size;
 
     char filepath[1024];
-    snprintf(filepath, sizeof(filepath), "%s/%s/version_%d", VERSIONS_DIR, filename, version_id);
+    snprintf(filepath, sizeof(filepath), "%s/version_%d", dirpath, version_id);
+    int rc = write_delta(filepath, &header, delta);
+    free(delta);
+    return rc;
+}
 
-    FILE *file = fopen(filepath, "rb");
-    if (!file) return NULL;
+// Parsed form of one stored version, kept in a small cache so ranged reads
+// do not re-read manifests or re-decode deltas on every request.
+typedef enum {
+    VERSION_KIND_WHOLE,
+    VERSION_KIND_CHUNKS,
+    VERSION_KIND_DELTA
+} VersionKind;
+
+struct VersionIndex {
+    char *filename;
+    int version_id;
+    VersionKind kind;
+    uint64_t size;
+    ChunkManifest chunks;
+    uint64_t *chunk_offsets;
+    int base_version;
+    char *delta;
+    DeltaOp *ops;
+    size_t op_count;
+    int refs;
+    int cached;
+    unsigned long last_used;
+};
 
-    fseek(file, 0, SEEK_END);
-    long filesize = ftell(file);
-    rewind(file);
+#define INDEX_CACHE_SIZE 64
 
-    char *data = malloc(filesize);
-    if (!data) {
+static VersionIndex *index_cache[INDEX_CACHE_SIZE];
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long index_tick;
+
+static void free_index(VersionIndex *index) {
+    free(index->filename);
+    free(index->chunks.chunks);
+    free(index->chunk_offsets);
+    free(index->delta);
+    free(index->ops);
+    free(index);
+}
+
+static void version_path(const char *filename, int version_id, char *path, size_t path_size) {
+    snprintf(path, path_size, "%s/%s/version_%d", VERSIONS_DIR, filename, version_id);
+}
+
+static int build_delta_index(const char *filepath, const DeltaHeader *header, VersionIndex *index) {
+    char *delta = malloc(header->delta_size ? header->delta_size : 1);
+    if (!delta) return -1;
+
+    FILE *file = fopen(filepath, "rb");
+    int ok = file && fseek(file, sizeof(*header), SEEK_SET) == 0 &&
+             fread(delta, 1, header->delta_size, file) == header->delta_size;
+    if (file)
         fclose(file);
+    if (!ok) {
+        free(delta);
+        return -1;
+    }
+
+    size_t delta_size = header->delta_size;
+    if (header->flags & DELTA_ENCODED) {
+        BlobHeader blob;
+        char *decoded = NULL;
+        if (delta_size >= sizeof(blob)) {
+            memcpy(&blob, delta, sizeof(blob));
+            decoded = malloc(blob.raw_size ? blob.raw_size : 1);
+        }
+        if (!decoded || codec_decode(delta, delta_size, decoded, blob.raw_size) != 0) {
+            free(decoded);
+            free(delta);
+            return -1;
+        }
+        free(delta);
+        delta = decoded;
+        delta_size = blob.raw_size;
+    }
+
+    uint64_t target_size;
+    if (delta_index(delta, delta_size, &index->ops, &index->op_count, &target_size) != 0 ||
+        target_size != header->size || (int) header->base_version >= index->version_id) {
+        free(delta);
+        return -1;
+    }
+    index->delta = delta;
+    index->base_version = (int) header->base_version;
+    index->size = header->size;
+    return 0;
+}
+
+static VersionIndex *build_index(const char *filename, int version_id) {
+    char filepath[1024];
+    version_path(filename, version_id, filepath, sizeof(filepath));
+
+    VersionIndex *index = calloc(1, sizeof(VersionIndex));
+    if (!index) return NULL;
+    index->filename = strdup(filename);
+    index->version_id = version_id;
+    if (!index->filename) {
+        free_index(index);
         return NULL;
     }
 
-    size_t read_size = fread(data, 1, filesize, file);
-    fclose(file);
+    DeltaHeader delta_header;
+    int kind = read_delta_header(filepath, &delta_header);
+    if (kind == 0) {
+        index->kind = VERSION_KIND_DELTA;
+        if (build_delta_index(filepath, &delta_header, index) != 0)
+            kind = -1;
+    } else if (kind > 0) {
+        kind = read_chunk_manifest(filepath, &index->chunks);
+        if (kind == 0) {
+            index->kind = VERSION_KIND_CHUNKS;
+            index->size = index->chunks.size;
+            index->chunk_offsets = malloc((index->chunks.chunk_count + 1) * sizeof(uint64_t));
+            if (!index->chunk_offsets) {
+                kind = -1;
+            } else {
+                uint64_t offset = 0;
+                for (uint64_t i = 0; i < index->chunks.chunk_count; i++) {
+                    index->chunk_offsets[i] = offset;
+                    offset += index->chunks.chunks[i].length;
+                }
+                index->chunk_offsets[index->chunks.chunk_count] = offset;
+                if (offset != index->size)
+                    kind = -1;
+            }
+        }
+    }
+    if (kind > 0) {
+        // Versions written before chunk storage existed are plain copies.
+        struct stat st;
+        if (stat(filepath, &st) == 0) {
+            index->kind = VERSION_KIND_WHOLE;
+            index->size = (uint64_t) st.st_size;
+            kind = 0;
+        } else {
+            kind = -1;
+        }
+    }
+
+    if (kind != 0) {
+        free_index(index);
+        return NULL;
+    }
+    return index;
+}
+
+static VersionIndex *acquire_index(const char *filename, int version_id) {
+    pthread_mutex_lock(&index_lock);
+    for (int i = 0; i < INDEX_CACHE_SIZE; i++) {
+        VersionIndex *index = index_cache[i];
+        if (index && index->version_id == version_id && strcmp(index->filename, filename) == 0) {
+            index->refs++;
+            index->last_used = ++index_tick;
+            pthread_mutex_unlock(&index_lock);
+            return index;
+        }
+    }
+    pthread_mutex_unlock(&index_lock);
+
+    VersionIndex *index = build_index(filename, version_id);
+    if (!index) return NULL;
+    index->refs = 1;
+
+    pthread_mutex_lock(&index_lock);
+    int victim = 0;
+    for (int i = 0; i < INDEX_CACHE_SIZE; i++) {
+        if (!index_cache[i]) {
+            victim = i;
+            break;
+        }
+        if (index_cache[i]->last_used < index_cache[victim]->last_used)
+            victim = i;
+    }
+    VersionIndex *evicted = index_cache[victim];
+    if (evicted) {
+        evicted->cached = 0;
+        if (evicted->refs == 0)
+            free_index(evicted);
+    }
+    index->cached = 1;
+    index->last_used = ++index_tick;
+    index_cache[victim] = index;
+    pthread_mutex_unlock(&index_lock);
+    return index;
+}
+
+static void release_index(VersionIndex *index) {
+    pthread_mutex_lock(&index_lock);
+    index->refs--;
+    if (index->refs == 0 && !index->cached)
+        free_index(index);
+    pthread_mutex_unlock(&index_lock);
+}
+
+int version_size(const char *filename, int version_id, uint64_t *size) {
+    VersionIndex *index = acquire_index(filename, version_id);
+    if (!index) return -1;
+    *size = index->size;
+    release_index(index);
+    return 0;
+}
+
+// Whether version_id of a file is stored completely and is size bytes
+// long, for checking commits that may not have reached the disk. A delta's
+// base is only checked to be readable; chunks must all be present.
+int version_verify(const char *filename, int version_id, uint64_t size) {
+    if (!filename) return 0;
+
+    VersionIndex *index = build_index(filename, version_id);
+    if (!index) return 0;
+
+    int complete = index->size == size;
+    if (complete && index->kind == VERSION_KIND_CHUNKS) {
+        for (uint64_t i = 0; complete && i < index->chunks.chunk_count; i++) {
+            const ChunkRef *ref = &index->chunks.chunks[i];
+            complete = chunk_store_contains(ref->hash, ref->flags, ref->length);
+        }
+    } else if (complete && index->kind == VERSION_KIND_DELTA) {
+        uint64_t base_size;
+        complete = version_size(filename, index->base_version, &base_size) == 0;
+    }
+    free_index(index);
+    return complete;
+}
+
+// Bytes at the start and end of a delta's target copied from the same
+// place in its base, read off the instructions.
+static void delta_shared_ends(const VersionIndex *delta, uint64_t base_size, uint64_t *prefix, uint64_t *suffix) {
+    uint64_t head = 0;
+    for (size_t i = 0; i < delta->op_count; i++) {
+        const DeltaOp *op = &delta->ops[i];
+        if (op->op != DELTA_OP_COPY || op->target_offset != head || op->source_offset != head)
+            break;
+        head += op->length;
+    }
+    uint64_t tail = 0;
+    for (size_t i = delta->op_count; i > 0; i--) {
+        const DeltaOp *op = &delta->ops[i - 1];
+        if (op->op != DELTA_OP_COPY || op->target_offset + op->length != delta->size - tail ||
+            op->source_offset + op->length != base_size - tail)
+            break;
+        tail += op->length;
+    }
+    *prefix = head;
+    *suffix = tail;
+}
+
+static int same_chunk(const ChunkRef *a, const ChunkRef *b) {
+    return a->length == b->length && memcmp(a->hash, b->hash, SHA256_DIGEST_SIZE) == 0;
+}
+
+// Leading and trailing chunks two manifests have in common.
+static void chunks_shared_ends(const VersionIndex *a, const VersionIndex *b, uint64_t *prefix, uint64_t *suffix) {
+    uint64_t a_count = a->chunks.chunk_count, b_count = b->chunks.chunk_count;
+    uint64_t count = a_count < b_count ? a_count : b_count;
+    uint64_t head = 0;
+    while (head < count && same_chunk(&a->chunks.chunks[head], &b->chunks.chunks[head]))
+        head++;
+    uint64_t tail = 0;
+    while (tail < count - head &&
+           same_chunk(&a->chunks.chunks[a_count - 1 - tail], &b->chunks.chunks[b_count - 1 - tail]))
+        tail++;
+    *prefix = a->chunk_offsets[head];
+    *suffix = a->size - a->chunk_offsets[a_count - tail];
+}
+
+static int shared_ends(VersionIndex *a, VersionIndex *b, uint64_t *prefix, uint64_t *suffix, int depth) {
+    *prefix = *suffix = 0;
+    if (a->version_id == b->version_id) {
+        *prefix = *suffix = a->size;
+        return 0;
+    }
+    if (a->kind == VERSION_KIND_CHUNKS && b->kind == VERSION_KIND_CHUNKS) {
+        chunks_shared_ends(a, b, prefix, suffix);
+        return 0;
+    }
+
+    // Step from the newer delta to its base; what the delta shares with
+    // its base and the base shares with the other version, the two share.
+    VersionIndex *delta = b->kind == VERSION_KIND_DELTA &&
+                          (a->kind != VERSION_KIND_DELTA || b->version_id > a->version_id) ? b : a;
+    VersionIndex *other = delta == a ? b : a;
+    if (delta->kind != VERSION_KIND_DELTA || depth > 2 * (VERSION_MAX_DELTA_CHAIN + 1))
+        return 0;
+    VersionIndex *base = acquire_index(delta->filename, delta->base_version);
+    if (!base) return -1;
+
+    uint64_t head, tail;
+    delta_shared_ends(delta, base->size, &head, &tail);
+    int rc = 0;
+    if (head || tail) {
+        uint64_t base_head, base_tail;
+        rc = shared_ends(base, other, &base_head, &base_tail, depth + 1);
+        *prefix = head < base_head ? head : base_head;
+        *suffix = tail < base_tail ? tail : base_tail;
+    }
+    release_index(base);
+    return rc;
+}
+
+// How many bytes two versions are known to share at their start and at
+// their end, from how they are stored rather than by reading them:
+// matching chunks of chunk manifests, and copies at the same place along
+// delta chains. It may fall short of what they really share, never past
+// it, and the two never overlap in the shorter version.
+int version_shared_ends(const char *filename, int version_a, int version_b, uint64_t *prefix, uint64_t *suffix) {
+    if (!filename || !prefix || !suffix) return -1;
+
+    VersionIndex *a = acquire_index(filename, version_a);
+    if (!a) return -1;
+    VersionIndex *b = acquire_index(filename, version_b);
+    if (!b) {
+        release_index(a);
+        return -1;
+    }
+
+    int rc = shared_ends(a, b, prefix, suffix, 0);
+    if (rc != 0)
+        *prefix = *suffix = 0;
+    uint64_t shorter = a->size < b->size ? a->size : b->size;
+    if (*prefix > shorter)
+        *prefix = shorter;
+    if (*suffix > shorter - *prefix)
+        *suffix = shorter - *prefix;
+    release_index(b);
+    release_index(a);
+    return rc;
+}
+
+void version_manager_invalidate(const char *filename) {
+    pthread_mutex_lock(&index_lock);
+    for (int i = 0; i < INDEX_CACHE_SIZE; i++) {
+        VersionIndex *index = index_cache[i];
+        if (!index || strcmp(index->filename, filename) != 0)
+            continue;
+        index_cache[i] = NULL;
+        index->cached = 0;
+        if (index->refs == 0)
+            free_index(index);
+    }
+    pthread_mutex_unlock(&index_lock);
+
+    char prefix[1024];
+    snprintf(prefix, sizeof(prefix), "%s/%s/", VERSIONS_DIR, filename);
+    fd_cache_invalidate_prefix(prefix);
+    block_cache_invalidate(filename);
+}
+
+// Add the chunks of every chunk manifest under dirpath to live. Files and
+// directories removed while the walk runs are skipped; any other failure
+// fails the walk, since a chunk it missed would be swept.
+static int mark_chunks(const char *dirpath, ChunkSet *live) {
+    DIR *d = opendir(dirpath);
+    if (!d)
+        return errno == ENOENT ? 0 : -1;
+
+    int rc = 0;
+    struct dirent *entry;
+    while (rc == 0 && (entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        char path[1024];
+        int len = snprintf(path, sizeof(path), "%s/%s", dirpath, entry->d_name);
+        if (len < 0 || (size_t) len >= sizeof(path)) {
+            rc = -1;
+            break;
+        }
+        if (strcmp(path, CHUNKS_DIR) == 0)
+            continue;
+
+        unsigned char type = entry->d_type;
+        struct stat st;
+        if (type == DT_UNKNOWN) {
+            if (lstat(path, &st) != 0) {
+                rc = errno == ENOENT ? 0 : -1;
+                continue;
+            }
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+
+        if (type == DT_DIR) {
+            rc = mark_chunks(path, live);
+        } else if (type == DT_REG && strncmp(entry->d_name, "version_", 8) == 0) {
+            ChunkManifest manifest;
+            errno = 0;
+            int kind = read_chunk_manifest(path, &manifest);
+            if (kind < 0) {
+                rc = errno == ENOENT ? 0 : -1;
+            } else if (kind == 0) {
+                for (uint64_t i = 0; rc == 0 && i < manifest.chunk_count; i++)
+                    rc = chunk_set_add(live, manifest.chunks[i].hash);
+                free(manifest.chunks);
+            }
+        }
+    }
+    closedir(d);
+    return rc;
+}
+
+// Delete the chunks no stored version refers to any more. Commits must be
+// held off meanwhile (see chunk_store.h). Returns the number deleted.
+long version_manager_collect(void) {
+    ChunkSet *live = chunk_set_create();
+    if (!live)
+        return -1;
+    long removed = mark_chunks(VERSIONS_DIR, live) == 0 ? chunk_store_sweep(live) : -1;
+    chunk_set_destroy(live);
+    return removed;
+}
+
+static int pread_file(const char *path, char *buf, size_t size, off_t offset) {
+    int slot;
+    int fd = fd_cache_open(path, &slot);
+    if (fd < 0) return -1;
+
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, buf + done, size - done, offset + (off_t) done);
+        if (n <= 0)
+            break;
+        done += (size_t) n;
+    }
+    fd_cache_close(fd, slot);
+    return done == size ? 0 : -1;
+}
+
+static int read_index_range(const VersionIndex *index, uint64_t offset, size_t size, char *buf, int depth);
+
+static int read_chunks_range(const VersionIndex *index, uint64_t offset, size_t size, char *buf) {
+    // Binary search for the chunk containing offset.
+    uint64_t lo = 0, hi = index->chunks.chunk_count;
+    while (hi - lo > 1) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (index->chunk_offsets[mid] <= offset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    size_t done = 0;
+    for (uint64_t i = lo; done < size && i < index->chunks.chunk_count; i++) {
+        const ChunkRef *ref = &index->chunks.chunks[i];
+        size_t in_chunk = (size_t) (offset + done - index->chunk_offsets[i]);
+        size_t length = ref->length - in_chunk < size - done ? ref->length - in_chunk : size - done;
+        if (chunk_store_read(ref->hash, ref->flags, ref->length, in_chunk, length, buf + done) != 0)
+            return -1;
+        done += length;
+    }
+    return done == size ? 0 : -1;
+}
+
+static int read_delta_range(const VersionIndex *index, uint64_t offset, size_t size, char *buf, int depth) {
+    size_t lo = 0, hi = index->op_count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->ops[mid].target_offset <= offset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    VersionIndex *base = NULL;
+    int rc = 0;
+    size_t done = 0;
+    for (size_t i = lo; rc == 0 && done < size && i < index->op_count; i++) {
+        const DeltaOp *op = &index->ops[i];
+        uint64_t in_op = offset + done - op->target_offset;
+        size_t length = op->length - in_op < size - done ? (size_t) (op->length - in_op) : size - done;
 
-    if (read_size != filesize) {
+        if (op->op == DELTA_OP_ADD) {
+            memcpy(buf + done, index->delta + op->delta_offset + in_op, length);
+        } else {
+            if (!base)
+                base = acquire_index(index->filename, index->base_version);
+            if (!base || op->source_offset + in_op + length > base->size)
+                rc = -1;
+            else
+                rc = read_index_range(base, op->source_offset + in_op, length, buf + done, depth + 1);
+        }
+        done += length;
+    }
+    if (base)
+        release_index(base);
+    return rc == 0 && done == size ? 0 : -1;
+}
+
+static int read_index_range(const VersionIndex *index, uint64_t offset, size_t size, char *buf, int depth) {
+    if (size == 0)
+        return 0;
+    // Chains are bounded when written; anything deeper is a corrupt store.
+    if (depth > VERSION_MAX_DELTA_CHAIN + 1)
+        return -1;
+
+    switch (index->kind) {
+    case VERSION_KIND_DELTA:
+        return read_delta_range(index, offset, size, buf, depth);
+    case VERSION_KIND_CHUNKS:
+        return read_chunks_range(index, offset, size, buf);
+    case VERSION_KIND_WHOLE: {
+        char filepath[1024];
+        version_path(index->filename, index->version_id, filepath, sizeof(filepath));
+        return pread_file(filepath, buf, size, (off_t) offset);
+    }
+    }
+    return -1;
+}
+
+// One block of a version through the block cache, returned pinned. On a
+// miss the whole block is reconstructed once and offered to the cache.
+static CacheBlock *cached_block(const VersionIndex *index, uint64_t block) {
+    CacheBlock *entry = block_cache_get(index->filename, index->version_id, block);
+    if (entry)
+        return entry;
+
+    uint64_t start = block * BLOCK_CACHE_BLOCK_SIZE;
+    size_t length = index->size - start < BLOCK_CACHE_BLOCK_SIZE ? (size_t) (index->size - start)
+                                                                  : BLOCK_CACHE_BLOCK_SIZE;
+    char *data = malloc(length ? length : 1);
+    if (!data || read_index_range(index, start, length, data, 0) != 0) {
         free(data);
         return NULL;
     }
+    return block_cache_put(index->filename, index->version_id, block, data, length);
+}
+
+static int read_cached_range(const VersionIndex *index, uint64_t offset, size_t size, char *buf) {
+    if (block_cache_budget() == 0)
+        return read_index_range(index, offset, size, buf, 0);
+
+    size_t done = 0;
+    while (done < size) {
+        uint64_t block = (offset + done) / BLOCK_CACHE_BLOCK_SIZE;
+        size_t in_block = (size_t) ((offset + done) % BLOCK_CACHE_BLOCK_SIZE);
+        CacheBlock *entry = cached_block(index, block);
+        if (!entry)
+            return -1;
+
+        size_t block_size;
+        const char *data = block_cache_data(entry, &block_size);
+        size_t length = block_size - in_block < size - done ? block_size - in_block : size - done;
+        memcpy(buf + done, data + in_block, length);
+        block_cache_unpin(entry);
+        done += length;
+    }
+    return 0;
+}
+
+ssize_t load_version_range(const char *filename, int version_id, off_t offset, size_t size, char *buf) {
+    if (!filename || !buf || offset < 0) return -1;
+
+    VersionIndex *index = acquire_index(filename, version_id);
+    if (!index) return -1;
 
-    *out_size = filesize;
+    ssize_t result = 0;
+    if ((uint64_t) offset < index->size) {
+        if (size > index->size - (uint64_t) offset)
+            size = (size_t) (index->size - (uint64_t) offset);
+        result = read_cached_range(index, (uint64_t) offset, size, buf) == 0 ? (ssize_t) size : -1;
+    }
+    release_index(index);
+    return result;
+}
+
+char *load_version(const char *filename, int version_id, size_t *out_size) {
+    if (!filename || !out_size) return NULL;
+
+    VersionIndex *index = acquire_index(filename, version_id);
+    if (!index) return NULL;
+
+    size_t size = (size_t) index->size;
+    char *data = malloc(size ? size : 1);
+    if (data && read_index_range(index, 0, size, data, 0) != 0) {
+        free(data);
+        data = NULL;
+    }
+    release_index(index);
+
+    if (data)
+        *out_size = size;
     return data;
 }
+
+static int read_source(const VersionSource *source, uint64_t offset, char *buf, size_t size) {
+    // Base bytes first, zeros past its end, then the pending writes on top
+    size_t from_base = 0;
+    if (source->base && offset < source->base->size)
+        from_base = source->base->size - offset < size ? (size_t) (source->base->size - offset) : size;
+    if (from_base > 0 && read_index_range(source->base, offset, from_base, buf, 0) != 0)
+        return -1;
+    memset(buf + from_base, 0, size - from_base);
+    return source->overlay ? source->overlay(source->context, buf, size, (off_t) offset) : 0;
+}
+
+static int push_chunk_ref(ChunkManifest *manifest, size_t *capacity, const ChunkRef *ref) {
+    if (manifest->chunk_count == *capacity) {
+        size_t grown = *capacity ? *capacity * 2 : manifest->size / CHUNK_AVG_SIZE + 16;
+        ChunkRef *chunks = realloc(manifest->chunks, grown * sizeof(ChunkRef));
+        if (!chunks)
+            return -1;
+        manifest->chunks = chunks;
+        *capacity = grown;
+    }
+    manifest->chunks[manifest->chunk_count++] = *ref;
+    return 0;
+}
+
+// Write version_id as a chunk manifest, reading the source through a
+// window of VERSION_STREAM_WINDOW bytes so memory stays bounded whatever
+// the file size. A content-defined cut only depends on the bytes since the
+// previous cut, so when the source is a chunked base and the chunking is
+// on one of the base's boundaries, a base chunk no dirty range touches is
+// reused without being read; only the dirty ranges, plus the chunks it
+// takes to fall back in step with the base after each, are chunked again.
+static int write_keyframe(const char *dirpath, int version_id, uint64_t size, const VersionSource *source,
+                          const VersionRange *dirty, int dirty_count) {
+    ChunkManifest manifest = { size, 0, NULL };
+    size_t capacity = 0;
+    uint64_t position = 0;
+    int rc = 0;
+
+    const VersionIndex *base = source->base && source->base->kind == VERSION_KIND_CHUNKS ? source->base : NULL;
+    // The base's last chunk was cut by its end of file, so it only carries
+    // over if the size is unchanged.
+    uint64_t reusable = 0;
+    if (base)
+        reusable = base->size == size ? base->chunks.chunk_count
+                 : base->chunks.chunk_count > 0 ? base->chunks.chunk_count - 1 : 0;
+    uint64_t base_chunk = 0;
+    int next_dirty = 0;
+
+    // The window holds [window_start, window_start + window_size) of the
+    // version.
+    char *window = malloc(VERSION_STREAM_WINDOW);
+    uint64_t window_start = 0;
+    size_t window_size = 0;
+    if (!window)
+        rc = -1;
+
+    while (rc == 0 && position < size) {
+        while (base_chunk < reusable && base->chunk_offsets[base_chunk] < position)
+            base_chunk++;
+        if (base_chunk < reusable && base->chunk_offsets[base_chunk] == position) {
+            uint64_t chunk_end = base->chunk_offsets[base_chunk + 1];
+            while (next_dirty < dirty_count && dirty[next_dirty].offset + dirty[next_dirty].size <= position)
+                next_dirty++;
+            if (chunk_end <= size && (next_dirty == dirty_count || dirty[next_dirty].offset >= chunk_end)) {
+                rc = push_chunk_ref(&manifest, &capacity, &base->chunks.chunks[base_chunk++]);
+                position = chunk_end;
+                continue;
+            }
+        }
+
+        if (position < window_start || position > window_start + window_size) {
+            window_start = position;
+            window_size = 0;
+        }
+        size_t at = (size_t) (position - window_start);
+        size_t available = window_size - at;
+        if (available < CHUNK_MAX_SIZE && window_start + window_size < size) {
+            memmove(window, window + at, available);
+            window_start = position;
+            size_t fill = VERSION_STREAM_WINDOW - available;
+            if (fill > size - window_start - available)
+                fill = (size_t) (size - window_start - available);
+            if (read_source(source, window_start + available, window + available, fill) != 0) {
+                rc = -1;
+                break;
+            }
+            window_size = available + fill;
+            at = 0;
+            available = window_size;
+        }
+
+        ChunkRef ref;
+        memset(&ref, 0, sizeof(ref));
+        size_t length = chunker_next_cut((const unsigned char *) window + at, available);
+        ref.length = (uint32_t) length;
+        if (chunk_store_put(window + at, length, ref.hash, &ref.flags) != 0 ||
+            push_chunk_ref(&manifest, &capacity, &ref) != 0)
+            rc = -1;
+        position += length;
+    }
+    free(window);
+
+    if (rc == 0) {
+        char filepath[1024];
+        snprintf(filepath, sizeof(filepath), "%s/version_%d", dirpath, version_id);
+        rc = write_chunk_manifest(filepath, &manifest);
+    }
+    free(manifest.chunks);
+    return rc;
+}
+
+// Store a version that only differs from its base in a few ranges as a
+// delta built from those ranges: the bytes in them (and any zeros past the
+// base's end) are added, everything else is copied from the base, which is
+// never read. Returns 1 when they are too much of the file for this to pay.
+static int save_dirty_delta(const char *dirpath, int version_id, int base_version, uint64_t size,
+                            const VersionSource *source, const VersionRange *dirty, int dirty_count) {
+    uint64_t base_size = source->base->size;
+    uint64_t copied_end = base_size < size ? base_size : size;
+
+    // Literal bytes: the dirty ranges within the file, and the tail the
+    // base does not reach.
+    uint64_t literal = size - copied_end;
+    for (int i = 0; i < dirty_count && dirty[i].offset < copied_end; i++) {
+        uint64_t end = dirty[i].offset + dirty[i].size;
+        literal += (end < copied_end ? end : copied_end) - dirty[i].offset;
+    }
+    if (literal > VERSION_STREAM_WINDOW || literal > size / 4)
+        return 1;
+
+    char *buf = malloc(literal ? (size_t) literal : 1);
+    DeltaBuilder builder;
+    if (!buf || delta_builder_init(&builder, size) != 0) {
+        free(buf);
+        return -1;
+    }
+
+    int rc = 0;
+    uint64_t position = 0;
+    size_t used = 0;
+    for (int i = 0; rc == 0 && i <= dirty_count; i++) {
+        uint64_t start = i < dirty_count && dirty[i].offset < copied_end ? dirty[i].offset : copied_end;
+        uint64_t end = size;
+        if (start < copied_end) {
+            end = dirty[i].offset + dirty[i].size;
+            if (end > copied_end)
+                end = copied_end;
+        }
+        if (start > position)
+            rc = delta_builder_copy(&builder, position, start - position);
+        if (rc == 0 && end > start) {
+            rc = read_source(source, start, buf + used, (size_t) (end - start));
+            if (rc == 0)
+                rc = delta_builder_add(&builder, buf + used, (size_t) (end - start));
+            used += (size_t) (end - start);
+        }
+        position = end > position ? end : position;
+        if (start == copied_end)
+            break;
+    }
+    free(buf);
+
+    size_t raw_size = 0;
+    char *raw = delta_builder_finish(&builder, &raw_size);
+    if (rc != 0 || !raw) {
+        free(raw);
+        return -1;
+    }
+    rc = write_encoded_delta(dirpath, version_id, base_version, size, raw, raw_size);
+    free(raw);
+    return rc;
+}
+
+// Store a version that rewrites much of a small base as a delta found by
+// matching the two, which catches content that moved. Both fit in a
+// stream window. Returns 1 when a keyframe should be written instead.
+static int save_matched_delta(const char *dirpath, int version_id, int base_version, uint64_t size,
+                              const VersionSource *source) {
+    const VersionIndex *base = source->base;
+    if (size > VERSION_STREAM_WINDOW || base->size > VERSION_STREAM_WINDOW)
+        return 1;
+
+    char *data = malloc(size ? (size_t) size : 1);
+    char *base_data = malloc(base->size ? (size_t) base->size : 1);
+    char *raw = NULL;
+    size_t raw_size = 0;
+    int rc = data && base_data && read_source(source, 0, data, (size_t) size) == 0 &&
+             read_index_range(base, 0, (size_t) base->size, base_data, 0) == 0 &&
+             delta_encode(base_data, (size_t) base->size, data, (size_t) size, &raw, &raw_size) == 0 ? 0 : 1;
+    free(data);
+    free(base_data);
+    if (rc == 0)
+        rc = write_encoded_delta(dirpath, version_id, base_version, size, raw, raw_size);
+    free(raw);
+    return rc;
+}
+
+// Save version_id as base_version with the writes that overlay patches in
+// applied, where nothing outside the dirty ranges (sorted, disjoint)
+// differs from the base, or from zeros past its end. No step holds the
+// whole file: a few writes become a delta built from the dirty ranges
+// alone, a rewrite of a small file a delta matched in memory, and the rest
+// is streamed into a chunk manifest that reuses the base chunks no write
+// touched, so the cost follows the bytes written rather than the file.
+int save_version_overlay(const char *filename, int version_id, int base_version, uint64_t size,
+                         const VersionRange *dirty, int dirty_count, VersionOverlay overlay, void *context) {
+    if (!filename || !overlay || (dirty_count > 0 && !dirty)) return -1;
+
+    char dirpath[512];
+    snprintf(dirpath, sizeof(dirpath), "%s/%s", VERSIONS_DIR, filename);
+    if (ensure_directory_exists(dirpath) != 0 || journal_note_file(dirpath) != 0)
+        return -1;
+
+    VersionIndex *base = NULL;
+    if (base_version > 0 && !(base = acquire_index(filename, base_version)))
+        return -1;
+
+    VersionSource source = { base, overlay, context };
+    int rc = 1;
+    if (base && base_version < version_id) {
+        rc = save_dirty_delta(dirpath, version_id, base_version, size, &source, dirty, dirty_count);
+        if (rc > 0)
+            rc = save_matched_delta(dirpath, version_id, base_version, size, &source);
+    }
+    if (rc > 0)
+        rc = write_keyframe(dirpath, version_id, size, &source, dirty, dirty_count);
+    if (base)
+        release_index(base);
+    return rc;
+}
+
+static VersionExtent *map_push(VersionMap *map) {
+    if (map->count == map->capacity) {
+        int capacity = map->capacity ? map->capacity * 2 : 16;
+        VersionExtent *extents = realloc(map->extents, sizeof(VersionExtent) * capacity);
+        if (!extents)
+            return NULL;
+        map->extents = extents;
+        map->capacity = capacity;
+    }
+    return &map->extents[map->count++];
+}
+
+// Add size bytes at pos of an fd from fd_cache_open, whose reference the
+// map takes over. Runs that continue the previous extent are merged.
+static int map_add_fd(VersionMap *map, int fd, int slot, off_t pos, size_t size) {
+    VersionExtent *last = map->count ? &map->extents[map->count - 1] : NULL;
+    if (last && last->fd == fd && last->pos + (off_t) last->size == pos) {
+        last->size += size;
+        fd_cache_close(fd, slot);
+        return 0;
+    }
+
+    VersionExtent *extent = map_push(map);
+    if (!extent) {
+        fd_cache_close(fd, slot);
+        return -1;
+    }
+    *extent = (VersionExtent) { fd, slot, pos, size, NULL, NULL };
+    return 0;
+}
+
+// Add a copy of size bytes, appended to the previous extent if that one is
+// in memory too.
+static int map_add_copy(VersionMap *map, const char *data, size_t size) {
+    VersionExtent *last = map->count ? &map->extents[map->count - 1] : NULL;
+    if (last && last->fd < 0 && !last->pin) {
+        char *grown = realloc(last->data, last->size + size);
+        if (!grown)
+            return -1;
+        memcpy(grown + last->size, data, size);
+        last->data = grown;
+        last->size += size;
+        return 0;
+    }
+
+    char *copy = malloc(size ? size : 1);
+    if (!copy)
+        return -1;
+    memcpy(copy, data, size);
+    if (version_map_add_data(map, copy, size) != 0) {
+        free(copy);
+        return -1;
+    }
+    return 0;
+}
+
+// Add size bytes of data, which the map takes ownership of.
+int version_map_add_data(VersionMap *map, char *data, size_t size) {
+    if (!map || !data) return -1;
+
+    VersionExtent *extent = map_push(map);
+    if (!extent)
+        return -1;
+    *extent = (VersionExtent) { -1, -1, 0, size, data, NULL };
+    return 0;
+}
+
+void version_map_release(VersionMap *map) {
+    if (!map) return;
+
+    for (int i = 0; i < map->count; i++) {
+        if (map->extents[i].fd >= 0)
+            fd_cache_close(map->extents[i].fd, map->extents[i].slot);
+        if (map->extents[i].pin)
+            block_cache_unpin(map->extents[i].pin);
+        else
+            free(map->extents[i].data);
+    }
+    free(map->extents);
+    memset(map, 0, sizeof(*map));
+}
+
+static int map_file_range(VersionMap *map, const char *path, off_t pos, size_t size) {
+    int slot;
+    int fd = fd_cache_open(path, &slot);
+    if (fd < 0)
+        return -1;
+    return map_add_fd(map, fd, slot, pos, size);
+}
+
+static int map_chunks_range(const VersionIndex *index, uint64_t offset, size_t size, VersionMap *map) {
+    uint64_t lo = 0, hi = index->chunks.chunk_count;
+    while (hi - lo > 1) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (index->chunk_offsets[mid] <= offset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    size_t done = 0;
+    for (uint64_t i = lo; done < size && i < index->chunks.chunk_count; i++) {
+        const ChunkRef *ref = &index->chunks.chunks[i];
+        size_t in_chunk = (size_t) (offset + done - index->chunk_offsets[i]);
+        size_t length = ref->length - in_chunk < size - done ? ref->length - in_chunk : size - done;
+
+        int fd, slot;
+        off_t data_offset;
+        int rc = chunk_store_locate(ref->hash, ref->flags, ref->length, &fd, &slot, &data_offset);
+        if (rc == 0) {
+            rc = map_add_fd(map, fd, slot, data_offset + (off_t) in_chunk, length);
+        } else if (rc > 0) {
+            // Compressed: decode this part into memory.
+            char *buf = malloc(length ? length : 1);
+            rc = buf && chunk_store_read(ref->hash, ref->flags, ref->length, in_chunk, length, buf) == 0 &&
+                 map_add_copy(map, buf, length) == 0 ? 0 : -1;
+            free(buf);
+        }
+        if (rc != 0)
+            return -1;
+        done += length;
+    }
+    return done == size ? 0 : -1;
+}
+
+static int map_index_range(const VersionIndex *index, uint64_t offset, size_t size, VersionMap *map, int depth);
+
+static int map_delta_range(const VersionIndex *index, uint64_t offset, size_t size, VersionMap *map, int depth) {
+    size_t lo = 0, hi = index->op_count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->ops[mid].target_offset <= offset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    VersionIndex *base = NULL;
+    int rc = 0;
+    size_t done = 0;
+    for (size_t i = lo; rc == 0 && done < size && i < index->op_count; i++) {
+        const DeltaOp *op = &index->ops[i];
+        uint64_t in_op = offset + done - op->target_offset;
+        size_t length = op->length - in_op < size - done ? (size_t) (op->length - in_op) : size - done;
+
+        if (op->op == DELTA_OP_ADD) {
+            rc = map_add_copy(map, index->delta + op->delta_offset + in_op, length);
+        } else {
+            if (!base)
+                base = acquire_index(index->filename, index->base_version);
+            if (!base || op->source_offset + in_op + length > base->size)
+                rc = -1;
+            else
+                rc = map_index_range(base, op->source_offset + in_op, length, map, depth + 1);
+        }
+        done += length;
+    }
+    if (base)
+        release_index(base);
+    return rc == 0 && done == size ? 0 : -1;
+}
+
+static int map_index_range(const VersionIndex *index, uint64_t offset, size_t size, VersionMap *map, int depth) {
+    if (size == 0)
+        return 0;
+    if (depth > VERSION_MAX_DELTA_CHAIN + 1)
+        return -1;
+
+    switch (index->kind) {
+    case VERSION_KIND_DELTA:
+        return map_delta_range(index, offset, size, map, depth);
+    case VERSION_KIND_CHUNKS:
+        return map_chunks_range(index, offset, size, map);
+    case VERSION_KIND_WHOLE: {
+        char filepath[1024];
+        version_path(index->filename, index->version_id, filepath, sizeof(filepath));
+        return map_file_range(map, filepath, (off_t) offset, size);
+    }
+    }
+    return -1;
+}
+
+static int map_add_pinned(VersionMap *map, CacheBlock *entry, size_t offset, size_t size) {
+    VersionExtent *extent = map_push(map);
+    if (!extent) {
+        block_cache_unpin(entry);
+        return -1;
+    }
+    *extent = (VersionExtent) { -1, -1, 0, size, (char *) block_cache_data(entry, NULL) + offset, entry };
+    return 0;
+}
+
+// Map a range block by block. Cached blocks are referenced in place. On a
+// miss, blocks stored verbatim stay file references, since the kernel's
+// page cache already keeps those; blocks that need decoding or delta
+// reconstruction are rebuilt once into the cache.
+static int map_cached_range(const VersionIndex *index, uint64_t offset, size_t size, VersionMap *map) {
+    if (block_cache_budget() == 0)
+        return map_index_range(index, offset, size, map, 0);
+
+    size_t done = 0;
+    while (done < size) {
+        uint64_t block = (offset + done) / BLOCK_CACHE_BLOCK_SIZE;
+        size_t in_block = (size_t) ((offset + done) % BLOCK_CACHE_BLOCK_SIZE);
+        size_t length = BLOCK_CACHE_BLOCK_SIZE - in_block < size - done ? BLOCK_CACHE_BLOCK_SIZE - in_block
+                                                                         : size - done;
+
+        CacheBlock *entry = block_cache_get(index->filename, index->version_id, block);
+        if (!entry) {
+            VersionMap part = { NULL, 0, 0 };
+            int verbatim = map_index_range(index, offset + done, length, &part, 0) == 0;
+            for (int i = 0; verbatim && i < part.count; i++)
+                verbatim = part.extents[i].fd >= 0;
+
+            if (verbatim) {
+                // Hand the file references over to map
+                int rc = 0;
+                for (int i = 0; i < part.count; i++) {
+                    VersionExtent *extent = &part.extents[i];
+                    if (rc == 0)
+                        rc = map_add_fd(map, extent->fd, extent->slot, extent->pos, extent->size);
+                    else
+                        fd_cache_close(extent->fd, extent->slot);
+                }
+                free(part.extents);
+                if (rc != 0)
+                    return -1;
+                done += length;
+                continue;
+            }
+            version_map_release(&part);
+
+            entry = cached_block(index, block);
+            if (!entry)
+                return -1;
+        }
+        if (map_add_pinned(map, entry, in_block, length) != 0)
+            return -1;
+        done += length;
+    }
+    return 0;
+}
+
+// Like load_version_range, but appends extents describing the bytes to map
+// instead of copying them. Delta insertions and compressed chunks are
+// served from the block cache; everything else stays a reference into a
+// backing file. On failure map may hold a partial result and must still
+// be released.
+ssize_t map_version_range(const char *filename, int version_id, off_t offset, size_t size, VersionMap *map) {
+    if (!filename || !map || offset < 0) return -1;
+
+    VersionIndex *index = acquire_index(filename, version_id);
+    if (!index) return -1;
+
+    ssize_t result = 0;
+    if ((uint64_t) offset < index->size) {
+        if (size > index->size - (uint64_t) offset)
+            size = (size_t) (index->size - (uint64_t) offset);
+        result = map_cached_range(index, (uint64_t) offset, size, map) == 0 ? (ssize_t) size : -1;
+    }
+    release_index(index);
+    return result;
+}
+
+// Warm the caches for a range of a version that is about to be read:
+// blocks that need decoding are rebuilt into the block cache, and for
+// data stored verbatim the kernel is asked to read the backing files
+// ahead. Best effort; failures are ignored.
+void prefetch_version_range(const char *filename, int version_id, off_t offset, size_t size) {
+    if (!filename || offset < 0) return;
+
+    VersionIndex *index = acquire_index(filename, version_id);
+    if (!index) return;
+
+    if ((uint64_t) offset < index->size) {
+        if (size > index->size - (uint64_t) offset)
+            size = (size_t) (index->size - (uint64_t) offset);
+
+        uint64_t first = (uint64_t) offset / BLOCK_CACHE_BLOCK_SIZE;
+        uint64_t last = ((uint64_t) offset + size - 1) / BLOCK_CACHE_BLOCK_SIZE;
+        for (uint64_t block = first; size > 0 && block <= last; block++) {
+            CacheBlock *entry = block_cache_get(filename, version_id, block);
+            if (entry) {
+                block_cache_unpin(entry);
+                continue;
+            }
+
+            uint64_t start = block * BLOCK_CACHE_BLOCK_SIZE;
+            size_t length = index->size - start < BLOCK_CACHE_BLOCK_SIZE ? (size_t) (index->size - start)
+                                                                          : BLOCK_CACHE_BLOCK_SIZE;
+            VersionMap part = { NULL, 0, 0 };
+            int verbatim = map_index_range(index, start, length, &part, 0) == 0;
+            for (int i = 0; verbatim && i < part.count; i++)
+                verbatim = part.extents[i].fd >= 0;
+            if (verbatim || block_cache_budget() == 0) {
+                for (int i = 0; i < part.count; i++) {
+                    if (part.extents[i].fd >= 0)
+                        posix_fadvise(part.extents[i].fd, part.extents[i].pos, (off_t) part.extents[i].size,
+                                      POSIX_FADV_WILLNEED);
+                }
+            } else {
+                entry = cached_block(index, block);
+                if (entry)
+                    block_cache_unpin(entry);
+            }
+            version_map_release(&part);
+        }
+    }
+    release_index(index);
+}
@@ -0,0 +1,87 @@
+// tests/test.h
+#ifndef TEST_H
+#define TEST_H
+
+#define _XOPEN_SOURCE 700
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "journal.h"
+#include "metadata_manager.h"
+#include "open_file.h"
+
+// Standalone tests: each is a program that runs its checks, reports the
+// ones that fail and exits non-zero if any did. None needs FUSE; the ones
+// that touch the store run in a scratch directory, since the store lives
+// in the working directory.
+static int test_failures;
+
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            test_failures++;                                                         \
+        }                                                                            \
+    } while (0)
+
+static char test_scratch[64];
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void) st;
+    (void) flag;
+    (void) ftw;
+    return remove(path);
+}
+
+// Move into a new, empty scratch directory. Exits if there is none.
+static inline void test_enter_scratch(void) {
+    snprintf(test_scratch, sizeof(test_scratch), "/tmp/vfs-test-XXXXXX");
+    if (!mkdtemp(test_scratch) || chdir(test_scratch) != 0) {
+        perror("scratch directory");
+        exit(2);
+    }
+}
+
+// Remove the scratch directory and report how the checks went.
+static inline int test_finish(void) {
+    if (test_scratch[0] && chdir("/") == 0)
+        nftw(test_scratch, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    if (test_failures)
+        fprintf(stderr, "%d check(s) failed\n", test_failures);
+    return test_failures ? 1 : 0;
+}
+
+// Deterministic bytes, so a failing case can be run again.
+static inline void test_fill(char *buf, size_t size, unsigned int *seed) {
+    for (size_t i = 0; i < size; i++)
+        buf[i] = (char) (rand_r(seed) >> 7);
+}
+
+// Set up an empty store in the scratch directory and open its journal.
+static inline void test_open_store(void) {
+    CHECK(ensure_directory_exists(".versions") == 0 && ensure_directory_exists(".metadata") == 0);
+    CHECK(journal_recover() == 0 && journal_open() == 0);
+}
+
+// Create an empty file, as fs_create does.
+static inline void test_create(const char *filename) {
+    FileMetadata *metadata = create_file_metadata(filename);
+    CHECK(metadata && save_metadata(metadata) == 0);
+    destroy_file_metadata(metadata);
+}
+
+// Write size bytes at offset through a new handle and commit them as one
+// version.
+static inline void test_commit(const char *filename, const char *data, size_t size, off_t offset) {
+    OpenFile *handle = open_file_create(filename);
+    CHECK(handle != NULL);
+    if (!handle)
+        return;
+    CHECK(open_file_write(handle, data, size, offset) == 0);
+    CHECK(open_file_commit(handle) == 0);
+    open_file_destroy(handle);
+}
+
+#endif // TEST_H
@@ -0,0 +1,76 @@
+// tests/test_chunker.c
+#include "test.h"
+#include "chunker.h"
+
+#define DATA_SIZE (4 * 1024 * 1024)
+#define MAX_CUTS (DATA_SIZE / CHUNK_MIN_SIZE + 2)
+
+// Offsets at which data is cut into chunks, checking each chunk's size.
+static size_t cut_all(const char *data, size_t size, size_t *cuts) {
+    size_t count = 0;
+    for (size_t pos = 0; pos < size;) {
+        size_t length = chunker_next_cut((const unsigned char *) data + pos, size - pos);
+        CHECK(length > 0 && length <= size - pos);
+        CHECK(length <= CHUNK_MAX_SIZE);
+        CHECK(length >= CHUNK_MIN_SIZE || pos + length == size);
+        if (length == 0)
+            break;
+        pos += length;
+        cuts[count++] = pos;
+    }
+    return count;
+}
+
+static int has_cut(const size_t *cuts, size_t count, size_t offset) {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cuts[mid] < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < count && cuts[lo] == offset;
+}
+
+int main(void) {
+    unsigned int seed = 1;
+    char *data = malloc(DATA_SIZE + 100);
+    size_t *cuts = malloc(MAX_CUTS * sizeof(size_t));
+    size_t *shifted = malloc(MAX_CUTS * sizeof(size_t));
+    if (!data || !cuts || !shifted)
+        return 2;
+    test_fill(data, DATA_SIZE, &seed);
+
+    // Chunks cover the data and average out near the target size
+    size_t count = cut_all(data, DATA_SIZE, cuts);
+    CHECK(count > 0 && cuts[count - 1] == DATA_SIZE);
+    CHECK(DATA_SIZE / count > CHUNK_AVG_SIZE / 2 && DATA_SIZE / count < CHUNK_AVG_SIZE * 2);
+
+    // Cutting is deterministic and short inputs are a single chunk
+    CHECK(chunker_next_cut((const unsigned char *) data, DATA_SIZE) == cuts[0]);
+    CHECK(chunker_next_cut((const unsigned char *) data, CHUNK_MIN_SIZE - 1) == CHUNK_MIN_SIZE - 1);
+    CHECK(chunker_next_cut((const unsigned char *) data, 1) == 1);
+
+    // Data with no boundary in it is cut at the maximum size
+    char *zeros = calloc(1, 3 * CHUNK_MAX_SIZE);
+    CHECK(zeros && chunker_next_cut((const unsigned char *) zeros, 3 * CHUNK_MAX_SIZE) <= CHUNK_MAX_SIZE);
+    free(zeros);
+
+    // Bytes inserted near the start move the boundaries after them along
+    // with the content instead of changing them
+    memmove(data + 1000 + 100, data + 1000, DATA_SIZE - 1000);
+    test_fill(data + 1000, 100, &seed);
+    size_t shifted_count = cut_all(data, DATA_SIZE + 100, shifted);
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (cuts[i] > 1000 && has_cut(shifted, shifted_count, cuts[i] + 100))
+            kept++;
+    }
+    CHECK(kept + 3 >= count);
+
+    free(data);
+    free(cuts);
+    free(shifted);
+    return test_finish();
+}
@@ -0,0 +1,70 @@
+// tests/test_codec.c
+#include "test.h"
+#include "codec.h"
+
+static void check_round_trip(const char *data, size_t size, int expect_codec) {
+    char *blob = NULL;
+    size_t blob_size = 0;
+    CHECK(codec_encode(data, size, &blob, &blob_size) == 0);
+    if (!blob)
+        return;
+
+    BlobHeader header;
+    memcpy(&header, blob, sizeof(header));
+    CHECK(memcmp(header.magic, CODEC_MAGIC, 4) == 0);
+    CHECK(header.codec == expect_codec);
+    CHECK(header.raw_size == size);
+    CHECK(codec_is_blob(blob, blob_size, size));
+    CHECK(!codec_is_blob(blob, blob_size, size + 1));
+    CHECK(!codec_is_blob(blob, blob_size - 1, size));
+
+    char *out = malloc(size + 1);
+    CHECK(out && codec_decode(blob, blob_size, out, size) == 0);
+    CHECK(out && memcmp(out, data, size) == 0);
+    // A buffer of the wrong size is refused rather than part filled
+    CHECK(out && codec_decode(blob, blob_size, out, size + 1) == -1);
+    free(out);
+    free(blob);
+}
+
+int main(void) {
+    unsigned int seed = 2;
+    size_t size = 256 * 1024;
+    char *random = malloc(size);
+    char *text = malloc(size);
+    if (!random || !text)
+        return 2;
+    test_fill(random, size, &seed);
+    for (size_t i = 0; i < size; i++)
+        text[i] = "the quick brown fox\n"[i % 20];
+
+    CHECK(codec_from_name("none") == CODEC_NONE);
+    CHECK(codec_from_name("fast") == CODEC_FAST);
+    CHECK(codec_from_name("dense") == CODEC_DENSE);
+    CHECK(codec_from_name("lz4") == -1);
+
+    int codecs[] = {CODEC_NONE, CODEC_FAST, CODEC_DENSE};
+    for (int i = 0; i < 3; i++) {
+        codec_set_default(codecs[i]);
+        check_round_trip(text, size, codecs[i]);
+        // Data that does not shrink is stored as it is
+        check_round_trip(random, size, CODEC_NONE);
+        check_round_trip(text, 0, CODEC_NONE);
+        check_round_trip(text, 1, CODEC_NONE);
+    }
+
+    // A corrupted payload fails to decode instead of returning garbage
+    codec_set_default(CODEC_FAST);
+    char *blob;
+    size_t blob_size;
+    CHECK(codec_encode(text, size, &blob, &blob_size) == 0);
+    memset(blob + sizeof(BlobHeader), 0xff, 16);
+    char *out = malloc(size);
+    CHECK(out && codec_decode(blob, blob_size, out, size) == -1);
+    free(out);
+    free(blob);
+
+    free(random);
+    free(text);
+    return test_finish();
+}
@@ -0,0 +1,119 @@
+// tests/test_delta.c
+#include "test.h"
+#include "delta.h"
+#include "version_manager.h"
+
+// Rebuild the target of a delta from its decoded instructions, as ranged
+// reads of a delta version do.
+static char *apply(const char *source, size_t source_size, const char *delta, size_t delta_size,
+                   size_t *out_size) {
+    DeltaOp *ops;
+    size_t op_count;
+    uint64_t target_size;
+    if (delta_index(delta, delta_size, &ops, &op_count, &target_size) != 0)
+        return NULL;
+
+    char *target = malloc(target_size ? target_size : 1);
+    for (size_t i = 0; target && i < op_count; i++) {
+        const DeltaOp *op = &ops[i];
+        if (op->op == DELTA_OP_COPY && op->source_offset + op->length <= source_size) {
+            memcpy(target + op->target_offset, source + op->source_offset, op->length);
+        } else if (op->op == DELTA_OP_ADD) {
+            memcpy(target + op->target_offset, delta + op->delta_offset, op->length);
+        } else {
+            free(target);
+            target = NULL;
+        }
+    }
+    free(ops);
+    *out_size = target_size;
+    return target;
+}
+
+static void check_encode(const char *source, size_t source_size, const char *target, size_t target_size) {
+    char *delta = NULL;
+    size_t delta_size = 0;
+    CHECK(delta_encode(source, source_size, target, target_size, &delta, &delta_size) == 0);
+    size_t size = 0;
+    char *rebuilt = delta ? apply(source, source_size, delta, delta_size, &size) : NULL;
+    CHECK(rebuilt && size == target_size && memcmp(rebuilt, target, size) == 0);
+    free(rebuilt);
+    free(delta);
+}
+
+int main(void) {
+    unsigned int seed = 3;
+    size_t size = 200 * 1024;
+    char *source = malloc(size);
+    char *target = malloc(size + 4096);
+    if (!source || !target)
+        return 2;
+    test_fill(source, size, &seed);
+
+    // Small edits, an insertion, a deletion, unrelated data and empty sides
+    memcpy(target, source, size);
+    test_fill(target + 5000, 10, &seed);
+    test_fill(target + 150000, 300, &seed);
+    check_encode(source, size, target, size);
+    memcpy(target, source, 70000);
+    test_fill(target + 70000, 4096, &seed);
+    memcpy(target + 74096, source + 70000, size - 70000);
+    check_encode(source, size, target, size + 4096);
+    check_encode(source, size, source + 1000, size - 2000);
+    test_fill(target, size, &seed);
+    check_encode(source, size, target, size);
+    check_encode(source, 0, target, size);
+    check_encode(source, size, target, 0);
+
+    // A delta written instruction by instruction reads back the same, and
+    // one that does not add up to its target size is refused
+    DeltaBuilder builder;
+    CHECK(delta_builder_init(&builder, 300) == 0);
+    CHECK(delta_builder_copy(&builder, 1000, 100) == 0);
+    CHECK(delta_builder_add(&builder, target, 100) == 0);
+    CHECK(delta_builder_copy(&builder, 0, 100) == 0);
+    CHECK(delta_builder_add(&builder, target, 1) == -1);
+    size_t delta_size = 0, rebuilt_size = 0;
+    char *delta = delta_builder_finish(&builder, &delta_size);
+    char *rebuilt = delta ? apply(source, size, delta, delta_size, &rebuilt_size) : NULL;
+    CHECK(rebuilt && rebuilt_size == 300);
+    CHECK(rebuilt && memcmp(rebuilt, source + 1000, 100) == 0 && memcmp(rebuilt + 100, target, 100) == 0 &&
+          memcmp(rebuilt + 200, source, 100) == 0);
+    free(rebuilt);
+
+    // Truncated deltas do not index
+    DeltaOp *ops;
+    size_t op_count;
+    uint64_t target_size;
+    CHECK(delta && delta_index(delta, delta_size - 1, &ops, &op_count, &target_size) == -1);
+    free(delta);
+    CHECK(delta_builder_init(&builder, 300) == 0);
+    CHECK(delta_builder_copy(&builder, 0, 200) == 0);
+    CHECK(delta_builder_finish(&builder, &delta_size) == NULL);
+
+    // Through the store: later versions of a file are kept as deltas and
+    // every version still reads back as it was written
+    test_enter_scratch();
+    test_open_store();
+    test_create("file");
+
+    memcpy(target, source, size);
+    test_commit("file", source, size, 0);
+    for (int version = 2; version <= VERSION_MAX_DELTA_CHAIN + 3; version++) {
+        off_t offset = (off_t) (rand_r(&seed) % (size - 64));
+        test_fill(target + offset, 64, &seed);
+        test_commit("file", target + offset, 64, offset);
+    }
+    char *read = malloc(size);
+    CHECK(read && load_version_range("file", VERSION_MAX_DELTA_CHAIN + 3, 0, size, read) == (ssize_t) size);
+    CHECK(read && memcmp(read, target, size) == 0);
+    CHECK(read && load_version_range("file", 1, 0, size, read) == (ssize_t) size);
+    CHECK(read && memcmp(read, source, size) == 0);
+    CHECK(read && load_version_range("file", 3, 1000, 5000, read) == 5000);
+    free(read);
+
+    journal_close();
+    free(source);
+    free(target);
+    return test_finish();
+}
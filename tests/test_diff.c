@@ -0,0 +1,82 @@
+// tests/test_diff.c
+#include "test.h"
+#include "chunker.h"
+#include "diff.h"
+#include "version_manager.h"
+
+static void check_diff(const char *a, const char *b, const char *expected) {
+    size_t size = 0;
+    char *diff = diff_text(a, strlen(a), b, strlen(b), "a", "b", &size);
+    CHECK(diff != NULL);
+    if (!diff)
+        return;
+    if (size != strlen(expected) || memcmp(diff, expected, size) != 0) {
+        fprintf(stderr, "diff of \"%s\" and \"%s\" was:\n%.*s", a, b, (int) size, diff);
+        CHECK(!"diff as expected");
+    }
+    free(diff);
+}
+
+static void check_shared_ends(const char *filename, int version_a, int version_b, uint64_t change_start,
+                              uint64_t change_end, uint64_t size) {
+    uint64_t prefix = 0, suffix = 0;
+    CHECK(version_shared_ends(filename, version_a, version_b, &prefix, &suffix) == 0);
+    // Never past what the versions really share, and not far short of it
+    CHECK(prefix <= change_start && prefix + CHUNK_MAX_SIZE >= change_start);
+    CHECK(suffix <= size - change_end && suffix + CHUNK_MAX_SIZE >= size - change_end);
+}
+
+int main(void) {
+    check_diff("a\nb\nc\n", "a\nb\nc\n", "");
+    check_diff("", "", "");
+    check_diff("a\nb\nc\nd\n", "a\nB\nc\nd\ne\n",
+               "--- a\n+++ b\n@@ -1,4 +1,5 @@\n a\n-b\n+B\n c\n d\n+e\n");
+    check_diff("", "x\n", "--- a\n+++ b\n@@ -0,0 +1 @@\n+x\n");
+    check_diff("x\n", "", "--- a\n+++ b\n@@ -1 +0,0 @@\n-x\n");
+    check_diff("a\nb\n", "a\nb", "--- a\n+++ b\n@@ -1,2 +1,2 @@\n a\n-b\n+b\n\\ No newline at end of file\n");
+    // Changes more than twice the context apart make separate hunks
+    check_diff("1\n2\n3\n4\n5\n6\n7\n8\n9\n10\n11\n12\n", "1\nX\n3\n4\n5\n6\n7\n8\n9\n10\nY\n12\n",
+               "--- a\n+++ b\n@@ -1,5 +1,5 @@\n 1\n-2\n+X\n 3\n 4\n 5\n"
+               "@@ -8,5 +8,5 @@\n 8\n 9\n 10\n-11\n+Y\n 12\n");
+    // Lines that moved are kept where the longest common run is
+    check_diff("a\nb\nc\n", "c\na\nb\n", "--- a\n+++ b\n@@ -1,3 +1,3 @@\n+c\n a\n b\n-c\n");
+
+    // Versions of a file in the store share their ends with each other
+    // as far as their storage shows, and diff as their contents do
+    test_enter_scratch();
+    test_open_store();
+    test_create("file");
+
+    size_t size = 0;
+    char *text = malloc(1024 * 1024);
+    if (!text)
+        return 2;
+    for (int line = 0; size < 1000 * 1000; line++)
+        size += (size_t) sprintf(text + size, "line %06d of the file\n", line);
+    test_commit("file", text, size, 0);
+    test_commit("file", "CHANGED", 7, 500000);
+    test_commit("file", "EDIT", 4, 1000);
+
+    check_shared_ends("file", 1, 2, 500000, 500007, size);
+    check_shared_ends("file", 2, 1, 500000, 500007, size);
+    check_shared_ends("file", 1, 3, 1000, 500007, size);
+    uint64_t prefix = 0, suffix = 0;
+    CHECK(version_shared_ends("file", 2, 2, &prefix, &suffix) == 0 && prefix + suffix <= size);
+
+    size_t diff_size = 0;
+    char *diff = diff_versions("file", 1, 2, &diff_size);
+    const char *expected = "--- file@1\n+++ file@2\n@@ -20831,7 +20831,7 @@\n"
+                           " line 020830 of the file\n line 020831 of the file\n line 020832 of the file\n"
+                           "-line 020833 of the file\n+line 020CHANGEDthe file\n"
+                           " line 020834 of the file\n line 020835 of the file\n line 020836 of the file\n";
+    CHECK(diff && diff_size == strlen(expected) && memcmp(diff, expected, diff_size) == 0);
+    free(diff);
+    diff = diff_versions("file", 3, 3, &diff_size);
+    CHECK(diff && diff_size == 0);
+    free(diff);
+    CHECK(diff_versions("file", 1, 4, &diff_size) == NULL);
+
+    journal_close();
+    free(text);
+    return test_finish();
+}
@@ -0,0 +1,73 @@
+// tests/test_file_metadata.c
+#include "test.h"
+#include "file_metadata.h"
+
+static void add_version(FileMetadata *metadata, int version_id, uint64_t epoch) {
+    VersionInfo *version = append_version(metadata);
+    CHECK(version != NULL);
+    if (version) {
+        version->version_id = version_id;
+        version->epoch = epoch;
+    }
+}
+
+static int version_before(const FileMetadata *metadata, uint64_t epoch) {
+    const VersionInfo *version = find_version_before_epoch(metadata, epoch);
+    return version ? version->version_id : 0;
+}
+
+int main(void) {
+    FileMetadata *metadata = create_file_metadata("file");
+    if (!metadata)
+        return 2;
+
+    // No versions yet
+    CHECK(version_before(metadata, 0) == 0);
+    CHECK(version_before(metadata, 100) == 0);
+    CHECK(find_version_before_epoch(NULL, 100) == NULL);
+
+    // Versions at epochs 10, 20, 20 (never from one file, but ties must
+    // still resolve to the later) and 40
+    add_version(metadata, 1, 10);
+    add_version(metadata, 2, 20);
+    add_version(metadata, 3, 20);
+    add_version(metadata, 4, 40);
+
+    // A version committed at an epoch is not yet current at it
+    CHECK(version_before(metadata, 0) == 0);
+    CHECK(version_before(metadata, 10) == 0);
+    CHECK(version_before(metadata, 11) == 1);
+    CHECK(version_before(metadata, 20) == 1);
+    CHECK(version_before(metadata, 21) == 3);
+    CHECK(version_before(metadata, 40) == 3);
+    CHECK(version_before(metadata, 41) == 4);
+    CHECK(version_before(metadata, UINT64_MAX) == 4);
+
+    // Versions from before epochs existed count as older than any epoch
+    FileMetadata *legacy = create_file_metadata("legacy");
+    if (!legacy)
+        return 2;
+    add_version(legacy, 1, 0);
+    add_version(legacy, 2, 0);
+    add_version(legacy, 3, 5);
+    CHECK(version_before(legacy, 0) == 0);
+    CHECK(version_before(legacy, 1) == 2);
+    CHECK(version_before(legacy, 5) == 2);
+    CHECK(version_before(legacy, 6) == 3);
+
+    // Long lists, at every boundary
+    FileMetadata *many = create_file_metadata("many");
+    if (!many)
+        return 2;
+    for (int i = 1; i <= 1000; i++)
+        add_version(many, i, (uint64_t) i * 3);
+    for (uint64_t epoch = 0; epoch <= 3005; epoch++) {
+        int expected = epoch > 3000 ? 1000 : epoch > 0 ? (int) ((epoch - 1) / 3) : 0;
+        CHECK(version_before(many, epoch) == expected);
+    }
+
+    destroy_file_metadata(metadata);
+    destroy_file_metadata(legacy);
+    destroy_file_metadata(many);
+    return test_finish();
+}
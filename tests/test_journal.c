@@ -0,0 +1,118 @@
+// tests/test_journal.c
+#include "test.h"
+#include "file_metadata.h"
+#include "snapshot.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+static int version_count(const char *filename) {
+    FileMetadata *metadata = load_metadata(filename);
+    if (!metadata)
+        return -1;
+    int count = metadata->version_count;
+    destroy_file_metadata(metadata);
+    return count;
+}
+
+static void commit(const char *filename, char fill, size_t size) {
+    char buf[2048];
+    memset(buf, fill, size);
+    test_commit(filename, buf, size, 0);
+}
+
+// Take a snapshot that a checkpoint leaves only in the snapshot list and
+// one that is still in the journal, then stop as a crash would.
+static void crash_after_snapshots(void) {
+    test_open_store();
+    test_create("snapped");
+    commit("snapped", 'a', 1024);
+    CHECK(snapshot_create("before", NULL) == 0);
+    CHECK(journal_checkpoint() == 0);
+    commit("snapped", 'b', 1024);
+    CHECK(snapshot_create("after", NULL) == 0);
+    commit("snapped", 'c', 1024);
+    _exit(test_failures ? 1 : 0);
+}
+
+// Commit versions and stop as a crash would: the journal has the commits,
+// the cached metadata they went into is never written back.
+static void crash_after_commits(void) {
+    test_open_store();
+    test_create("whole");
+    test_create("lost");
+    test_create("torn");
+    test_create("gone");
+    commit("whole", 'a', 1024);
+    commit("whole", 'b', 2048);
+    commit("lost", 'a', 1024);
+    commit("lost", 'b', 1024);
+    commit("gone", 'a', 1024);
+    CHECK(remove_metadata("gone") == 0 && journal_log_unlink("gone", 1024) == 0);
+    test_create("gone");
+    commit("torn", 'a', 1024);
+    commit("torn", 'b', 1024);
+    _exit(test_failures ? 1 : 0);
+}
+
+int main(void) {
+    test_enter_scratch();
+    CHECK(ensure_directory_exists(".versions") == 0 && ensure_directory_exists(".metadata") == 0);
+
+    pid_t child = fork();
+    if (child == 0)
+        crash_after_commits();
+    int status;
+    CHECK(child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK(version_count("whole") == 0);
+
+    // The data of lost's second version never reached the disk, and the
+    // last record, torn's second commit, was only partly written
+    struct stat st;
+    CHECK(stat(".versions/lost/version_2", &st) == 0 && remove(".versions/lost/version_2") == 0);
+    CHECK(stat(JOURNAL_PATH, &st) == 0 && truncate(JOURNAL_PATH, st.st_size - 10) == 0);
+
+    CHECK(journal_recover() == 0);
+    CHECK(version_count("whole") == 2);
+    CHECK(version_count("lost") == 1);
+    CHECK(version_count("torn") == 1);
+    // Commits of the file before it was unlinked stay with it
+    CHECK(version_count("gone") == 0);
+
+    FileMetadata *metadata = load_metadata("whole");
+    CHECK(metadata && metadata->attributes.st_size == 2048);
+    CHECK(metadata && metadata->version_count == 2 && metadata->version_list[0].epoch > 0 &&
+          metadata->version_list[1].epoch > metadata->version_list[0].epoch);
+    uint64_t last_epoch = metadata && metadata->version_count == 2 ? metadata->version_list[1].epoch : 0;
+    destroy_file_metadata(metadata);
+
+    // Replay empties the journal, so running it again changes nothing,
+    // and epochs carry on from the replayed ones
+    CHECK(stat(JOURNAL_PATH, &st) == 0 && st.st_size == 0);
+    CHECK(journal_recover() == 0);
+    CHECK(version_count("whole") == 2);
+    CHECK(journal_epoch() >= last_epoch);
+
+    // A snapshot survives the checkpoint that drops its journal record,
+    // and one whose list record was torn comes back from the journal
+    child = fork();
+    if (child == 0)
+        crash_after_snapshots();
+    CHECK(child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK(stat(SNAPSHOTS_PATH, &st) == 0 && truncate(SNAPSHOTS_PATH, st.st_size - 10) == 0);
+    CHECK(journal_recover() == 0);
+
+    Snapshot before, after;
+    CHECK(snapshot_find("before", &before) == 0);
+    CHECK(snapshot_find("after", &after) == 0);
+    CHECK(stat(SNAPSHOTS_PATH, &st) == 0 && st.st_size == 2 * (off_t) sizeof(Snapshot));
+    metadata = load_metadata("snapped");
+    CHECK(metadata && metadata->version_count == 3);
+    const VersionInfo *version = find_version_before_epoch(metadata, before.epoch);
+    CHECK(version && version->version_id == 1);
+    version = find_version_before_epoch(metadata, after.epoch);
+    CHECK(version && version->version_id == 2);
+    destroy_file_metadata(metadata);
+
+    return test_finish();
+}
@@ -0,0 +1,64 @@
+// tests/test_open_file.c
+#include "test.h"
+#include "metadata_cache.h"
+#include "version_manager.h"
+
+static int version_count(const char *filename) {
+    FileMetadata *metadata = metadata_cache_acquire(filename);
+    if (!metadata)
+        return -1;
+    int count = metadata->version_count;
+    metadata_cache_release(metadata, 0);
+    return count;
+}
+
+int main(void) {
+    test_enter_scratch();
+    test_open_store();
+    test_create("file");
+
+    // Many writes through one handle, overlapping and out of order, are
+    // read back through it before they are committed
+    char expected[10000];
+    memset(expected, 0, sizeof(expected));
+    OpenFile *handle = open_file_create("file");
+    CHECK(handle != NULL);
+    if (!handle)
+        return test_finish();
+    unsigned int seed = 4;
+    for (int i = 0; i < 200; i++) {
+        char buf[100];
+        size_t size = (size_t) (rand_r(&seed) % sizeof(buf)) + 1;
+        off_t offset = (off_t) (rand_r(&seed) % (sizeof(expected) - size));
+        test_fill(buf, size, &seed);
+        memcpy(expected + offset, buf, size);
+        CHECK(open_file_write(handle, buf, size, offset) == 0);
+    }
+    size_t size = (size_t) handle->size;
+    char read[sizeof(expected)];
+    CHECK(open_file_read(handle, read, sizeof(read), 0) == (int) size);
+    CHECK(memcmp(read, expected, size) == 0);
+    CHECK(version_count("file") == 0);
+
+    // and become exactly one version when it is committed
+    CHECK(open_file_commit(handle) == 0);
+    CHECK(version_count("file") == 1);
+    CHECK(load_version_range("file", 1, 0, size, read) == (ssize_t) size);
+    CHECK(memcmp(read, expected, size) == 0);
+
+    // Committing again with nothing written adds no version
+    CHECK(open_file_commit(handle) >= 0);
+    CHECK(version_count("file") == 1);
+
+    // Later writes go on top of the committed version
+    CHECK(open_file_write(handle, "tail", 4, (off_t) size) == 0);
+    memcpy(expected + size, "tail", 4);
+    CHECK(open_file_commit(handle) == 0);
+    CHECK(version_count("file") == 2);
+    CHECK(load_version_range("file", 2, 0, size + 4, read) == (ssize_t) (size + 4));
+    CHECK(memcmp(read, expected, size + 4) == 0);
+    open_file_destroy(handle);
+
+    journal_close();
+    return test_finish();
+}
@@ -0,0 +1,144 @@
+// tests/test_rollback.c
+#include "test.h"
+#include "metadata_cache.h"
+#include "rollback.h"
+#include "snapshot.h"
+#include "version_manager.h"
+
+static int notified;
+
+static void count_notify(const char *filename, void *context) {
+    (void) filename;
+    (void) context;
+    notified++;
+}
+
+static void make_directory(const char *path) {
+    char dirpath[1024];
+    snprintf(dirpath, sizeof(dirpath), ".metadata/%s", path);
+    CHECK(ensure_directory_exists(dirpath) == 0);
+    snprintf(dirpath, sizeof(dirpath), ".versions/%s", path);
+    CHECK(ensure_directory_exists(dirpath) == 0);
+}
+
+static void commit(const char *filename, char fill, size_t size) {
+    char buf[256];
+    memset(buf, fill, size);
+    test_commit(filename, buf, size, 0);
+}
+
+static int version_count(const char *filename) {
+    FileMetadata *metadata = metadata_cache_acquire(filename);
+    if (!metadata)
+        return -1;
+    int count = metadata->version_count;
+    metadata_cache_release(metadata, 0);
+    return count;
+}
+
+// The latest version reads back as size bytes of fill, from wherever its
+// data is stored.
+static int reads_back(const char *filename, char fill, size_t size) {
+    char buf[256];
+    FileMetadata *metadata = metadata_cache_acquire(filename);
+    int data_version = metadata && metadata->version_count > 0
+                     ? version_data_id(&metadata->version_list[metadata->version_count - 1])
+                     : 0;
+    if (metadata)
+        metadata_cache_release(metadata, 0);
+    if (data_version == 0 || load_version_range(filename, data_version, 0, size, buf) != (ssize_t) size)
+        return 0;
+    for (size_t i = 0; i < size; i++)
+        if (buf[i] != fill)
+            return 0;
+    return 1;
+}
+
+static int roll_back(const char *path) {
+    char target_path[1024];
+    TimeView target;
+    snprintf(target_path, sizeof(target_path), "%s/snap/%s", TIME_VIEW_SNAPSHOTS_DIR, path);
+    if (time_view_parse(target_path, &target) != 0)
+        return -1;
+    notified = 0;
+    return rollback_path(path, &target, count_notify, NULL);
+}
+
+int main(void) {
+    test_enter_scratch();
+    test_open_store();
+    make_directory("dir");
+    make_directory("dir/sub");
+    make_directory("dir/many");
+
+    // Enough files in one directory to fill more than one batch
+    char name[64];
+    for (int i = 0; i < ROLLBACK_BATCH + 10; i++) {
+        snprintf(name, sizeof(name), "dir/many/%d", i);
+        test_create(name);
+        commit(name, 'a', 100);
+    }
+    const char *files[] = { "dir/a", "dir/sub/b", "other" };
+    for (int i = 0; i < 3; i++) {
+        test_create(files[i]);
+        commit(files[i], 'a', 100);
+    }
+    test_create("dir/same");
+    commit("dir/same", 's', 10);
+    CHECK(snapshot_create("snap", NULL) == 0);
+
+    for (int i = 0; i < ROLLBACK_BATCH + 10; i++) {
+        snprintf(name, sizeof(name), "dir/many/%d", i);
+        commit(name, 'b', 200);
+    }
+    for (int i = 0; i < 3; i++) {
+        commit(files[i], 'b', 200);
+        commit(files[i], 'c', 50);
+    }
+    test_create("dir/new");
+    commit("dir/new", 'n', 10);
+
+    // Every file under the directory that changed since the snapshot gets
+    // one version with the data it had then; the rest are left alone
+    CHECK(roll_back("dir") == 0);
+    CHECK(notified == ROLLBACK_BATCH + 12);
+    CHECK(version_count("dir/a") == 4 && reads_back("dir/a", 'a', 100));
+    CHECK(version_count("dir/sub/b") == 4 && reads_back("dir/sub/b", 'a', 100));
+    int all = 1;
+    for (int i = 0; i < ROLLBACK_BATCH + 10; i++) {
+        snprintf(name, sizeof(name), "dir/many/%d", i);
+        all = all && version_count(name) == 3 && reads_back(name, 'a', 100);
+    }
+    CHECK(all);
+    CHECK(version_count("dir/same") == 1);
+    CHECK(version_count("dir/new") == 1 && reads_back("dir/new", 'n', 10));
+    CHECK(version_count("other") == 3 && reads_back("other", 'c', 50));
+
+    FileMetadata *metadata = metadata_cache_acquire("dir/a");
+    CHECK(metadata && metadata->attributes.st_size == 100);
+    CHECK(metadata && metadata->version_count == 4 &&
+          metadata->version_list[3].epoch > metadata->version_list[2].epoch);
+    if (metadata)
+        metadata_cache_release(metadata, 0);
+
+    // Rolling back again changes nothing
+    CHECK(roll_back("dir") == 0);
+    CHECK(notified == 0);
+    CHECK(version_count("dir/a") == 4);
+
+    // A single file, and one that had no version then
+    CHECK(roll_back("other") == 0);
+    CHECK(notified == 1);
+    CHECK(version_count("other") == 4 && reads_back("other", 'a', 100));
+    CHECK(roll_back("dir/new") == -1);
+
+    // The rolled back versions are in the journal, so they survive a crash
+    // that loses the cached metadata
+    journal_close();
+    CHECK(journal_recover() == 0);
+    metadata = load_metadata("dir/sub/b");
+    CHECK(metadata && metadata->version_count == 4 && metadata->attributes.st_size == 100);
+    destroy_file_metadata(metadata);
+
+    return test_finish();
+}